@@ -0,0 +1,445 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+
+#include <ftw.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*
+ * Trace archives are unpacked to memory, not to disk: the decompressor
+ * output is parsed as a tar stream, and each member is copied to an
+ * anonymous memory file. Babeltrace needs random access to every stream at
+ * once, so it is given a temporary directory of symlinks to these files.
+ * Memory files cannot be evicted, only swapped: archives larger than
+ * ARCHIVE_MEMORY once unpacked are rejected, they are to be extracted.
+ */
+
+#define TAR_BLOCK                 (512)
+/* bytes of archive members held in memory files, all archives together */
+#define ARCHIVE_MEMORY            (256ULL*1024*1024)
+
+struct archive {
+	char      *tmpdir;
+	int       *fds;
+	int        nb_fds;
+	int        nb_files;
+};
+
+static struct archive *archives;
+static int nb_archives;
+static uint64_t in_memory;
+/* shard processes exit with a copy of the archives, see shard.c */
+static pid_t owner;
+
+static const struct {
+	const char *suffix;
+	const char *command;   /* NULL for a plain tar */
+} formats[] = {
+	{".tar.gz",  "gzip"},
+	{".tgz",     "gzip"},
+	{".tar.zst", "zstd"},
+	{".tar",     NULL},
+};
+
+static int find_format(const char *path)
+{
+	int i;
+	size_t len = strlen(path), slen;
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++) {
+		slen = strlen(formats[i].suffix);
+		if ((len > slen) &&
+		    (strcmp(&path[len-slen], formats[i].suffix) == 0))
+			return i;
+	}
+	return -1;
+}
+
+int archive_is_archive(const char *path)
+{
+	struct stat st;
+
+	return (find_format(path) >= 0) && !stat(path, &st) &&
+		S_ISREG(st.st_mode);
+}
+
+/* length of the archive name without its suffix */
+size_t archive_base_len(const char *path)
+{
+	size_t len = strlen(path);
+
+	if (!archive_is_archive(path))
+		return len;
+	return len-strlen(formats[find_format(path)].suffix);
+}
+
+int archive_count(void)
+{
+	return nb_archives;
+}
+
+/* run the decompressor, without a shell to interpret the path */
+static FILE *open_stream(const char *path, const char *command, pid_t *pid)
+{
+	int fds[2];
+	FILE *fp;
+
+	*pid = 0;
+	if (!command) {
+		fp = fopen(path, "rb");
+		if (!fp)
+			FATAL("cannot open archive '%s': %s\n", path,
+			      strerror(errno));
+		return fp;
+	}
+
+	if (pipe(fds))
+		FATAL("cannot create pipe: %s\n", strerror(errno));
+	*pid = fork();
+	if (*pid < 0)
+		FATAL("cannot fork: %s\n", strerror(errno));
+	if (*pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execlp(command, command, "-dc", "--", path, (char *)NULL);
+		fprintf(stderr, PFX "cannot run '%s': %s\n", command,
+			strerror(errno));
+		_exit(127);
+	}
+	close(fds[1]);
+	fp = fdopen(fds[0], "rb");
+	assert(fp);
+	return fp;
+}
+
+static void close_stream(FILE *fp, const char *path, pid_t pid)
+{
+	int status;
+
+	fclose(fp);
+	if (pid <= 0)
+		return;
+	if ((waitpid(pid, &status, 0) < 0) || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		FATAL("cannot decompress archive '%s'\n", path);
+}
+
+static int read_block(FILE *fp, char *block)
+{
+	return fread(block, 1, TAR_BLOCK, fp) == TAR_BLOCK ? 0 : -1;
+}
+
+/* numeric header field: octal, or big-endian base-256 for large values */
+static uint64_t parse_number(const char *field, size_t len)
+{
+	size_t i;
+	uint64_t val = 0;
+
+	if ((unsigned char)field[0] & 0x80) {
+		for (i = 1; i < len; i++)
+			val = (val << 8)|(unsigned char)field[i];
+		return val;
+	}
+	for (i = 0; (i < len) && field[i]; i++) {
+		if ((field[i] >= '0') && (field[i] <= '7'))
+			val = (val << 3)|(field[i]-'0');
+	}
+	return val;
+}
+
+/* member path relative to the archive root, NULL if it escapes it */
+static char *member_path(const char *name)
+{
+	char *path, *p;
+
+	while ((name[0] == '.') && (name[1] == '/'))
+		name += 2;
+	if ((name[0] == '/') || (name[0] == '\0'))
+		return NULL;
+
+	path = strdup(name);
+	assert(path);
+	for (p = path; p; p = strchr(p, '/')) {
+		if (*p == '/')
+			p++;
+		if ((p[0] == '.') && (p[1] == '.') &&
+		    ((p[2] == '/') || (p[2] == '\0'))) {
+			free(path);
+			return NULL;
+		}
+	}
+	return path;
+}
+
+static void make_dirs(const char *root, const char *path, int parent_only)
+{
+	char *full, *p;
+	int ret;
+
+	ret = asprintf(&full, "%s/%s", root, path);
+	assert(ret > 0);
+	for (p = full+strlen(root)+1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		if (mkdir(full, 0700) && (errno != EEXIST))
+			FATAL("cannot create '%s': %s\n", full,
+			      strerror(errno));
+		*p = '/';
+	}
+	if (!parent_only && mkdir(full, 0700) && (errno != EEXIST))
+		FATAL("cannot create '%s': %s\n", full, strerror(errno));
+	free(full);
+}
+
+/* copy a member to a memory file linked into the tree */
+static void load_member(struct archive *ar, FILE *fp, const char *path,
+			uint64_t size)
+{
+	int fd, ret;
+	char *link, *target;
+	char buf[64*1024];
+	uint64_t left = size;
+	size_t len;
+	const char *base = strrchr(path, '/');
+
+	make_dirs(ar->tmpdir, path, 1);
+	ret = asprintf(&link, "%s/%s", ar->tmpdir, path);
+	assert(ret > 0);
+	ar->nb_files++;
+
+	if (in_memory+size > ARCHIVE_MEMORY)
+		FATAL("archive members take more than %llu MiB, extract the "
+		      "archive to convert it\n", ARCHIVE_MEMORY >> 20);
+	fd = memfd_create(base ? base+1 : path, 0);
+	if (fd < 0)
+		FATAL("cannot create memory file: %s\n", strerror(errno));
+	in_memory += size;
+
+	while (left) {
+		len = (left < sizeof(buf)) ? left : sizeof(buf);
+		if (fread(buf, 1, len, fp) != len)
+			FATAL("truncated archive member '%s'\n", path);
+		if (write(fd, buf, len) != (ssize_t)len)
+			FATAL("cannot load '%s': %s\n", path, strerror(errno));
+		left -= len;
+	}
+
+	/* skip padding */
+	len = (TAR_BLOCK-(size % TAR_BLOCK)) % TAR_BLOCK;
+	if (len && (fread(buf, 1, len, fp) != len))
+		FATAL("truncated archive member '%s'\n", path);
+
+	ret = asprintf(&target, "/proc/%d/fd/%d", (int)getpid(), fd);
+	assert(ret > 0);
+	if (symlink(target, link))
+		FATAL("cannot link '%s': %s\n", link, strerror(errno));
+	free(link);
+	free(target);
+
+	ar->fds = realloc(ar->fds, sizeof(*ar->fds)*(ar->nb_fds+1));
+	assert(ar->fds);
+	ar->fds[ar->nb_fds++] = fd;
+}
+
+static void skip_member(FILE *fp, uint64_t size)
+{
+	char block[TAR_BLOCK];
+	uint64_t blocks = (size+TAR_BLOCK-1)/TAR_BLOCK;
+
+	while (blocks--)
+		if (read_block(fp, block))
+			FATAL("truncated archive\n");
+}
+
+/* long member name, from a GNU 'L' or a pax 'x' header */
+static char *read_long_name(FILE *fp, uint64_t size, int pax)
+{
+	char *data, *p, *end, *name = NULL;
+	uint64_t padded = (size+TAR_BLOCK-1)/TAR_BLOCK*TAR_BLOCK;
+	unsigned long reclen;
+
+	if (size > 1024*1024)
+		FATAL("oversized archive header\n");
+	data = malloc(padded+1);
+	assert(data);
+	if (fread(data, 1, padded, fp) != padded)
+		FATAL("truncated archive\n");
+	data[size] = '\0';
+
+	if (!pax) {
+		name = strdup(data);
+		assert(name);
+		free(data);
+		return name;
+	}
+
+	/* "<len> <key>=<value>\n" records */
+	for (p = data; p < data+size; p += reclen) {
+		reclen = strtoul(p, &end, 10);
+		if ((end == p) || (*end != ' ') || !reclen ||
+		    (p+reclen > data+size))
+			break;
+		if (strncmp(end+1, "path=", 5) == 0) {
+			free(name);
+			name = strndup(end+6, p+reclen-(end+6)-1);
+			assert(name);
+		}
+	}
+	free(data);
+	return name;
+}
+
+/* babeltrace keeps a descriptor open per stream */
+static void raise_file_limit(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+/* unpack an archive to memory, return the directory to read traces from */
+const char *archive_open(const char *path)
+{
+	int ret;
+	pid_t pid;
+	FILE *fp;
+	uint64_t size;
+	char block[TAR_BLOCK];
+	char *name, *long_name = NULL, *member;
+	struct archive *ar;
+	int format = find_format(path);
+
+	assert(format >= 0);
+	raise_file_limit();
+	/* do not leave the tree behind on FATAL() */
+	if (!nb_archives) {
+		owner = getpid();
+		atexit(archive_close);
+	}
+
+	archives = realloc(archives, sizeof(*archives)*(nb_archives+1));
+	assert(archives);
+	ar = &archives[nb_archives++];
+	memset(ar, 0, sizeof(*ar));
+
+	ret = asprintf(&ar->tmpdir, "%s/lttng2lxt-XXXXXX",
+		       getenv("TMPDIR") ? : "/tmp");
+	assert(ret > 0);
+	if (!mkdtemp(ar->tmpdir))
+		FATAL("cannot create '%s': %s\n", ar->tmpdir, strerror(errno));
+
+	INFO("unpacking archive '%s' to memory\n", path);
+	fp = open_stream(path, formats[format].command, &pid);
+
+	while (read_block(fp, block) == 0) {
+		/* end of archive */
+		if (block[0] == '\0')
+			break;
+
+		size = parse_number(&block[124], 12);
+		switch (block[156]) {
+		case 'L':
+		case 'x':
+			free(long_name);
+			long_name = read_long_name(fp, size, block[156] == 'x');
+			continue;
+		case '0':
+		case '\0':
+		case '5':
+			break;
+		default:
+			/* links, devices and global headers */
+			skip_member(fp, size);
+			free(long_name);
+			long_name = NULL;
+			continue;
+		}
+
+		if (long_name) {
+			name = long_name;
+			long_name = NULL;
+		} else if (block[345]) {
+			/* ustar prefix */
+			ret = asprintf(&name, "%.155s/%.100s", &block[345],
+				       block);
+			assert(ret > 0);
+		} else {
+			ret = asprintf(&name, "%.100s", block);
+			assert(ret > 0);
+		}
+		/* a truncated name could collide with another member */
+		if (strlen(ar->tmpdir)+1+strlen(name) >= PATH_MAX)
+			FATAL("archive member name too long: '%.64s...'\n",
+			      name);
+
+		member = member_path(name);
+		if (!member) {
+			INFO("skipping archive member '%s'\n", name);
+			free(name);
+			skip_member(fp, size);
+			continue;
+		}
+		free(name);
+
+		if (block[156] == '5') {
+			make_dirs(ar->tmpdir, member, 0);
+			skip_member(fp, size);
+		} else {
+			load_member(ar, fp, member, size);
+		}
+		free(member);
+	}
+	free(long_name);
+
+	/* let the decompressor finish the stream */
+	while (fread(block, 1, sizeof(block), fp) > 0)
+		;
+	close_stream(fp, path, pid);
+
+	INFO("loaded %d files from archive '%s'\n", ar->nb_files, path);
+	return ar->tmpdir;
+}
+
+static int remove_entry(const char *fpath, const struct stat *sb,
+			int tflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+void archive_close(void)
+{
+	int i, j;
+	struct archive *ar;
+
+	if (nb_archives && (getpid() != owner))
+		return;
+
+	for (i = 0; i < nb_archives; i++) {
+		ar = &archives[i];
+		/* the tree only holds symlinks, do not follow them */
+		(void)nftw(ar->tmpdir, remove_entry, 10, FTW_DEPTH|FTW_PHYS);
+		for (j = 0; j < ar->nb_fds; j++)
+			close(ar->fds[j]);
+		free(ar->fds);
+		free(ar->tmpdir);
+	}
+	free(archives);
+	archives = NULL;
+	nb_archives = 0;
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# LTTng to GTKwave trace conversion
+#
+# FST output size and conversion speed per decoder and pack type:
+#   make bench TRACES="<lttng_trace_dir|archive> ..." [PACKS="zlib:9 ..."]
+#   make bench-decode [TRACES="..."] [DECODERS="serial -j --native"]
+# Decoding costs the same for every pack type: the differences in time are
+# the cost of packing, and the other way around with a single pack type.
+# Without traces, the benchmark runs on a trace of EVENTS events made by
+# tests/mkctf.py, laid out as lttng-modules writes it.
+#
+
+PROGRAM=${PROGRAM:-./lttng2lxt}
+PACKS=${PACKS:-"zlib zlib:9 fastlz lz4 zstd zstd:19"}
+DECODERS=${DECODERS:-serial}
+EVENTS=${EVENTS:-300000}
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+now_ms() {
+	echo $(($(date +%s%N)/1000000))
+}
+
+if [ $# -eq 0 ]; then
+	python3 "$(dirname "$0")/tests/mkctf.py" --lttng "$OUT/mkctf" \
+		"$EVENTS" || exit 1
+	set -- "$OUT/mkctf"
+fi
+
+printf "%-24s %-9s %-10s %12s %8s %10s\n" trace decoder pack "FST bytes" ms \
+       "input MB/s"
+for trace in "$@"; do
+	input=$(du -sbL "$trace" | cut -f1)
+	for decoder in $DECODERS; do
+		flags=$decoder
+		[ "$decoder" = serial ] && flags=
+		for pack in $PACKS; do
+			type=${pack%%:*}
+			level=
+			[ "$type" != "$pack" ] && level="--pack-level ${pack#*:}"
+			start=$(now_ms)
+			if ! "$PROGRAM" -N $flags --pack "$type" $level \
+			     "$trace" "$OUT/out.fst" "$OUT/out.sav" \
+			     >/dev/null 2>"$OUT/err"; then
+				printf "%-24s %-9s %-10s %s\n" \
+				       "$(basename "$trace")" "$decoder" \
+				       "$pack" "$(tail -n 1 "$OUT/err")"
+				continue
+			fi
+			ms=$(($(now_ms)-start))
+			[ $ms -eq 0 ] && ms=1
+			printf "%-24s %-9s %-10s %12d %8d %10d\n" \
+			       "$(basename "$trace")" "$decoder" "$pack" \
+			       "$(stat -c %s "$OUT/out.fst")" $ms \
+			       $((input*1000/ms/1000000))
+		done
+	done
+done
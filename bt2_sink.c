@@ -0,0 +1,552 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "event.h"
+
+#include <babeltrace2/babeltrace.h>
+
+/*
+ * Babeltrace 2 sink component: 'sink.lttng2lxt.fst' converts the messages of
+ * a babeltrace 2 graph, so that its CTF source, muxer and trimmer replace the
+ * babeltrace 1 reader of ctf.c. For instance:
+ *
+ *   babeltrace2 --plugin-path=. <trace> --begin=<t> \
+ *       --component=sink.lttng2lxt.fst --params='path="out.fst"'
+ *
+ * A graph only runs once: pass 1 runs on the messages, which are spooled to
+ * a temporary file, and pass 2 replays the spool once the graph is done.
+ * Parameters:
+ *   path          FST file to write (mandatory)
+ *   savefile      GTKwave savefile, defaults to the FST file with '.sav'
+ *   absolute-time do not rebase time on the first event (like -a)
+ *   single-pass   convert in a single pass (like -1)
+ *   pack          FST pack type (like --pack)
+ *   pack-level    FST pack level (like --pack-level)
+ *   max-memory    FST writer budget in MiB (like --max-memory)
+ *   verbose       like -v
+ */
+
+#define CLASS_HASH_SIZE           (64)
+
+/* module of an event class, resolved on its first event */
+struct sink_class {
+	const bt_event_class     *cls;
+	const struct ltt_module  *mod;
+	struct sink_class        *next;
+};
+
+/* discarded events and packets, accounted on the next event of a stream */
+struct sink_stream {
+	const bt_stream          *stream;
+	uint64_t                  lost_events;
+	uint64_t                  lost_packets;
+	struct sink_stream       *next;
+};
+
+struct fst_sink {
+	bt_message_iterator      *iterator;
+	char                     *outfile;
+	char                     *savefile;
+	int                       rebase_clock;
+	int                       done;
+	/* pass 2 events, in dispatch order */
+	FILE                     *spool;
+	struct sink_class        *classes[CLASS_HASH_SIZE];
+	struct sink_stream       *streams;
+	struct event_record       rec;
+};
+
+/* modules and the FST writer are process wide */
+static int instances;
+
+static const struct ltt_module *find_class(struct fst_sink *sink,
+					   const bt_event_class *cls)
+{
+	unsigned int h;
+	const char *name;
+	struct sink_class *sc;
+
+	h = ((uintptr_t)cls >> 4) % CLASS_HASH_SIZE;
+	for (sc = sink->classes[h]; sc; sc = sc->next) {
+		if (sc->cls == cls)
+			return sc->mod;
+	}
+
+	sc = calloc(1, sizeof(*sc));
+	assert(sc);
+	sc->cls = cls;
+	name = bt_event_class_get_name(cls);
+	/* filtered out events look like events without module */
+	if (name && !filter_event(name))
+		sc->mod = find_module_by_name(name);
+	sc->next = sink->classes[h];
+	sink->classes[h] = sc;
+	return sc->mod;
+}
+
+static struct sink_stream *find_stream(struct fst_sink *sink,
+				       const bt_stream *stream)
+{
+	struct sink_stream *ss;
+
+	for (ss = sink->streams; ss; ss = ss->next) {
+		if (ss->stream == stream)
+			return ss;
+	}
+
+	ss = calloc(1, sizeof(*ss));
+	assert(ss);
+	ss->stream = stream;
+	ss->next = sink->streams;
+	sink->streams = ss;
+	return ss;
+}
+
+/* the stream object may be reused for another stream once it ended */
+static void end_stream(struct fst_sink *sink, const bt_stream *stream)
+{
+	struct sink_stream **pss, *ss;
+
+	for (pss = &sink->streams; (ss = *pss); pss = &ss->next) {
+		if (ss->stream == stream) {
+			*pss = ss->next;
+			free(ss);
+			return;
+		}
+	}
+}
+
+static int event_cpu(const bt_event *event)
+{
+	const bt_packet *packet;
+	const bt_field *context, *field;
+
+	packet = bt_event_borrow_packet_const(event);
+	context = packet ? bt_packet_borrow_context_field_const(packet) : NULL;
+	field = context ?
+		bt_field_structure_borrow_member_field_by_name_const(context,
+								     "cpu_id") :
+		NULL;
+	if (!field ||
+	    (bt_field_get_class_type(field) !=
+	     BT_FIELD_CLASS_TYPE_UNSIGNED_INTEGER))
+		return 0;
+	return (int)bt_field_integer_unsigned_get_value(field);
+}
+
+/* same as decode_event() of ctf.c: integers and strings, enums skipped */
+static void decode_payload(const bt_event *event, struct event_record *rec)
+{
+	uint64_t i, count;
+	const bt_field *payload, *field;
+	const bt_field_class *fc;
+	const bt_field_class_structure_member *member;
+	struct event_arg *arg;
+
+	rec->source = NULL;
+	rec->nargs = 0;
+	payload = bt_event_borrow_payload_field_const(event);
+	if (!payload)
+		return;
+
+	fc = bt_field_borrow_class_const(payload);
+	count = bt_field_class_structure_get_member_count(fc);
+	for (i = 0; (i < count) && (rec->nargs < MAX_EVENT_ARGS); i++) {
+		arg = &rec->args[rec->nargs];
+		member = bt_field_class_structure_borrow_member_by_index_const(
+			fc, i);
+		field = bt_field_structure_borrow_member_field_by_index_const(
+			payload, i);
+
+		switch (bt_field_get_class_type(field)) {
+
+		case BT_FIELD_CLASS_TYPE_UNSIGNED_INTEGER:
+			arg->value.u64 =
+				bt_field_integer_unsigned_get_value(field);
+			arg->value.type = ARG_U64;
+			break;
+
+		case BT_FIELD_CLASS_TYPE_SIGNED_INTEGER:
+			arg->value.i64 =
+				bt_field_integer_signed_get_value(field);
+			arg->value.type = ARG_I64;
+			break;
+
+		case BT_FIELD_CLASS_TYPE_STRING:
+			/* the CTF source turns character arrays to strings */
+			arg->value.s = record_strdup(rec,
+					bt_field_string_get_value(field));
+			arg->value.type = ARG_STR;
+			break;
+
+		default:
+			continue;
+		}
+		/* the spool copies names, pass 1 uses them right away */
+		arg->name = bt_field_class_structure_member_get_name(member);
+		rec->nargs++;
+	}
+}
+
+static int decode_message(struct fst_sink *sink, const bt_message *msg,
+			  struct event_record *rec)
+{
+	int64_t ns;
+	const char *path;
+	const bt_event *event;
+	const bt_stream *stream;
+	const bt_clock_snapshot *snapshot;
+	struct sink_stream *ss;
+
+	event = bt_message_event_borrow_event_const(msg);
+	rec->mod = find_class(sink, bt_event_borrow_class_const(event));
+	if (!rec->mod)
+		return -1;
+
+	if (!bt_message_event_borrow_stream_class_default_clock_class_const(
+		    msg))
+		FATAL("event '%s' has no clock\n",
+		      bt_event_class_get_name(
+			      bt_event_borrow_class_const(event)));
+	snapshot = bt_message_event_borrow_default_clock_snapshot_const(msg);
+	if (bt_clock_snapshot_get_ns_from_origin(snapshot, &ns) !=
+	    BT_CLOCK_SNAPSHOT_GET_NS_FROM_ORIGIN_STATUS_OK)
+		return -1;
+
+	rec->cpu_id = event_cpu(event);
+	if (filter_cpu(rec->cpu_id))
+		return -1;
+
+	rec->strpos = 0;
+	rec->timestamp = (ns < 0) ? 0 : (uint64_t)ns;
+	rec->host = 0;
+	rec->cpu_id = host_cpu_id(0, rec->cpu_id);
+	rec->name = record_strdup(rec, bt_event_class_get_name(
+					  bt_event_borrow_class_const(event)));
+
+	stream = bt_event_borrow_stream_const(event);
+	ss = find_stream(sink, stream);
+	rec->lost_events = ss->lost_events;
+	rec->lost_packets = ss->lost_packets;
+	rec->lost_channel = NULL;
+	if (ss->lost_events || ss->lost_packets) {
+		path = bt_trace_get_name(bt_stream_borrow_trace_const(stream));
+		rec->lost_channel = lost_channel(0, path ? : "?",
+			bt_stream_class_get_id(
+				bt_stream_borrow_class_const(stream)),
+			rec->cpu_id);
+		ss->lost_events = ss->lost_packets = 0;
+	}
+
+	decode_payload(event, rec);
+	return 0;
+}
+
+static void handle_message(struct fst_sink *sink, const bt_message *msg)
+{
+	uint64_t count;
+	const bt_stream *stream;
+	struct event_record *rec = &sink->rec;
+
+	switch (bt_message_get_type(msg)) {
+
+	case BT_MESSAGE_TYPE_EVENT:
+		if (decode_message(sink, msg, rec))
+			break;
+		if (single_pass) {
+			dispatch_event(rec, 0, sink->rebase_clock);
+			break;
+		}
+		dispatch_event(rec, 1, sink->rebase_clock);
+		record_write(sink->spool, rec);
+		/* the spool does not outlive the process */
+		fwrite(&rec->lost_channel, sizeof(rec->lost_channel), 1,
+		       sink->spool);
+		break;
+
+	case BT_MESSAGE_TYPE_DISCARDED_EVENTS:
+		stream = bt_message_discarded_events_borrow_stream_const(msg);
+		if (bt_message_discarded_events_get_count(msg, &count) ==
+		    BT_PROPERTY_AVAILABILITY_AVAILABLE)
+			find_stream(sink, stream)->lost_events += count;
+		break;
+
+	case BT_MESSAGE_TYPE_DISCARDED_PACKETS:
+		stream = bt_message_discarded_packets_borrow_stream_const(msg);
+		if (bt_message_discarded_packets_get_count(msg, &count) ==
+		    BT_PROPERTY_AVAILABILITY_AVAILABLE)
+			find_stream(sink, stream)->lost_packets += count;
+		break;
+
+	case BT_MESSAGE_TYPE_STREAM_END:
+		end_stream(sink,
+			   bt_message_stream_end_borrow_stream_const(msg));
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* end of the graph: pass 2 from the spool, then the output files */
+static void finish(struct fst_sink *sink)
+{
+	struct event_record *rec = &sink->rec;
+
+	if (!single_pass) {
+		/* flush address symbol conversion pipe */
+		atag_flush();
+		symbol_flush();
+
+		INFO("pass 2: emitting LXT traces\n");
+		lost_reset();
+		if (fflush(sink->spool) || ferror(sink->spool))
+			FATAL("cannot write event spool: %s\n",
+			      strerror(errno));
+		rewind(sink->spool);
+		while (record_read(sink->spool, rec) == 0) {
+			if (fread(&rec->lost_channel,
+				  sizeof(rec->lost_channel), 1,
+				  sink->spool) != 1)
+				break;
+			dispatch_event(rec, 2, sink->rebase_clock);
+		}
+		if (!feof(sink->spool))
+			FATAL("corrupted event spool\n");
+	}
+
+	write_savefile(sink->savefile);
+	save_dump_close();
+	sink->done = 1;
+	INFO("generated '%s'\n", sink->outfile);
+	lost_summary();
+}
+
+static const char *get_string(const bt_value *params, const char *key)
+{
+	const bt_value *value;
+
+	value = bt_value_map_borrow_entry_value_const(params, key);
+	if (!value || !bt_value_is_string(value))
+		return NULL;
+	return bt_value_string_get(value);
+}
+
+static int get_bool(const bt_value *params, const char *key)
+{
+	const bt_value *value;
+
+	value = bt_value_map_borrow_entry_value_const(params, key);
+	if (!value || !bt_value_is_bool(value))
+		return 0;
+	return bt_value_bool_get(value) ? 1 : 0;
+}
+
+/* integers are checked as text, like the command line options */
+static const char *get_int(const bt_value *params, const char *key,
+			   char *buf, size_t size)
+{
+	const bt_value *value;
+
+	value = bt_value_map_borrow_entry_value_const(params, key);
+	if (!value || !bt_value_is_signed_integer(value))
+		return NULL;
+	snprintf(buf, size, "%" PRId64, bt_value_integer_signed_get(value));
+	return buf;
+}
+
+static void free_sink(struct fst_sink *sink)
+{
+	int i;
+	struct sink_class *sc, *next;
+	struct sink_stream *ss, *snext;
+
+	for (i = 0; i < CLASS_HASH_SIZE; i++) {
+		for (sc = sink->classes[i]; sc; sc = next) {
+			next = sc->next;
+			free(sc);
+		}
+	}
+	for (ss = sink->streams; ss; ss = snext) {
+		snext = ss->next;
+		free(ss);
+	}
+	if (sink->spool)
+		fclose(sink->spool);
+	free(sink->outfile);
+	free(sink->savefile);
+	free(sink);
+}
+
+static bt_component_class_initialize_method_status fst_initialize(
+	bt_self_component_sink *self_component_sink,
+	bt_self_component_sink_configuration *configuration,
+	const bt_value *params, void *initialize_method_data)
+{
+	int ret;
+	size_t len;
+	const char *path, *savefile, *limit;
+	char level[32], mib[32];
+	long val;
+	struct fst_sink *sink;
+
+	path = get_string(params, "path");
+	if (!path) {
+		DIAG("sink.lttng2lxt.fst needs a 'path' parameter\n");
+		return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_ERROR;
+	}
+	if (instances) {
+		DIAG("only one sink.lttng2lxt.fst per process\n");
+		return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_ERROR;
+	}
+	limit = get_int(params, "max-memory", mib, sizeof(mib));
+	if (limit) {
+		val = strtol(limit, NULL, 10);
+		if (val <= 0) {
+			DIAG("invalid max-memory '%s', expecting MiB\n", limit);
+			return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_ERROR;
+		}
+		memory_limit = (uint64_t)val << 20;
+	}
+
+	sink = calloc(1, sizeof(*sink));
+	assert(sink);
+	sink->outfile = strdup(path);
+	assert(sink->outfile);
+	savefile = get_string(params, "savefile");
+	if (savefile) {
+		sink->savefile = strdup(savefile);
+		assert(sink->savefile);
+	} else {
+		/* "trace.fst" gives "trace.sav" */
+		len = strlen(path);
+		if ((len > 4) && (strcmp(&path[len-4], ".fst") == 0))
+			len -= 4;
+		ret = asprintf(&sink->savefile, "%.*s.sav", (int)len, path);
+		assert(ret > 0);
+	}
+	sink->rebase_clock = !get_bool(params, "absolute-time");
+	single_pass = get_bool(params, "single-pass");
+	save_dump_set_pack(get_string(params, "pack"),
+			   get_int(params, "pack-level", level, sizeof(level)));
+	verbose = get_bool(params, "verbose");
+
+	if (!single_pass) {
+		sink->spool = tmpfile();
+		if (!sink->spool) {
+			DIAG("cannot create event spool: %s\n",
+			     strerror(errno));
+			free_sink(sink);
+			return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_ERROR;
+		}
+	}
+
+	if (bt_self_component_sink_add_input_port(self_component_sink, "in",
+						  NULL, NULL) !=
+	    BT_SELF_COMPONENT_ADD_PORT_STATUS_OK) {
+		free_sink(sink);
+		return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_MEMORY_ERROR;
+	}
+
+	setenv("TZ", "", 1);
+	/* a single host, without offset: see host.c */
+	nb_hosts = 1;
+	if (single_pass) {
+		symbol_set_lazy();
+		task_set_single_pass();
+	}
+	save_dump_init(sink->outfile);
+
+	instances++;
+	bt_self_component_set_data(
+		bt_self_component_sink_as_self_component(self_component_sink),
+		sink);
+	return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_OK;
+}
+
+static void fst_finalize(bt_self_component_sink *self_component_sink)
+{
+	struct fst_sink *sink = bt_self_component_get_data(
+		bt_self_component_sink_as_self_component(self_component_sink));
+
+	/* the graph failed or was interrupted: still close the FST file */
+	if (!sink->done)
+		save_dump_close();
+	BT_MESSAGE_ITERATOR_PUT_REF_AND_RESET(sink->iterator);
+	free_sink(sink);
+	instances--;
+}
+
+static bt_component_class_sink_graph_is_configured_method_status
+fst_graph_is_configured(bt_self_component_sink *self_component_sink)
+{
+	struct fst_sink *sink = bt_self_component_get_data(
+		bt_self_component_sink_as_self_component(self_component_sink));
+	bt_self_component_port_input *port;
+
+	port = bt_self_component_sink_borrow_input_port_by_index(
+		self_component_sink, 0);
+	if (bt_message_iterator_create_from_sink_component(
+		    self_component_sink, port, &sink->iterator) !=
+	    BT_MESSAGE_ITERATOR_CREATE_FROM_SINK_COMPONENT_STATUS_OK)
+		return BT_COMPONENT_CLASS_SINK_GRAPH_IS_CONFIGURED_METHOD_STATUS_ERROR;
+	return BT_COMPONENT_CLASS_SINK_GRAPH_IS_CONFIGURED_METHOD_STATUS_OK;
+}
+
+static bt_component_class_sink_consume_method_status fst_consume(
+	bt_self_component_sink *self_component_sink)
+{
+	uint64_t i, count;
+	bt_message_array_const messages;
+	struct fst_sink *sink = bt_self_component_get_data(
+		bt_self_component_sink_as_self_component(self_component_sink));
+
+	switch (bt_message_iterator_next(sink->iterator, &messages, &count)) {
+
+	case BT_MESSAGE_ITERATOR_NEXT_STATUS_OK:
+		break;
+
+	case BT_MESSAGE_ITERATOR_NEXT_STATUS_END:
+		finish(sink);
+		BT_MESSAGE_ITERATOR_PUT_REF_AND_RESET(sink->iterator);
+		return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_END;
+
+	case BT_MESSAGE_ITERATOR_NEXT_STATUS_AGAIN:
+		return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_AGAIN;
+
+	case BT_MESSAGE_ITERATOR_NEXT_STATUS_MEMORY_ERROR:
+		return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_MEMORY_ERROR;
+
+	default:
+		return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_ERROR;
+	}
+
+	for (i = 0; i < count; i++) {
+		handle_message(sink, messages[i]);
+		bt_message_put_ref(messages[i]);
+	}
+	return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_OK;
+}
+
+BT_PLUGIN_MODULE();
+
+BT_PLUGIN(lttng2lxt);
+BT_PLUGIN_DESCRIPTION("LTTng to GTKwave trace conversion");
+BT_PLUGIN_AUTHOR("Parrot S.A.");
+BT_PLUGIN_LICENSE("MIT");
+
+BT_PLUGIN_SINK_COMPONENT_CLASS(fst, fst_consume);
+BT_PLUGIN_SINK_COMPONENT_CLASS_DESCRIPTION(fst,
+	"Write LTTng events to an FST file and a GTKwave savefile");
+BT_PLUGIN_SINK_COMPONENT_CLASS_INITIALIZE_METHOD(fst, fst_initialize);
+BT_PLUGIN_SINK_COMPONENT_CLASS_FINALIZE_METHOD(fst, fst_finalize);
+BT_PLUGIN_SINK_COMPONENT_CLASS_GRAPH_IS_CONFIGURED_METHOD(fst,
+	fst_graph_is_configured);
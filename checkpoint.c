@@ -0,0 +1,267 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "ctf.h"
+
+#include <time.h>
+
+/*
+ * Checkpoints of long conversions, in '<output>.ckpt'. A resumed conversion
+ * runs pass 1 again, usually from the discovery cache: a checkpoint only
+ * holds what pass 2 changed since. That is the FST writer state at a flushed
+ * block boundary, the trace handles, the state of each module, and the
+ * merge position of the per-stream decoders (-j): each stream seeks back to
+ * its next event, and the merge heap gets its layout back. Events of several
+ * streams at one timestamp come out in the order of an uninterrupted run.
+ */
+
+#define CHECKPOINT_MAGIC          (0x4b58544cU) /* "LTXK" */
+#define CHECKPOINT_VERSION        (4)
+/* the clock is only read every so many timestamps */
+#define CHECKPOINT_EVENTS         (1024)
+
+double checkpoint_interval;
+int checkpoint_resume;
+
+struct state {
+	const char  *name;
+	void       (*save)(FILE *fp);
+	void       (*restore)(FILE *fp);
+};
+
+static struct state *states;
+static int nb_states;
+
+static const char *trace_name;
+static const char *out_name;
+static char *ckpt_name;
+static char *tmp_name;
+static FILE *resume_fp;
+static uint64_t resume_ts;
+
+static uint64_t last_ts;
+static unsigned int nb_events;
+static struct timespec last_time;
+
+static int compare_states(const void *a, const void *b)
+{
+	return strcmp(((struct state *)a)->name, ((struct state *)b)->name);
+}
+
+void register_state(const char *name, void (*save)(FILE *fp),
+		    void (*restore)(FILE *fp))
+{
+	states = realloc(states, sizeof(*states)*(nb_states+1));
+	assert(states);
+	states[nb_states].name = name;
+	states[nb_states].save = save;
+	states[nb_states].restore = restore;
+	nb_states++;
+	/* same order whatever the link order */
+	qsort(states, nb_states, sizeof(*states), compare_states);
+}
+
+void state_put(FILE *fp, const void *data, size_t len)
+{
+	fwrite(data, len, 1, fp);
+}
+
+void state_get(FILE *fp, void *data, size_t len)
+{
+	if (len && (fread(data, len, 1, fp) != 1))
+		FATAL("truncated checkpoint '%s', remove it\n", ckpt_name);
+}
+
+void state_put_str(FILE *fp, const char *s)
+{
+	uint32_t len = strlen(s);
+
+	state_put(fp, &len, sizeof(len));
+	state_put(fp, s, len);
+}
+
+void state_get_str(FILE *fp, char *buf, size_t size)
+{
+	uint32_t len;
+
+	state_get(fp, &len, sizeof(len));
+	if (len >= size)
+		state_error("oversized string");
+	state_get(fp, buf, len);
+	buf[len] = '\0';
+}
+
+void state_error(const char *what)
+{
+	FATAL("checkpoint '%s' does not match this conversion (%s), "
+	      "remove it\n", ckpt_name, what);
+}
+
+/* state of every module, also used for the time shard snapshots */
+void state_save_all(FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < nb_states; i++) {
+		state_put_str(fp, states[i].name);
+		states[i].save(fp);
+	}
+}
+
+void state_restore_all(FILE *fp)
+{
+	int i;
+	char name[LINEBUF_MAX];
+	struct state key = {.name = name}, *state;
+
+	for (i = 0; i < nb_states; i++) {
+		state_get_str(fp, name, sizeof(name));
+		state = bsearch(&key, states, nb_states, sizeof(*states),
+				compare_states);
+		if (!state)
+			state_error(name);
+		state->restore(fp);
+	}
+}
+
+/* with --resume, open the checkpoint of a previous conversion if any */
+void checkpoint_init(const char *trace, const char *outfile)
+{
+	int ret;
+	uint32_t magic, version;
+	char name[LINEBUF_MAX];
+
+	trace_name = trace;
+	out_name = outfile;
+	ret = asprintf(&ckpt_name, "%s.ckpt", outfile);
+	assert(ret > 0);
+	ret = asprintf(&tmp_name, "%s.tmp", ckpt_name);
+	assert(ret > 0);
+	clock_gettime(CLOCK_MONOTONIC, &last_time);
+
+	if (!checkpoint_resume)
+		return;
+
+	resume_fp = fopen(ckpt_name, "rb");
+	if (!resume_fp) {
+		INFO("no checkpoint '%s', converting from the start\n",
+		     ckpt_name);
+		return;
+	}
+
+	state_get(resume_fp, &magic, sizeof(magic));
+	state_get(resume_fp, &version, sizeof(version));
+	if ((magic != CHECKPOINT_MAGIC) || (version != CHECKPOINT_VERSION))
+		state_error("version");
+	state_get_str(resume_fp, name, sizeof(name));
+	if (strcmp(name, trace_name))
+		state_error("trace");
+	state_get(resume_fp, &resume_ts, sizeof(resume_ts));
+}
+
+int checkpoint_resuming(void)
+{
+	return resume_fp != NULL;
+}
+
+/* restore pass 2 state, return the timestamp pass 2 resumes from */
+uint64_t checkpoint_restore(void)
+{
+	uint32_t magic;
+
+	save_dump_resume(out_name, resume_fp);
+	state_restore_all(resume_fp);
+	state_get(resume_fp, &magic, sizeof(magic));
+	if (magic != CHECKPOINT_MAGIC)
+		state_error("trailer");
+
+	fclose(resume_fp);
+	resume_fp = NULL;
+	INFO("resuming from checkpoint '%s'\n", ckpt_name);
+	return resume_ts;
+}
+
+static void checkpoint_save(uint64_t ts)
+{
+	int ret;
+	uint32_t magic = CHECKPOINT_MAGIC, version = CHECKPOINT_VERSION;
+	FILE *fp;
+
+	fp = fopen(tmp_name, "wb");
+	if (!fp) {
+		INFO("cannot write checkpoint '%s': %s\n", tmp_name,
+		     strerror(errno));
+		return;
+	}
+
+	state_put(fp, &magic, sizeof(magic));
+	state_put(fp, &version, sizeof(version));
+	state_put_str(fp, trace_name);
+	state_put(fp, &ts, sizeof(ts));
+
+	/* nothing to resume before the first value change */
+	if (save_dump_checkpoint(fp)) {
+		fclose(fp);
+		unlink(tmp_name);
+		return;
+	}
+
+	state_save_all(fp);
+	state_put(fp, &magic, sizeof(magic));
+
+	/* the checkpoint replaces the previous one once on disk */
+	ret = fflush(fp);
+	ret |= fsync(fileno(fp));
+	ret |= ferror(fp);
+	ret |= fclose(fp);
+	if (ret || rename(tmp_name, ckpt_name)) {
+		INFO("cannot write checkpoint '%s'\n", ckpt_name);
+		unlink(tmp_name);
+		return;
+	}
+	INFO("checkpoint at %" PRIu64 " ns\n", ts-get_clock_base());
+}
+
+/* called with the timestamp of each pass 2 event, before converting it */
+void checkpoint_event(uint64_t ts)
+{
+	struct timespec now;
+	double elapsed;
+
+	if (ts == last_ts)
+		return;
+	last_ts = ts;
+
+	if (++nb_events < CHECKPOINT_EVENTS)
+		return;
+	nb_events = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec-last_time.tv_sec)+
+		(now.tv_nsec-last_time.tv_nsec)/1e9;
+	if (elapsed < checkpoint_interval)
+		return;
+	last_time = now;
+	checkpoint_save(ts);
+}
+
+/* the conversion is complete, there is nothing left to resume */
+void checkpoint_done(void)
+{
+	if (ckpt_name)
+		unlink(ckpt_name);
+	free(ckpt_name);
+	free(tmp_name);
+	ckpt_name = tmp_name = NULL;
+	free(states);
+	states = NULL;
+	nb_states = 0;
+}
@@ -22,18 +22,19 @@ enum {
 static int idle_cpu_state[MAX_CPU];
 static int idle_cpu_preempt[MAX_CPU];
 static struct ltt_trace idle_cpu[MAX_CPU];
+static uint64_t run_start;
+static uint64_t total_run;
 
 void init_cpu(int cpu)
 {
 	init_trace(&idle_cpu[cpu], TG_PROCESS, 0.0+0.001*cpu, TRACE_SYM_F_BITS,
-		   "cpu idle/%d", cpu);
+		   "cpu idle/%d", host_cpu(cpu));
 }
 
-static double emit_cpu_idle_state(double clock, int cpu, union ltt_value val)
+static uint64_t emit_cpu_idle_state(uint64_t clock, int cpu,
+				    union ltt_value val)
 {
-	static double run_start;
-	static double total_run;
-	double ret;
+	uint64_t ret;
 
 	if (val.state) {
 		emit_trace(&idle_cpu[cpu], val);
@@ -64,13 +65,13 @@ static double emit_cpu_idle_state(double clock, int cpu, union ltt_value val)
 	return ret;
 }
 
-void set_cpu_idle(double clock, int cpu)
+void set_cpu_idle(uint64_t clock, int cpu)
 {
 	idle_cpu_state[cpu] = IDLE_IDLE;
 	(void)emit_cpu_idle_state(clock, cpu, (union ltt_value)IDLE_CPU_IDLE);
 }
 
-void set_cpu_running(double clock, int cpu)
+void set_cpu_running(uint64_t clock, int cpu)
 {
 	if (idle_cpu_state[cpu] == IDLE_RUNNING)
 		return;
@@ -79,7 +80,7 @@ void set_cpu_running(double clock, int cpu)
 				  (union ltt_value)IDLE_CPU_RUNNING);
 }
 
-void cpu_preempt(double clock, int cpu)
+void cpu_preempt(uint64_t clock, int cpu)
 {
 	struct task *task;
 
@@ -95,7 +96,7 @@ void cpu_preempt(double clock, int cpu)
 	}
 }
 
-void cpu_unpreempt(double clock, int cpu)
+void cpu_unpreempt(uint64_t clock, int cpu)
 {
 	union ltt_value value;
 	struct task *task;
@@ -111,7 +112,8 @@ void cpu_unpreempt(double clock, int cpu)
 			emit_trace(task->state_trace,
 					(union ltt_value)task->mode);
 		else
-			INFO("cpu unpreempt : no more task for cpu %d at %lf\n", cpu, clock);
+			INFO("cpu unpreempt : no more task for cpu %d at %"
+			     PRIu64 " ns\n", cpu, clock);
 
 		if (idle_cpu_state[cpu] == IDLE_RUNNING) {
 			value.state = IDLE_CPU_RUNNING;
@@ -121,3 +123,20 @@ void cpu_unpreempt(double clock, int cpu)
 		(void)emit_cpu_idle_state(clock, cpu, value);
 	}
 }
+
+static void cpu_idle_save(FILE *fp)
+{
+	state_put(fp, idle_cpu_state, sizeof(idle_cpu_state));
+	state_put(fp, idle_cpu_preempt, sizeof(idle_cpu_preempt));
+	state_put(fp, &run_start, sizeof(run_start));
+	state_put(fp, &total_run, sizeof(total_run));
+}
+
+static void cpu_idle_restore(FILE *fp)
+{
+	state_get(fp, idle_cpu_state, sizeof(idle_cpu_state));
+	state_get(fp, idle_cpu_preempt, sizeof(idle_cpu_preempt));
+	state_get(fp, &run_start, sizeof(run_start));
+	state_get(fp, &total_run, sizeof(total_run));
+}
+STATE(cpu_idle);
@@ -9,6 +9,7 @@
  */
 
 #include "lttng2lxt.h"
+#include "ctf.h"
 
 #include <babeltrace/babeltrace.h>
 #include <babeltrace/ctf/iterator.h>
@@ -16,57 +17,110 @@
 #include <babeltrace/ctf/callbacks.h>
 #include <ftw.h>
 #include <fcntl.h>
+#include <signal.h>
 
 static struct bt_context *ctx;
-static uint32_t tids;
+static int *trace_ids;
+static int nb_trace_ids;
+static char **trace_dirs;
+static int nb_trace_dirs;
+static struct decode_cache cache;
+static uint64_t clock_base;
+static uint64_t event_clock;
+static int event_host;
+/* timestamp a resumed pass 2 starts from, see checkpoint.c */
+static uint64_t resume_ts;
 
-int get_arg(void *args, const char *name, struct arg_value *value)
+/* state at the window start is rebuilt from events this much earlier */
+#define WINDOW_LEAD_IN            (1000000000ULL)
+/* without lttng_statedump_end, a statedump ends after this long a pause */
+#define STATEDUMP_GAP             (1000000000ULL)
+
+static struct time_window window;
+
+/* at most max bytes of s, which may not be terminated */
+const char *record_strndup(struct event_record *rec, const char *s,
+			   size_t max)
 {
-	int ret = 0;
-	struct bt_ctf_event *ctf_event = args;
-	const struct bt_definition *scope;
-	const struct bt_definition *def;
-	const struct bt_declaration *decl;
-	enum ctf_type_id type;
+	char *p;
+	size_t len, room;
 
-	scope = bt_ctf_get_top_level_scope(ctf_event, BT_EVENT_FIELDS);
+	room = sizeof(rec->strbuf)-rec->strpos;
+	if (room == 0)
+		return "";
 
-	def = bt_ctf_get_field(ctf_event, scope, name);
-	if (!def)
-		return -1;
+	len = strnlen(s, max);
+	if (len >= room)
+		len = room-1;
+
+	p = &rec->strbuf[rec->strpos];
+	memcpy(p, s, len);
+	p[len] = '\0';
+	rec->strpos += len+1;
+	return p;
+}
+
+const char *record_strdup(struct event_record *rec, const char *s)
+{
+	return record_strndup(rec, s, strlen(s));
+}
+
+/* copy the strings a record borrows from babeltrace into its buffer */
+void record_keep_strings(struct event_record *rec)
+{
+	int i;
+
+	for (i = 0; i < rec->nargs; i++) {
+		if (rec->args[i].value.type == ARG_STR)
+			rec->args[i].value.s = record_strdup(rec,
+						rec->args[i].value.s);
+	}
+}
+
+/* how to read each payload field, resolved once per event class */
+enum field_kind {
+	FIELD_SKIP,
+	FIELD_I64,
+	FIELD_U64,
+	FIELD_STRING,
+	FIELD_CHAR_ARRAY,
+};
+
+/*
+ * Everything resolved once per event class: its module, and how to read
+ * its payload. Events of classes without module are dropped right away.
+ */
+struct event_class {
+	const struct bt_ctf_event_decl *decl;
+	const struct ltt_module        *mod;
+	unsigned int                    nfields;
+	unsigned char                  *kind;
+	struct event_class             *next;
+};
+
+static enum field_kind field_kind(const struct bt_definition *def)
+{
+	const struct bt_declaration *decl;
+	enum ctf_type_id type;
 
 	decl = bt_ctf_get_decl_from_def(def);
 	if (!decl)
-		return -1;
+		return FIELD_SKIP;
 
 	type = bt_ctf_field_type(decl);
 
 	switch (type) {
 
 	case CTF_TYPE_INTEGER:
-		if (bt_ctf_get_int_signedness(decl)) {
-			value->i64 = bt_ctf_get_int64(def);
-			value->type = ARG_I64;
-		} else {
-			value->u64 = bt_ctf_get_uint64(def);
-			value->type = ARG_U64;
-		}
-		break;
+		if (bt_ctf_get_int_signedness(decl))
+			return FIELD_I64;
+		return FIELD_U64;
 
 	case CTF_TYPE_STRING:
-		value->s = bt_ctf_get_string(def);
-		assert(value->s);
-		value->type = ARG_STR;
-		break;
+		return FIELD_STRING;
 
 	case CTF_TYPE_ARRAY:
-		value->s = bt_ctf_get_char_array(def);
-		if (!value->s) {
-			ret = -1;
-			break;
-		}
-		value->type = ARG_STR;
-		break;
+		return FIELD_CHAR_ARRAY;
 
 	case CTF_TYPE_STRUCT:
 	case CTF_TYPE_UNTAGGED_VARIANT:
@@ -75,11 +129,388 @@ int get_arg(void *args, const char *name, struct arg_value *value)
 	case CTF_TYPE_ENUM:
 	case CTF_TYPE_SEQUENCE:
 	default:
-		DIAG("field '%s' has unsupported CTF type %d\n", name, type);
-		ret = -1;
+		DIAG("field '%s' has unsupported CTF type %d\n",
+		     bt_ctf_field_name(def), type);
+		return FIELD_SKIP;
+	}
+}
+
+static int decode_arg(const struct bt_definition *def, enum field_kind kind,
+		      struct arg_value *value)
+{
+	switch (kind) {
+
+	case FIELD_I64:
+		value->i64 = bt_ctf_get_int64(def);
+		value->type = ARG_I64;
+		break;
+
+	case FIELD_U64:
+		value->u64 = bt_ctf_get_uint64(def);
+		value->type = ARG_U64;
+		break;
+
+	case FIELD_STRING:
+		value->s = bt_ctf_get_string(def);
+		assert(value->s);
+		value->type = ARG_STR;
 		break;
+
+	case FIELD_CHAR_ARRAY:
+		/* NULL unless this is an array of characters */
+		value->s = bt_ctf_get_char_array(def);
+		if (!value->s)
+			return -1;
+		value->type = ARG_STR;
+		break;
+
+	case FIELD_SKIP:
+	default:
+		return -1;
 	}
-	return ret;
+	return 0;
+}
+
+static struct event_class *find_class(struct decode_cache *cache,
+				      const struct bt_ctf_event_decl *decl)
+{
+	unsigned int h;
+	const char *name;
+	struct event_class *cls;
+
+	h = ((uintptr_t)decl >> 4) % CLASS_HASH_SIZE;
+	for (cls = cache->classes[h]; cls; cls = cls->next) {
+		if (cls->decl == decl)
+			return cls;
+	}
+
+	cls = calloc(1, sizeof(*cls));
+	assert(cls);
+	cls->decl = decl;
+	name = bt_ctf_get_decl_event_name(decl);
+	/* filtered out events look like events without module */
+	if (!filter_event(name))
+		cls->mod = find_module_by_name(name);
+	cls->next = cache->classes[h];
+	cache->classes[h] = cls;
+	return cls;
+}
+
+/* resolve modules of all event classes of a newly opened trace */
+void decode_cache_load(struct decode_cache *cache, struct bt_context *ctx,
+		       int handle_id)
+{
+	int ret;
+	unsigned int count, i, id;
+	struct bt_ctf_event_decl * const *list;
+	struct event_class *cls;
+	struct class_table *table;
+
+	cache->ctx = ctx;
+	ret = bt_ctf_get_event_decl_list(handle_id, ctx, &list, &count);
+	if (ret < 0)
+		return;
+
+	if (handle_id >= cache->ntables) {
+		cache->tables = realloc(cache->tables,
+					(handle_id+1)*sizeof(*cache->tables));
+		assert(cache->tables);
+		memset(&cache->tables[cache->ntables], 0,
+		       (handle_id+1-cache->ntables)*sizeof(*cache->tables));
+		cache->ntables = handle_id+1;
+	}
+	table = &cache->tables[handle_id];
+
+	for (i = 0; i < count; i++) {
+		cls = find_class(cache, list[i]);
+		id = (unsigned int)bt_ctf_get_decl_event_id(list[i]);
+		if (id >= table->size) {
+			table->classes = realloc(table->classes, (id+1)*
+						 sizeof(*table->classes));
+			assert(table->classes);
+			memset(&table->classes[table->size], 0,
+			       (id+1-table->size)*sizeof(*table->classes));
+			table->size = id+1;
+		}
+		/* ids are per stream class, the first one wins the slot */
+		if (!table->classes[id])
+			table->classes[id] = cls;
+	}
+}
+
+static struct event_class *lookup_class(struct decode_cache *cache,
+					struct bt_ctf_event *ctf_event)
+{
+	int handle_id;
+	unsigned int id;
+	struct event_class *cls;
+	const struct bt_ctf_event_decl *decl;
+
+	decl = bt_ctf_event_get_decl(ctf_event);
+	handle_id = bt_ctf_event_get_handle_id(ctf_event);
+	id = (unsigned int)bt_ctf_get_decl_event_id(decl);
+
+	if ((handle_id >= 0) && (handle_id < cache->ntables) &&
+	    (id < cache->tables[handle_id].size)) {
+		cls = cache->tables[handle_id].classes[id];
+		if (cls && (cls->decl == decl))
+			return cls;
+	}
+	/* id shared between stream classes, or trace never loaded */
+	return find_class(cache, decl);
+}
+
+static void set_field_kinds(struct event_class *cls,
+			    struct bt_definition const * const *list,
+			    unsigned int count)
+{
+	unsigned int i;
+
+	cls->kind = malloc(count ? count : 1);
+	assert(cls->kind);
+	for (i = 0; i < count; i++)
+		cls->kind[i] = field_kind(list[i]);
+	cls->nfields = count;
+}
+
+void decode_cache_free(struct decode_cache *cache)
+{
+	int i;
+	struct event_class *cls, *next;
+
+	for (i = 0; i < CLASS_HASH_SIZE; i++) {
+		for (cls = cache->classes[i]; cls; cls = next) {
+			next = cls->next;
+			free(cls->kind);
+			free(cls);
+		}
+	}
+	for (i = 0; i < cache->ntables; i++)
+		free(cache->tables[i].classes);
+	free(cache->tables);
+	free(cache->packets);
+	memset(cache, 0, sizeof(*cache));
+}
+
+/* packet context fields are looked up once per stream */
+static struct packet_defs *find_packet(struct decode_cache *cache,
+				       struct bt_ctf_event *ctf_event,
+				       const struct bt_definition *scope)
+{
+	int i;
+	uint64_t stream_id = 0;
+	const char *path;
+	const struct bt_definition *header, *def;
+	struct packet_defs *pkt;
+
+	for (i = 0; i < cache->npackets; i++) {
+		if (cache->packets[i].packet == scope) {
+			cache->cur_packet = i;
+			return &cache->packets[i];
+		}
+	}
+
+	cache->packets = realloc(cache->packets,
+				 sizeof(*cache->packets)*(cache->npackets+1));
+	assert(cache->packets);
+	pkt = &cache->packets[cache->npackets];
+	memset(pkt, 0, sizeof(*pkt));
+
+	pkt->packet = scope;
+	pkt->cpu_id = bt_ctf_get_field(ctf_event, scope, "cpu_id");
+	assert(pkt->cpu_id);
+	pkt->discarded = bt_ctf_get_field(ctf_event, scope,
+					  "events_discarded");
+	pkt->seq_num = bt_ctf_get_field(ctf_event, scope, "packet_seq_num");
+
+	if (pkt->discarded || pkt->seq_num) {
+		header = bt_ctf_get_top_level_scope(ctf_event,
+						    BT_TRACE_PACKET_HEADER);
+		def = header ? bt_ctf_get_field(ctf_event, header,
+						"stream_id") : NULL;
+		if (def)
+			stream_id = bt_ctf_get_uint64(def);
+		path = cache->path;
+		if (!path && cache->ctx)
+			path = bt_trace_handle_get_path(cache->ctx,
+					bt_ctf_event_get_handle_id(ctf_event));
+		pkt->channel = lost_channel(cache->host, path ? : "?",
+				stream_id, (int)bt_ctf_get_uint64(pkt->cpu_id));
+	}
+
+	cache->cur_packet = cache->npackets++;
+	return pkt;
+}
+
+/* everything but the arguments, -1 for events not to convert */
+static int decode_header(struct bt_ctf_event *ctf_event,
+			 struct event_record *rec, struct decode_cache *cache,
+			 struct event_class *cls)
+{
+	const struct bt_definition *scope;
+	struct packet_defs *pkt;
+	uint64_t discarded, seq;
+
+	rec->mod = cls->mod;
+	rec->name = bt_ctf_event_name(ctf_event);
+
+	rec->timestamp = host_clock(cache->host,
+				    bt_ctf_get_timestamp(ctf_event));
+	rec->host = cache->host;
+
+	scope = bt_ctf_get_top_level_scope(ctf_event, BT_STREAM_PACKET_CONTEXT);
+	assert(scope);
+	if (cache->npackets &&
+	    (cache->packets[cache->cur_packet].packet == scope))
+		pkt = &cache->packets[cache->cur_packet];
+	else
+		pkt = find_packet(cache, ctf_event, scope);
+	rec->cpu_id = (int)bt_ctf_get_uint64(pkt->cpu_id);
+
+	/* the stream gap accounting sees every packet, filtered or not */
+	rec->lost_events = rec->lost_packets = 0;
+	rec->lost_channel = NULL;
+	if (pkt->channel) {
+		discarded = pkt->discarded ?
+			bt_ctf_get_uint64(pkt->discarded) : 0;
+		seq = pkt->seq_num ? bt_ctf_get_uint64(pkt->seq_num) : 0;
+		if (cache->defer_lost) {
+			cache->counters.channel = pkt->channel;
+			cache->counters.discarded = discarded;
+			cache->counters.seq = seq;
+			cache->counters.has_seq = pkt->seq_num != NULL;
+		} else {
+			lost_check(pkt->channel, discarded,
+				   pkt->seq_num != NULL, seq, rec);
+		}
+	}
+	if (filter_cpu(rec->cpu_id))
+		return -1;
+	rec->cpu_id = host_cpu_id(cache->host, rec->cpu_id);
+	/* host_cpu_id() warned already */
+	if ((nb_hosts > 1) && (rec->cpu_id >= MAX_CPU))
+		return -1;
+
+	rec->nargs = 0;
+	rec->strpos = 0;
+	rec->source = NULL;
+	return 0;
+}
+
+/* payload fields of an event, -1 when it has none */
+static int get_fields(struct bt_ctf_event *ctf_event, struct event_class *cls,
+		      struct bt_definition const * const **list,
+		      unsigned int *count)
+{
+	const struct bt_definition *scope;
+
+	/* events without payload have no field scope */
+	scope = bt_ctf_get_top_level_scope(ctf_event, BT_EVENT_FIELDS);
+	if (!scope || (bt_ctf_get_field_list(ctf_event, scope, list,
+					     count) < 0))
+		return -1;
+
+	if (!cls->kind || (cls->nfields != *count)) {
+		free(cls->kind);
+		set_field_kinds(cls, *list, *count);
+	}
+	return 0;
+}
+
+/* decode an event with its arguments, strings point into babeltrace */
+int decode_event(struct bt_ctf_event *ctf_event, struct event_record *rec,
+		 struct decode_cache *cache)
+{
+	unsigned int count, i;
+	struct bt_definition const * const *list;
+	struct event_class *cls;
+	struct event_arg *arg;
+
+	cls = lookup_class(cache, ctf_event);
+	if (!cls->mod || decode_header(ctf_event, rec, cache, cls))
+		return -1;
+	if (get_fields(ctf_event, cls, &list, &count))
+		return 0;
+
+	for (i = 0; (i < count) && (rec->nargs < MAX_EVENT_ARGS); i++) {
+		arg = &rec->args[rec->nargs];
+		if (decode_arg(list[i], cls->kind[i], &arg->value))
+			continue;
+		arg->name = bt_ctf_field_name(list[i]);
+		rec->nargs++;
+	}
+	return 0;
+}
+
+/*
+ * Serial events are dispatched before the iterator moves: modules read
+ * their arguments straight from babeltrace, one at a time.
+ */
+struct event_source {
+	struct event_class                 *cls;
+	struct bt_definition const * const *list;
+	unsigned int                        count;
+};
+
+static int decode_source(struct bt_ctf_event *ctf_event,
+			 struct event_record *rec, struct decode_cache *cache)
+{
+	static struct event_source source;
+	struct event_class *cls;
+
+	cls = lookup_class(cache, ctf_event);
+	if (!cls->mod || decode_header(ctf_event, rec, cache, cls))
+		return -1;
+
+	source.cls = cls;
+	if (get_fields(ctf_event, cls, &source.list, &source.count))
+		source.count = 0;
+	rec->source = &source;
+	return 0;
+}
+
+/* decode the arguments of a serial event, before the iterator moves */
+void record_decode(struct event_record *rec)
+{
+	unsigned int i;
+	const struct event_source *src = rec->source;
+	struct event_arg *arg;
+
+	if (!src)
+		return;
+	for (i = 0; (i < src->count) && (rec->nargs < MAX_EVENT_ARGS); i++) {
+		arg = &rec->args[rec->nargs];
+		if (decode_arg(src->list[i], src->cls->kind[i], &arg->value))
+			continue;
+		arg->name = bt_ctf_field_name(src->list[i]);
+		rec->nargs++;
+	}
+	rec->source = NULL;
+}
+
+int get_arg(void *args, const char *name, struct arg_value *value)
+{
+	int i;
+	unsigned int j;
+	const struct event_record *rec = args;
+	const struct event_source *src = rec->source;
+
+	if (src) {
+		for (j = 0; j < src->count; j++) {
+			if (strcmp(bt_ctf_field_name(src->list[j]), name) == 0)
+				return decode_arg(src->list[j],
+						  src->cls->kind[j], value);
+		}
+		return -1;
+	}
+
+	for (i = 0; i < rec->nargs; i++) {
+		if (strcmp(rec->args[i].name, name) == 0) {
+			*value = rec->args[i].value;
+			return 0;
+		}
+	}
+	return -1;
 }
 
 void for_each_arg(void *args,
@@ -88,24 +519,24 @@ void for_each_arg(void *args,
 			      const struct arg_value *value),
 		  void *cookie)
 {
-	int ret;
-	struct bt_ctf_event *ctf_event = args;
-	unsigned int count, i;
-	struct bt_definition const * const *list;
+	int i;
+	unsigned int j;
 	struct arg_value value;
-	const char *name;
-	const struct bt_definition *scope;
-
-	scope = bt_ctf_get_top_level_scope(ctf_event, BT_EVENT_FIELDS);
-	assert(scope);
-	ret = bt_ctf_get_field_list(ctf_event, scope, &list, &count);
-	assert(ret == 0);
+	const struct event_record *rec = args;
+	const struct event_source *src = rec->source;
 
-	for (i = 0; i < count; i++) {
-		name = bt_ctf_field_name(list[i]);
-		if (get_arg(args, name, &value) == 0)
-			(*pfn)(cookie, name, &value);
+	if (src) {
+		for (j = 0; j < src->count; j++) {
+			if (decode_arg(src->list[j], src->cls->kind[j],
+				       &value) == 0)
+				(*pfn)(cookie, bt_ctf_field_name(src->list[j]),
+				       &value);
+		}
+		return;
 	}
+
+	for (i = 0; i < rec->nargs; i++)
+		(*pfn)(cookie, rec->args[i].name, &rec->args[i].value);
 }
 
 int64_t get_arg_i64(void *args, const char *name)
@@ -129,138 +560,672 @@ const char *get_arg_str(void *args, const char *name)
 	return value.s;
 }
 
-static void process_one_event(struct bt_ctf_event *ctf_event, double clock,
-			      const struct ltt_module *mod, const char *name,
-			      int pass)
+/*
+ * A field keeps its position across events of the same class: check the
+ * position found last time before searching by name. Babeltrace interns
+ * field names, so the name pointer found last identifies the field without
+ * a string compare.
+ */
+static int get_source_field(const struct event_source *src,
+			    struct arg_field *field, struct arg_value *value)
+{
+	unsigned int i;
+	const char *name;
+
+	i = (unsigned int)field->index;
+	if ((i >= src->count) ||
+	    (bt_ctf_field_name(src->list[i]) != field->match)) {
+		for (i = 0; i < src->count; i++) {
+			name = bt_ctf_field_name(src->list[i]);
+			if ((name == field->match) ||
+			    (strcmp(name, field->name) == 0))
+				break;
+		}
+		if (i == src->count)
+			return -1;
+		field->index = i;
+		field->match = bt_ctf_field_name(src->list[i]);
+	}
+	return decode_arg(src->list[i], src->cls->kind[i], value);
+}
+
+int get_field(void *args, struct arg_field *field, struct arg_value *value)
 {
-	const struct bt_definition *scope;
-	const struct bt_definition *def;
-	int cpu_id;
+	int i;
+	const struct event_arg *arg;
+	const struct event_record *rec = args;
 
-	scope = bt_ctf_get_top_level_scope(ctf_event, BT_STREAM_PACKET_CONTEXT);
-	assert(scope);
-	def = bt_ctf_get_field(ctf_event, scope, "cpu_id");
-	assert(def);
+	if (rec->source)
+		return get_source_field(rec->source, field, value);
+
+	if (field->index < rec->nargs) {
+		arg = &rec->args[field->index];
+		if (arg->name == field->match) {
+			*value = arg->value;
+			return 0;
+		}
+	}
 
-	cpu_id = (int)bt_ctf_get_uint64(def);
-	if (cpu_id >= MAX_CPU) {
-		DIAG("dropping event with cpu_id = %d\n", cpu_id);
+	for (i = 0; i < rec->nargs; i++) {
+		if ((rec->args[i].name == field->match) ||
+		    (strcmp(rec->args[i].name, field->name) == 0)) {
+			field->index = i;
+			field->match = rec->args[i].name;
+			*value = rec->args[i].value;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int64_t get_field_i64(void *args, struct arg_field *field)
+{
+	struct arg_value value = {0};
+	(void)get_field(args, field, &value);
+	return value.i64;
+}
+
+uint64_t get_field_u64(void *args, struct arg_field *field)
+{
+	struct arg_value value = {0};
+	(void)get_field(args, field, &value);
+	return value.u64;
+}
+
+const char *get_field_str(void *args, struct arg_field *field)
+{
+	struct arg_value value = {0};
+	(void)get_field(args, field, &value);
+	return value.s;
+}
+
+/* the first event seen defines time zero, unless told otherwise */
+void set_clock_base(uint64_t timestamp)
+{
+	if (clock_base == 0)
+		clock_base = timestamp;
+}
+
+uint64_t get_clock_base(void)
+{
+	return clock_base;
+}
+
+uint64_t get_event_clock(void)
+{
+	return event_clock;
+}
+
+int get_event_host(void)
+{
+	return event_host;
+}
+
+void dispatch_event(struct event_record *rec, int pass, int rebase_clock)
+{
+	uint64_t clock;
+
+	clock = rec->timestamp;
+	if (rebase_clock) {
+		set_clock_base(rec->timestamp);
+		clock = (clock > clock_base) ? clock-clock_base : 0;
+	}
+	event_clock = clock;
+	event_host = rec->host;
+
+	if (rec->cpu_id >= MAX_CPU) {
+		DIAG("dropping event with cpu_id = %d\n", rec->cpu_id);
 		return;
 	}
 
-	if (pass == 2)
-		emit_clock(clock);
+	if (pass == 0) {
+		/* single pass: discover, then emit right away */
+		rec->mod->process(rec->name, 1, clock, rec->cpu_id, rec);
+		if (rec->lost_events || rec->lost_packets)
+			lost_process(rec, 1);
+		pass = 2;
+	}
+
+	if (pass == 2) {
+		/* lead-in events set up the state at the window start */
+		if (window.enabled && (rec->timestamp < window.begin))
+			emit_clock(clock+(window.begin-rec->timestamp));
+		else
+			emit_clock(clock);
+	}
+
+	TDIAG("process events", clock, "name=%s cpu=%d pass=%d\n", rec->name,
+	      rec->cpu_id, pass);
+	rec->mod->process(rec->name, pass, clock, rec->cpu_id, rec);
+	if (rec->lost_events || rec->lost_packets)
+		lost_process(rec, pass);
+
+	if (pass == 1) {
+		discovery_log(rec);
+		/* pass 2 state for the time shards, see shard.c */
+		if (shard_tracking()) {
+			emit_clock(clock);
+			rec->mod->process(rec->name, 2, clock, rec->cpu_id,
+					  rec);
+			if (rec->lost_events || rec->lost_packets)
+				lost_process(rec, 2);
+		}
+	}
+}
+
+const struct time_window *get_time_window(void)
+{
+	return &window;
+}
+
+static int is_statedump(struct bt_ctf_event *ctf_event)
+{
+	return strncmp(bt_ctf_event_name(ctf_event), "lttng_statedump_",
+		       strlen("lttng_statedump_")) == 0;
+}
+
+static void next_event(struct bt_ctf_iter *iter, const char *name)
+{
+	if (bt_iter_next(bt_ctf_get_iter(iter)) < 0)
+		FATAL("error fetching event in trace '%s'\n", name);
+}
 
-	TDIAG("process events", clock, "name=%s cpu=%d pass=%d\n", name, cpu_id, pass);
-	mod->process(name, pass, clock, cpu_id, ctf_event);
+/*
+ * The events to convert, one at a time. With a time window, these are the
+ * statedump, then the events from the lead-in to the window end: the
+ * iterator seeks there through the packet index. A walk from a resume
+ * position (not 0) goes straight to the events at or after it.
+ */
+void walk_start(struct event_walk *walk, struct bt_ctf_iter *iter,
+		const char *name, uint64_t from)
+{
+	int ret;
+	struct bt_iter_pos begin_pos, *pos;
+
+	walk->iter = iter;
+	walk->name = name;
+	walk->state = (window.enabled && !from) ? WALK_STATEDUMP : WALK_EVENTS;
+
+	if (from) {
+		pos = bt_iter_create_time_pos(bt_ctf_get_iter(iter), from);
+		assert(pos);
+		ret = bt_iter_set_pos(bt_ctf_get_iter(iter), pos);
+		bt_iter_free_pos(pos);
+		if (ret < 0)
+			FATAL("cannot seek in trace '%s'\n", name);
+	} else {
+		begin_pos.type = BT_SEEK_BEGIN;
+		ret = bt_iter_set_pos(bt_ctf_get_iter(iter), &begin_pos);
+		assert(ret == 0);
+	}
 }
 
-static void process_events(struct bt_ctf_iter *iter, int pass, int rebase_clock)
+/* current event, NULL at the end: it stays valid until walk_next() */
+struct bt_ctf_event *walk_event(struct event_walk *walk)
 {
 	int ret;
-	double clock;
-	const char *name;
+	uint64_t ts;
+	struct bt_iter_pos *pos;
 	struct bt_ctf_event *ctf_event;
-	const struct ltt_module *mod;
 
-	while ((ctf_event = bt_ctf_iter_read_event(iter))) {
-		name = bt_ctf_event_name(ctf_event);
-		mod = find_module_by_name(name);
-		if (mod) {
-			clock = (double)bt_ctf_get_timestamp(ctf_event)/
-				1000000000.0;
-			if (rebase_clock) {
-				static double clock_base = 0.0;
- 				if (clock_base == 0.0)
-					clock_base = clock;
-				clock -= clock_base;
-			}
-			process_one_event(ctf_event, clock, mod, name, pass);
+	while (walk->state != WALK_END) {
+		ctf_event = bt_ctf_iter_read_event(walk->iter);
+		ts = ctf_event ? (uint64_t)bt_ctf_get_timestamp(ctf_event) : 0;
+
+		if (walk->state == WALK_EVENTS) {
+			if (ctf_event &&
+			    (!window.enabled || (ts <= window.end)))
+				return ctf_event;
+			walk->state = WALK_END;
+			break;
+		}
+
+		/* statedump events up to the lead-in */
+		if (ctf_event && (ts <= window.dump_end) &&
+		    (ts < window.lead_in)) {
+			if (is_statedump(ctf_event))
+				return ctf_event;
+			next_event(walk->iter, walk->name);
+			continue;
 		}
-		ret = bt_iter_next(bt_ctf_get_iter(iter));
+		pos = bt_iter_create_time_pos(bt_ctf_get_iter(walk->iter),
+					      window.lead_in);
+		assert(pos);
+		ret = bt_iter_set_pos(bt_ctf_get_iter(walk->iter), pos);
+		bt_iter_free_pos(pos);
 		if (ret < 0)
-			FATAL("error fetching event in trace '%s'\n", name);
+			FATAL("cannot seek in trace '%s'\n", walk->name);
+		walk->state = WALK_EVENTS;
 	}
+	return NULL;
+}
+
+void walk_next(struct event_walk *walk)
+{
+	next_event(walk->iter, walk->name);
 }
 
+/* feed fn with the events to convert */
+void iterate_events(struct bt_ctf_iter *iter, const char *name,
+		    void (*fn)(struct bt_ctf_event *ctf_event, void *cookie),
+		    void *cookie)
+{
+	struct event_walk walk;
+	struct bt_ctf_event *ctf_event;
+
+	walk_start(&walk, iter, name, 0);
+	while ((ctf_event = walk_event(&walk))) {
+		fn(ctf_event, cookie);
+		walk_next(&walk);
+	}
+}
+
+struct serial_pass {
+	int pass;
+	int rebase_clock;
+};
+
+static void process_event(struct bt_ctf_event *ctf_event, void *cookie)
+{
+	static struct event_record rec;
+	struct serial_pass *sp = cookie;
+
+	if (decode_source(ctf_event, &rec, &cache) == 0)
+		dispatch_event(&rec, sp->pass, sp->rebase_clock);
+}
+
+static void process_events(struct bt_ctf_iter *iter, const char *name,
+			   int pass, int rebase_clock)
+{
+	struct serial_pass sp = {pass, rebase_clock};
+
+	if (pipeline) {
+		pipeline_process_events(iter, name, &cache, pass,
+					rebase_clock);
+		return;
+	}
+
+	iterate_events(iter, name, process_event, &sp);
+}
+
+/* first and last timestamps of the opened traces, -1 if unknown */
+static int trace_range(uint64_t *begin, uint64_t *end)
+{
+	int i;
+	int64_t ts;
+
+	*begin = UINT64_MAX;
+	*end = 0;
+	for (i = 0; i < nb_trace_ids; i++) {
+		ts = bt_trace_handle_get_timestamp_begin(ctx, trace_ids[i],
+							 BT_CLOCK_REAL);
+		if ((ts >= 0) && ((uint64_t)ts < *begin))
+			*begin = ts;
+		ts = bt_trace_handle_get_timestamp_end(ctx, trace_ids[i],
+						       BT_CLOCK_REAL);
+		if ((ts >= 0) && ((uint64_t)ts > *end))
+			*end = ts;
+	}
+	return (*begin > *end) ? -1 : 0;
+}
+
+/* convert --from/--to/--last to absolute timestamps */
+static void resolve_window(struct bt_ctf_iter *iter, const char *name,
+			   int rebase_clock)
+{
+	int ret;
+	int64_t ts;
+	uint64_t begin, end;
+	struct bt_iter_pos begin_pos;
+	struct bt_ctf_event *ctf_event;
+
+	if (trace_range(&begin, &end))
+		FATAL("cannot find the trace time range\n");
+
+	window.enabled = 1;
+	window.begin = begin;
+	window.end = end;
+	if (window_to >= 0.0)
+		window.end = begin+(uint64_t)(window_to*1000000000.0);
+	if (window_from >= 0.0)
+		window.begin = begin+(uint64_t)(window_from*1000000000.0);
+	if ((window_last >= 0.0) &&
+	    (window.end-window.begin > (uint64_t)(window_last*1000000000.0)))
+		window.begin = window.end-(uint64_t)(window_last*1000000000.0);
+	if (window.begin > window.end)
+		FATAL("empty time window\n");
+
+	window.lead_in = begin;
+	if (window.begin-begin > WINDOW_LEAD_IN)
+		window.lead_in = window.begin-WINDOW_LEAD_IN;
+
+	/*
+	 * Statedump events are only looked for up to the statedump end, found
+	 * once here for every pass. The statedump is a burst at the session
+	 * start: without lttng_statedump_end, it ends with its last event
+	 * before a pause, not at the lead-in.
+	 */
+	window.dump_end = begin;
+	begin_pos.type = BT_SEEK_BEGIN;
+	ret = bt_iter_set_pos(bt_ctf_get_iter(iter), &begin_pos);
+	assert(ret == 0);
+	while ((ctf_event = bt_ctf_iter_read_event(iter))) {
+		ts = bt_ctf_get_timestamp(ctf_event);
+		if ((uint64_t)ts >= window.lead_in)
+			break;
+		if (is_statedump(ctf_event)) {
+			window.dump_end = ts;
+			if (strcmp(bt_ctf_event_name(ctf_event),
+				   "lttng_statedump_end") == 0)
+				break;
+		} else if ((uint64_t)ts-window.dump_end > STATEDUMP_GAP) {
+			break;
+		}
+		next_event(iter, name);
+	}
+
+	INFO("converting %" PRIu64 " ns to %" PRIu64 " ns, lead-in from %"
+	     PRIu64 " ns\n", window.begin-begin, window.end-begin,
+	     window.lead_in-begin);
+
+	/* keep the time origin of a full conversion */
+	if (rebase_clock)
+		set_clock_base(begin);
+
+	/* the discovery cache covers whole traces */
+	discovery_cache = 0;
+}
+
+/* collect directories holding a trace, babeltrace opens them later */
 static int traverse_trace_dir(const char *fpath, const struct stat *sb,
 			      int tflag, struct FTW *ftwbuf)
 {
-	int tid;
-	/* size of "fpath/metadata" + '0' */
-	size_t sz = sizeof(char) * (strlen(fpath) + strlen("metadata") + 2);
+	int ret;
+	char *metadata;
 
-	char *metadata = malloc(sz);
-	if (!metadata)
-		return -1;
+	if (tflag != FTW_D)
+		return 0;
 
-	snprintf(metadata, sz, "%s/%s", fpath, "metadata");
-	if (access(metadata, R_OK))
-		goto exit;
+	ret = asprintf(&metadata, "%s/metadata", fpath);
+	assert(ret > 0);
+	ret = access(metadata, R_OK);
+	free(metadata);
+	if (ret)
+		return 0;
 
-	tid = bt_context_add_trace(ctx, fpath, "ctf",
-			NULL, NULL, NULL);
-	if (tid < 0)
-		FATAL("cannot open trace '%s' for reading\n", fpath);
+	trace_dirs = realloc(trace_dirs,
+			     sizeof(*trace_dirs)*(nb_trace_dirs+1));
+	assert(trace_dirs);
+	trace_dirs[nb_trace_dirs] = strdup(fpath);
+	assert(trace_dirs[nb_trace_dirs]);
+	nb_trace_dirs++;
+	return 0;
+}
 
-	if (tid > 31)
-		goto exit;
+static void free_trace_dirs(void)
+{
+	int i;
 
-	tids |= 1 << tid;
+	for (i = 0; i < nb_trace_dirs; i++)
+		free(trace_dirs[i]);
+	free(trace_dirs);
+	trace_dirs = NULL;
+	nb_trace_dirs = 0;
+}
 
-exit:
-	free(metadata);
+/*
+ * Add every trace found under name to the context. Session directories may
+ * hold hundreds of per-UID/per-PID traces, each one keeps its handle.
+ */
+static int open_traces(const char *name)
+{
+	int i, tid;
+
+	if (nftw(name, traverse_trace_dir, 10, 0) < 0)
+		return -1;
+
+	trace_ids = realloc(trace_ids,
+			    sizeof(*trace_ids)*(nb_trace_ids+nb_trace_dirs+1));
+	assert(trace_ids);
+
+	for (i = 0; i < nb_trace_dirs; i++) {
+		tid = bt_context_add_trace(ctx, trace_dirs[i], "ctf",
+					   NULL, NULL, NULL);
+		if (tid < 0)
+			FATAL("cannot open trace '%s' for reading\n",
+			      trace_dirs[i]);
+		decode_cache_load(&cache, ctx, tid);
+		trace_ids[nb_trace_ids++] = tid;
+	}
+
+	free_trace_dirs();
 	return 0;
 }
 
-void scan_lttng_trace(const char *name, int rebase_clock)
+/* timestamp of the first sync event of a host, 0 when there is none */
+static uint64_t find_sync_event(const char *dir)
 {
+	int i;
+	uint64_t ts = 0;
+	struct bt_context *host_ctx;
 	struct bt_ctf_iter *iter;
 	struct bt_iter_pos begin_pos;
-	int ret, i;
+	struct bt_ctf_event *ctf_event;
+
+	host_ctx = bt_context_create();
+	assert(host_ctx);
+	if (nftw(dir, traverse_trace_dir, 10, 0) < 0)
+		FATAL("cannot open trace '%s'\n", dir);
+	for (i = 0; i < nb_trace_dirs; i++) {
+		if (bt_context_add_trace(host_ctx, trace_dirs[i], "ctf",
+					 NULL, NULL, NULL) < 0)
+			FATAL("cannot open trace '%s' for reading\n",
+			      trace_dirs[i]);
+	}
+	free_trace_dirs();
+
+	begin_pos.type = BT_SEEK_BEGIN;
+	iter = bt_ctf_iter_create(host_ctx, &begin_pos, NULL);
+	if (!iter)
+		FATAL("cannot iterate on trace '%s'\n", dir);
+
+	while ((ctf_event = bt_ctf_iter_read_event(iter))) {
+		if (fnmatch(sync_event, bt_ctf_event_name(ctf_event), 0) == 0) {
+			ts = bt_ctf_get_timestamp(ctf_event);
+			break;
+		}
+		if (bt_iter_next(bt_ctf_get_iter(iter)) < 0)
+			break;
+	}
+
+	bt_ctf_iter_destroy(iter);
+	bt_context_put(host_ctx);
+	return ts;
+}
+
+/*
+ * Merged hosts go through the per-stream decoders: offsets are applied when
+ * decoding, and the stream merge orders events on the shifted timestamps.
+ */
+static void open_hosts(int rebase_clock)
+{
+	int host;
+	uint64_t ref = 0, ts;
+
+	for (host = 0; sync_event && (host < nb_hosts); host++) {
+		/* hosts saw the sync event at the same time */
+		ts = find_sync_event(host_dir(host));
+		if (!ts)
+			FATAL("no '%s' event in trace '%s'\n",
+			      sync_event, host_dir(host));
+		if (host == 0)
+			ref = ts;
+		host_adjust_offset(host, (int64_t)(ref-ts));
+		INFO("host %s: sync event @%" PRIu64 "\n",
+		     host_name(host), ts);
+	}
+	/* decoders start right away, offsets are final by now */
+	if (!rebase_clock && host_bias())
+		DIAG("a host starts before '%s', times are shifted by "
+		     "%" PRIu64 " ns\n", host_name(0), host_bias());
+	for (host = 0; host < nb_hosts; host++)
+		parallel_open(host_dir(host), host);
+}
+
+static void run_pass(struct bt_ctf_iter *iter, const char *name, int pass,
+		     int rebase_clock)
+{
+	/* a resumed pass 2 starts with the checkpointed counters */
+	if ((pass != 2) || !resume_ts)
+		lost_reset();
+	if (pipeline && (pass != 1))
+		pipeline_start_writer();
+	if (parallel_decode)
+		parallel_process_events(pass, rebase_clock, UINT64_MAX);
+	else
+		process_events(iter, name, pass, rebase_clock);
+	if (pipeline && (pass != 1))
+		pipeline_stop_writer();
+}
+
+static void close_traces(void)
+{
+	int i;
+
+	for (i = 0; i < nb_trace_ids; i++)
+		bt_context_remove_trace(ctx, trace_ids[i]);
+	free(trace_ids);
+	trace_ids = NULL;
+	nb_trace_ids = 0;
+}
+
+static volatile sig_atomic_t stop_following;
+
+static void stop_follow(int sig)
+{
+	stop_following = 1;
+}
+
+/*
+ * Convert a trace while a live session writes it, in rounds: the -j
+ * decoders keep their streams open and only read what was appended, see
+ * parallel_follow().
+ */
+static void follow_lttng_trace(const char *name, int rebase_clock)
+{
+	unsigned long events = 0, round;
+
+	signal(SIGINT, stop_follow);
+	signal(SIGTERM, stop_follow);
+
+	INFO("following trace '%s', interrupt to stop\n", name);
+	symbol_set_lazy();
+	task_set_single_pass();
+
+	while (!stop_following) {
+		round = parallel_follow(name, rebase_clock, 0);
+		if (round) {
+			events += round;
+			INFO("%lu events converted\n", events);
+			save_dump_flush();
+		}
+		if (!stop_following)
+			usleep((useconds_t)(follow_interval*1000000.0));
+	}
+
+	/* the session is over: convert what is left, whatever the streams */
+	parallel_follow(name, rebase_clock, 1);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	parallel_close();
+}
+
+void scan_lttng_trace(const char *name, int rebase_clock)
+{
+	struct bt_ctf_iter *iter = NULL;
+	struct bt_iter_pos begin_pos;
+	int ret, windowed;
 
-	/* XXX hack to display missed event */
-	extern int babeltrace_ctf_console_output;
-	babeltrace_ctf_console_output = 1;
 	setenv("TZ", "", 1);
 
+	if (follow_interval > 0.0) {
+		follow_lttng_trace(name, rebase_clock);
+		return;
+	}
+
 	ctx = bt_context_create();
 	assert(ctx);
 
-	ret = nftw(name, traverse_trace_dir, 10, 0);
-	if (ret < 0)
-		FATAL("cannot open trace '%s'\n", name);
+	windowed = (window_from >= 0.0) || (window_to >= 0.0) ||
+		(window_last >= 0.0);
 
-	begin_pos.type = BT_SEEK_BEGIN;
-	iter = bt_ctf_iter_create(ctx, &begin_pos, NULL);
-	if (!iter)
-		FATAL("cannot iterate on trace '%s'\n", name);
+	/* each stream is decoded by its own worker thread */
+	if (nb_hosts > 1)
+		open_hosts(rebase_clock);
+	else if (parallel_decode)
+		parallel_open(name, 0);
+
+	/* time windows are resolved on the whole trace */
+	if (!parallel_decode || windowed) {
+		ret = open_traces(name);
+		if (ret < 0)
+			FATAL("cannot open trace '%s'\n", name);
+
+		begin_pos.type = BT_SEEK_BEGIN;
+		iter = bt_ctf_iter_create(ctx, &begin_pos, NULL);
+		if (!iter)
+			FATAL("cannot iterate on trace '%s'\n", name);
+	}
 
-	INFO("pass 1: initializing modules and converting addresses\n");
-	process_events(iter, 1, rebase_clock);
+	if (windowed)
+		resolve_window(iter, name, rebase_clock);
 
-	babeltrace_ctf_console_output = 0;
+	/* time shards are seeded by a pass 1 over every event */
+	if (shard_count > 1)
+		shard_init();
+
+	if (shard_tracking() && discovery_cached(name))
+		DIAG("time shards are seeded by pass 1, not from the "
+		     "discovery cache\n");
+
+	if (!shard_tracking() && discovery_load(name, rebase_clock)) {
+		/* the cache has pass 1 results, two passes come cheap */
+		INFO("pass 1: loaded from discovery cache\n");
+		if (single_pass)
+			DIAG("pass 1 is in the discovery cache, converting in "
+			     "two passes instead of -1\n");
+	} else if (single_pass) {
+		INFO("single pass: discovering and emitting LXT traces\n");
+		discovery_close();
+		symbol_set_lazy();
+		task_set_single_pass();
+		run_pass(iter, name, 0, rebase_clock);
+		goto done;
+	} else {
+		INFO("pass 1: initializing modules and converting addresses\n");
+		discovery_open();
+		run_pass(iter, name, 1, rebase_clock);
+		discovery_close();
+	}
 
 	/* flush address symbol conversion pipe */
 	atag_flush();
-	symbol_flush();
+	if (checkpoint_resuming())
+		resume_ts = checkpoint_restore();
+	else
+		symbol_flush();
 
 	INFO("pass 2: emitting LXT traces\n");
-	/* rewind */
-	ret = bt_iter_set_pos(bt_ctf_get_iter(iter), &begin_pos);
-	assert(ret == 0);
-	process_events(iter, 2, rebase_clock);
+	if (!shard_tracking() || shard_pass(rebase_clock))
+		run_pass(iter, name, 2, rebase_clock);
 
-	bt_ctf_iter_destroy(iter);
-	i = 0;
-	while (tids) {
-		if (tids & (1 << i)) {
-			bt_context_remove_trace(ctx, i);
-			tids &= ~(1 << i);
-			i++;
-		}
-	}
+done:
+	if (parallel_decode)
+		parallel_close();
+	if (iter)
+		bt_ctf_iter_destroy(iter);
+	decode_cache_free(&cache);
+	close_traces();
 
 	bt_context_put(ctx);
 }
-
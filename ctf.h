@@ -0,0 +1,141 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+#ifndef LTTNG2LXT_CTF_H
+#define LTTNG2LXT_CTF_H
+
+#include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/iterator.h>
+
+#include "event.h"
+
+/* decoding shortcuts, valid as long as the babeltrace context lives */
+#define CLASS_HASH_SIZE           (64)
+
+struct event_class;
+
+/*
+ * Packet context fields of a stream. Babeltrace updates the definitions in
+ * place, each stream keeps the same ones.
+ */
+struct packet_defs {
+	const struct bt_definition  *packet;
+	const struct bt_definition  *cpu_id;
+	const struct bt_definition  *discarded;
+	const struct bt_definition  *seq_num;
+	struct lost_channel         *channel;
+};
+
+/* event classes of a trace, indexed by event id */
+struct class_table {
+	struct event_class         **classes;
+	unsigned int                 size;
+};
+
+/* packet context counters of an event, see lost_check() */
+struct packet_counters {
+	struct lost_channel         *channel;  /* NULL without accounting */
+	uint64_t                     discarded;
+	uint64_t                     seq;
+	int                          has_seq;
+};
+
+struct decode_cache {
+	/* host of the decoded trace, see host.c */
+	int                          host;
+	/* trace directory for the lost events summary, else asked to ctx */
+	const char                  *path;
+	struct bt_context           *ctx;
+	struct packet_defs          *packets;
+	int                          npackets;
+	int                          cur_packet;
+	struct class_table          *tables;
+	int                          ntables;
+	struct event_class          *classes[CLASS_HASH_SIZE];
+	/*
+	 * Decoders running ahead of the merge leave the gap accounting to
+	 * it: counters holds the packet values of the last decoded event.
+	 */
+	int                          defer_lost;
+	struct packet_counters       counters;
+};
+
+int decode_event(struct bt_ctf_event *ctf_event, struct event_record *rec,
+		 struct decode_cache *cache);
+void decode_cache_load(struct decode_cache *cache, struct bt_context *ctx,
+		       int handle_id);
+void decode_cache_free(struct decode_cache *cache);
+
+/* absolute timestamps of the time window to convert */
+struct time_window {
+	int                          enabled;
+	uint64_t                     dump_end;
+	uint64_t                     lead_in;
+	uint64_t                     begin;
+	uint64_t                     end;
+};
+
+const struct time_window *get_time_window(void);
+
+/* events to convert of an iterator, read one at a time */
+enum walk_state {
+	WALK_STATEDUMP,
+	WALK_EVENTS,
+	WALK_END,
+};
+
+struct event_walk {
+	struct bt_ctf_iter          *iter;
+	const char                  *name;
+	enum walk_state              state;
+};
+
+void walk_start(struct event_walk *walk, struct bt_ctf_iter *iter,
+		const char *name, uint64_t from);
+struct bt_ctf_event *walk_event(struct event_walk *walk);
+void walk_next(struct event_walk *walk);
+void iterate_events(struct bt_ctf_iter *iter, const char *name,
+		    void (*fn)(struct bt_ctf_event *ctf_event, void *cookie),
+		    void *cookie);
+
+void pipeline_process_events(struct bt_ctf_iter *iter, const char *name,
+			     struct decode_cache *cache, int pass,
+			     int rebase_clock);
+
+/* stream files read without babeltrace, see ctf_native.c */
+struct native_stream;
+
+struct native_stream *native_open(const char *tracedir, const char *path,
+				  int host);
+int native_grow(struct native_stream *ns);
+uint64_t native_stream_id(const struct native_stream *ns);
+int native_range(const struct native_stream *ns, uint64_t *begin,
+		 uint64_t *end);
+void native_start(struct native_stream *ns, uint64_t from);
+int native_read(struct native_stream *ns, struct event_record *rec,
+		struct packet_counters *counters);
+void native_close(struct native_stream *ns);
+void native_free(void);
+
+void parallel_open(const char *name, int host);
+void parallel_process_events(int pass, int rebase_clock, uint64_t end);
+unsigned long parallel_follow(const char *name, int rebase_clock, int last);
+void parallel_close(void);
+
+void lost_check(struct lost_channel *ch, uint64_t discarded, int has_seq,
+		uint64_t seq, struct event_record *rec);
+void lost_process(struct event_record *rec, int pass);
+
+int discovery_cached(const char *name);
+int discovery_load(const char *name, int rebase_clock);
+void discovery_open(void);
+void discovery_log(struct event_record *rec);
+void discovery_close(void);
+
+#endif /* LTTNG2LXT_CTF_H */
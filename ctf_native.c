@@ -0,0 +1,2128 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "ctf.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Native CTF 1.8 reader, the --native fast path of the -j decoders, and the
+ * decoder --follow prefers: it indexes the packets appended to a stream
+ * without reading the others again. Stream files are mapped and their
+ * events are decoded straight from the layouts of the trace metadata into
+ * records, without babeltrace definitions. Streams it cannot read
+ * (metadata it does not understand, malformed packets) are left to
+ * babeltrace. Events come out as babeltrace 1 decodes them: same clock
+ * conversion, same arguments, same walk.
+ */
+
+/* fields of a structure, nested ones are decoded on the stack */
+#define NATIVE_MAX_FIELDS         (128)
+/* event ids of a stream class */
+#define NATIVE_MAX_EVENTS         (65536)
+#define CTF_MAGIC                 (0xc1fc1fc1U)
+#define METADATA_MAGIC            (0x75d11d57U)
+/* magic, uuid, checksum, sizes, schemes and version of a metadata packet */
+#define METADATA_HEADER           (37)
+#define TOKEN_MAX                 (256)
+/* mapped bytes a stream keeps behind the packet it decodes */
+#define DROP_BEHIND               (1 << 20)
+
+enum ntype_kind {
+	NT_INTEGER,
+	NT_ENUM,
+	NT_FLOAT,
+	NT_STRING,
+	NT_STRUCT,
+	NT_VARIANT,
+	NT_ARRAY,
+	NT_SEQUENCE,
+};
+
+/* babeltrace 1 type ids (enum ctf_type_id), for its diagnostics */
+static const int ctf_type_ids[] = {1, 3, 2, 4, 5, 7, 8, 9};
+
+enum byte_order {
+	ORDER_TRACE,    /* native: the byte order of the trace */
+	ORDER_LE,
+	ORDER_BE,
+};
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ORDER_HOST                ORDER_LE
+#else
+#define ORDER_HOST                ORDER_BE
+#endif
+
+/* event header fields babeltrace 1 reads the event id and clock from */
+enum field_role {
+	ROLE_NONE,
+	ROLE_ID,
+	ROLE_TIMESTAMP,
+};
+
+struct nclock {
+	char                 *name;
+	uint64_t              freq;
+	uint64_t              offset;     /* cycles */
+	int64_t               offset_s;
+	uint64_t              offset_ns;  /* both offsets */
+	struct nclock        *next;
+};
+
+struct nenum_entry {
+	char                 *label;
+	uint64_t              start;
+	uint64_t              end;
+};
+
+struct nfield {
+	char                 *name;       /* without its leading underscore */
+	struct ntype         *type;
+	int                   role;
+};
+
+struct ntype {
+	enum ntype_kind       kind;
+	unsigned int          align;      /* bits */
+	unsigned int          size;       /* bits of integers, enums, floats */
+	int                   is_signed;
+	int                   order;
+	int                   encoded;    /* integers holding characters */
+	char                 *map;        /* clock name */
+	/* enums */
+	struct nenum_entry   *entries;
+	unsigned int          nentries;
+	/* structs, variant options */
+	struct nfield        *fields;
+	unsigned int          nfields;
+	int                   shared;     /* fields of a named variant */
+	/* variant tag, sequence length: a previous field of the structure */
+	char                 *ref_name;
+	int                   ref;
+	const struct ntype   *tag;
+	int                  *options;    /* variant option of each tag entry */
+	/* arrays and sequences */
+	struct ntype         *elem;
+	uint64_t              length;
+	struct ntype         *next;       /* every type of the trace */
+};
+
+struct nalias {
+	char                 *name;
+	struct ntype         *type;
+	struct nalias        *next;
+};
+
+/* how each payload field becomes an argument, babeltrace 1 style */
+enum narg_kind {
+	NARG_I64,
+	NARG_U64,
+	NARG_STRING,
+	NARG_CHARS,
+};
+
+struct narg {
+	const char           *name;
+	unsigned int          field;
+	enum narg_kind        kind;
+	uint64_t              length;     /* of character arrays */
+};
+
+struct nevent {
+	char                 *name;
+	uint64_t              id;
+	uint64_t              stream_id;
+	int                   has_stream_id;
+	struct ntype         *context;
+	struct ntype         *fields;
+	const struct ltt_module *mod;
+	int                   statedump;
+	struct narg          *args;
+	unsigned int          nargs;
+	int                   warned;
+	struct nevent        *next;
+};
+
+struct nstream_class {
+	uint64_t              id;
+	struct ntype         *header;
+	struct ntype         *context;
+	struct ntype         *packet;
+	struct nclock        *clock;
+	struct nevent       **events;     /* by id */
+	uint64_t              nevents;
+	/* packet context fields, -1 when missing */
+	int                   ts_begin;
+	int                   ts_end;
+	int                   content_size;
+	int                   packet_size;
+	int                   discarded;
+	int                   seq;
+	int                   cpu_id;
+	struct nstream_class *next;
+};
+
+struct ntrace {
+	char                 *dir;
+	int                   failed;
+	int                   order;
+	struct ntype         *packet_header;
+	/* packet header fields, -1 when missing */
+	int                   magic;
+	int                   stream_id;
+	struct nclock        *clocks;
+	struct nstream_class *classes;
+	struct nevent        *events;
+	struct ntype         *types;
+	uint64_t              metadata_size;  /* when parsed */
+	struct ntrace        *next;
+};
+
+struct npacket {
+	uint64_t              offset;        /* in the file, bytes */
+	uint64_t              content_size;  /* bits */
+	uint64_t              data;          /* first event, bits */
+	uint64_t              begin;         /* clock cycles */
+	uint64_t              end;
+	uint64_t              discarded;
+	uint64_t              seq;
+	int                   cpu_id;
+};
+
+struct native_stream {
+	struct ntrace        *trace;
+	struct nstream_class *cls;
+	char                 *path;
+	char                 *origin;
+	int                   host;
+	unsigned char        *map;
+	size_t                size;
+	size_t                dropped;    /* pages before are dropped */
+	size_t                indexed;    /* bytes of whole packets */
+	uint64_t              stream_id;
+	struct npacket       *packets;
+	unsigned int          npackets;
+	unsigned int          alloc;
+	struct lost_channel  *channel;
+	/* where the walk is */
+	enum walk_state       state;
+	unsigned int          packet;
+	uint64_t              pos;        /* bits in the packet */
+	uint64_t              cycles;     /* clock value */
+	uint64_t              seek;       /* events before are skipped */
+	/* last event decoded */
+	struct nevent        *event;
+	uint64_t              id;
+	uint64_t              ts;         /* real time, ns */
+	uint64_t              header[NATIVE_MAX_FIELDS];
+	uint64_t              fields[NATIVE_MAX_FIELDS];
+};
+
+/* a position in a packet, header decoding sets ns for the field roles */
+struct cursor {
+	const unsigned char  *base;
+	uint64_t              pos;        /* bits */
+	uint64_t              end;
+	struct native_stream *ns;
+};
+
+/* traces are parsed once, the -j workers open their streams together */
+static pthread_mutex_t traces_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ntrace *traces;
+
+/*
+ * Metadata parsing: a recursive descent over the TSDL subset LTTng writes.
+ * The first error stops it, the trace is then left to babeltrace.
+ */
+
+enum token_type {
+	TOKEN_END,
+	TOKEN_IDENT,
+	TOKEN_NUMBER,
+	TOKEN_STRING,
+	TOKEN_PUNCT,
+};
+
+struct parser {
+	const char           *pos;
+	enum token_type       type;
+	char                  text[TOKEN_MAX];
+	uint64_t              num;
+	int                   failed;
+	char                  error[TOKEN_MAX+64];
+	int                   has_order;
+	struct ntrace        *trace;
+	struct nalias        *aliases;
+};
+
+struct value {
+	enum token_type       type;
+	uint64_t              num;
+	char                  text[TOKEN_MAX];
+};
+
+static void fail(struct parser *p, const char *what)
+{
+	if (!p->failed && p->text[0])
+		snprintf(p->error, sizeof(p->error), "%s near '%s'", what,
+			 p->text);
+	else if (!p->failed)
+		snprintf(p->error, sizeof(p->error), "%s", what);
+	p->failed = 1;
+	p->type = TOKEN_END;
+	p->pos = "";
+}
+
+static void next_token(struct parser *p)
+{
+	const char *s = p->pos, *end;
+	size_t len;
+
+	for (;;) {
+		while (isspace((unsigned char)*s))
+			s++;
+		if ((s[0] == '/') && (s[1] == '*')) {
+			s = strstr(s+2, "*/");
+			if (!s)
+				return fail(p, "unterminated comment");
+			s += 2;
+		} else if ((s[0] == '/') && (s[1] == '/')) {
+			s += strcspn(s, "\n");
+		} else {
+			break;
+		}
+	}
+
+	if (*s == '\0') {
+		p->type = TOKEN_END;
+		p->text[0] = '\0';
+		p->pos = s;
+		return;
+	}
+
+	if (isalpha((unsigned char)*s) || (*s == '_')) {
+		for (len = 1; isalnum((unsigned char)s[len]) ||
+			     (s[len] == '_'); len++)
+			;
+		p->type = TOKEN_IDENT;
+	} else if (isdigit((unsigned char)*s)) {
+		errno = 0;
+		p->num = strtoull(s, (char **)&end, 0);
+		if (errno)
+			return fail(p, "bad number");
+		while ((*end == 'u') || (*end == 'U') || (*end == 'l') ||
+		       (*end == 'L'))
+			end++;
+		len = end-s;
+		p->type = TOKEN_NUMBER;
+	} else if (*s == '"') {
+		for (len = 1; s[len] && (s[len] != '"'); len++) {
+			if ((s[len] == '\\') && s[len+1])
+				len++;
+		}
+		if (s[len] != '"')
+			return fail(p, "unterminated string");
+		if (len-1 >= TOKEN_MAX)
+			return fail(p, "string too long");
+		/* escapes are kept, names and labels do not have any */
+		memcpy(p->text, s+1, len-1);
+		p->text[len-1] = '\0';
+		p->type = TOKEN_STRING;
+		p->pos = s+len+1;
+		return;
+	} else {
+		len = (strncmp(s, "...", 3) == 0) ? 3 :
+			(strncmp(s, ":=", 2) == 0) ? 2 : 1;
+		p->type = TOKEN_PUNCT;
+	}
+
+	if (len >= TOKEN_MAX)
+		return fail(p, "token too long");
+	memcpy(p->text, s, len);
+	p->text[len] = '\0';
+	p->pos = s+len;
+}
+
+static int is_punct(struct parser *p, const char *s)
+{
+	return (p->type == TOKEN_PUNCT) && (strcmp(p->text, s) == 0);
+}
+
+static int is_ident(struct parser *p, const char *s)
+{
+	return (p->type == TOKEN_IDENT) && (strcmp(p->text, s) == 0);
+}
+
+static int accept(struct parser *p, const char *s)
+{
+	if (!is_punct(p, s))
+		return 0;
+	next_token(p);
+	return 1;
+}
+
+static void expect(struct parser *p, const char *s)
+{
+	if (!accept(p, s))
+		fail(p, "syntax error");
+}
+
+/* an identifier, or a dotted path of them, to buf */
+static void parse_path(struct parser *p, char *buf)
+{
+	size_t len = 0;
+
+	buf[0] = '\0';
+	for (;;) {
+		if (p->type != TOKEN_IDENT)
+			return fail(p, "identifier expected");
+		if (len+strlen(p->text)+2 > TOKEN_MAX)
+			return fail(p, "path too long");
+		len += sprintf(buf+len, "%s%s", len ? "." : "", p->text);
+		next_token(p);
+		if (!accept(p, "."))
+			return;
+	}
+}
+
+static void parse_value(struct parser *p, struct value *v)
+{
+	int neg = accept(p, "-");
+
+	v->type = p->type;
+	v->num = 0;
+	v->text[0] = '\0';
+	switch (p->type) {
+
+	case TOKEN_NUMBER:
+		v->num = neg ? -p->num : p->num;
+		next_token(p);
+		break;
+
+	case TOKEN_STRING:
+		strcpy(v->text, p->text);
+		next_token(p);
+		break;
+
+	case TOKEN_IDENT:
+		parse_path(p, v->text);
+		break;
+
+	default:
+		fail(p, "value expected");
+		break;
+	}
+}
+
+static int value_bool(const struct value *v)
+{
+	if (v->type == TOKEN_NUMBER)
+		return v->num != 0;
+	return strcasecmp(v->text, "true") == 0;
+}
+
+static int value_order(struct parser *p, const struct value *v)
+{
+	if ((strcmp(v->text, "le") == 0) || (strcmp(v->text, "little") == 0))
+		return ORDER_LE;
+	if ((strcmp(v->text, "be") == 0) || (strcmp(v->text, "big") == 0) ||
+	    (strcmp(v->text, "network") == 0))
+		return ORDER_BE;
+	if (strcmp(v->text, "native") == 0)
+		return ORDER_TRACE;
+	fail(p, "unknown byte order");
+	return ORDER_TRACE;
+}
+
+/* babeltrace 1 names fields without the underscore LTTng prefixes */
+static const char *field_name(const char *name)
+{
+	return (name[0] == '_') ? name+1 : name;
+}
+
+static struct ntype *new_type(struct parser *p, enum ntype_kind kind)
+{
+	struct ntype *t;
+
+	t = calloc(1, sizeof(*t));
+	assert(t);
+	t->kind = kind;
+	t->align = 8;
+	t->ref = -1;
+	t->next = p->trace->types;
+	p->trace->types = t;
+	return t;
+}
+
+static void add_alias(struct parser *p, const char *name, struct ntype *t)
+{
+	struct nalias *a;
+
+	if (!t || p->failed)
+		return;
+	a = calloc(1, sizeof(*a));
+	assert(a);
+	a->name = strdup(name);
+	assert(a->name);
+	a->type = t;
+	a->next = p->aliases;
+	p->aliases = a;
+}
+
+static struct ntype *find_alias(struct parser *p, const char *name)
+{
+	struct nalias *a;
+
+	for (a = p->aliases; a; a = a->next) {
+		if (strcmp(a->name, name) == 0)
+			return a->type;
+	}
+	fail(p, "unknown type");
+	return NULL;
+}
+
+static void check_align(struct parser *p, unsigned int align)
+{
+	if ((align == 0) || (align & (align-1)))
+		fail(p, "bad alignment");
+}
+
+static struct ntype *parse_type(struct parser *p, char *name);
+static void parse_fields(struct parser *p, struct ntype *parent);
+
+/* attributes of integer, floating_point and string, the name is read */
+static struct ntype *parse_scalar(struct parser *p, enum ntype_kind kind)
+{
+	char key[TOKEN_MAX];
+	struct value v;
+	struct ntype *t = new_type(p, kind);
+	unsigned int exp_dig = 0, mant_dig = 0;
+	int has_align = 0;
+
+	if ((kind == NT_STRING) && !is_punct(p, "{"))
+		return t;
+	expect(p, "{");
+	while (!p->failed && !is_punct(p, "}")) {
+		parse_path(p, key);
+		expect(p, "=");
+		parse_value(p, &v);
+		expect(p, ";");
+		if (strcmp(key, "size") == 0) {
+			t->size = (unsigned int)v.num;
+		} else if (strcmp(key, "align") == 0) {
+			t->align = (unsigned int)v.num;
+			has_align = 1;
+		} else if (strcmp(key, "signed") == 0) {
+			t->is_signed = value_bool(&v);
+		} else if (strcmp(key, "byte_order") == 0) {
+			t->order = value_order(p, &v);
+		} else if (strcmp(key, "encoding") == 0) {
+			t->encoded = strcasecmp(v.text, "none") != 0;
+		} else if (strcmp(key, "map") == 0) {
+			t->map = strdup(v.text);
+			assert(t->map);
+		} else if (strcmp(key, "exp_dig") == 0) {
+			exp_dig = (unsigned int)v.num;
+		} else if (strcmp(key, "mant_dig") == 0) {
+			mant_dig = (unsigned int)v.num;
+		}
+		/* base and the like do not change the layout */
+	}
+	expect(p, "}");
+
+	if (kind == NT_STRING)
+		return t;
+	if (kind == NT_FLOAT)
+		t->size = exp_dig+mant_dig;
+	if ((t->size == 0) || ((kind == NT_INTEGER) && (t->size > 64)))
+		fail(p, "bad size");
+	if (!has_align)
+		t->align = (t->size % 8) ? 1 : 8;
+	check_align(p, t->align);
+	return t;
+}
+
+static struct ntype *parse_enum(struct parser *p)
+{
+	char name[TOKEN_MAX+8] = "";
+	struct value v;
+	struct ntype *t, *c = NULL;
+	struct nenum_entry *e;
+	uint64_t next = 0;
+
+	if (p->type == TOKEN_IDENT) {
+		snprintf(name, sizeof(name), "enum %s", p->text);
+		next_token(p);
+	}
+	if (accept(p, ":"))
+		c = parse_type(p, NULL);
+	if (!is_punct(p, "{"))
+		return find_alias(p, name);
+	/* the default container is the int type alias */
+	if (!c && !p->failed)
+		c = find_alias(p, "int");
+	if (p->failed)
+		return NULL;
+	if (c->kind != NT_INTEGER) {
+		fail(p, "enum container is not an integer");
+		return NULL;
+	}
+
+	t = new_type(p, NT_ENUM);
+	t->align = c->align;
+	t->size = c->size;
+	t->is_signed = c->is_signed;
+	t->order = c->order;
+	next_token(p);
+	while (!p->failed && !is_punct(p, "}")) {
+		if ((p->type != TOKEN_IDENT) && (p->type != TOKEN_STRING)) {
+			fail(p, "enum label expected");
+			break;
+		}
+		t->entries = realloc(t->entries,
+				     sizeof(*t->entries)*(t->nentries+1));
+		assert(t->entries);
+		e = &t->entries[t->nentries++];
+		e->label = strdup(p->text);
+		assert(e->label);
+		next_token(p);
+		e->start = e->end = next;
+		if (accept(p, "=")) {
+			parse_value(p, &v);
+			e->start = e->end = v.num;
+			if (accept(p, "...")) {
+				parse_value(p, &v);
+				e->end = v.num;
+			}
+		}
+		next = e->end+1;
+		if (!accept(p, ","))
+			break;
+	}
+	expect(p, "}");
+	if (name[0])
+		add_alias(p, name, t);
+	return t;
+}
+
+static struct ntype *parse_compound(struct parser *p, enum ntype_kind kind)
+{
+	char name[TOKEN_MAX+8] = "", tag[TOKEN_MAX] = "";
+	const char *prefix = (kind == NT_STRUCT) ? "struct" : "variant";
+	struct value v;
+	struct ntype *t, *named;
+
+	if (p->type == TOKEN_IDENT) {
+		snprintf(name, sizeof(name), "%s %s", prefix, p->text);
+		next_token(p);
+	}
+	if ((kind == NT_VARIANT) && accept(p, "<")) {
+		parse_path(p, tag);
+		expect(p, ">");
+	}
+
+	if (!is_punct(p, "{")) {
+		named = find_alias(p, name);
+		if (!named || !tag[0])
+			return named;
+		/* each tagged use of a variant resolves its own tag */
+		t = new_type(p, NT_VARIANT);
+		t->align = named->align;
+		t->fields = named->fields;
+		t->nfields = named->nfields;
+		t->shared = 1;
+		t->ref_name = strdup(tag);
+		assert(t->ref_name);
+		return t;
+	}
+
+	t = new_type(p, kind);
+	/* a variant is aligned on its selected field */
+	t->align = 1;
+	if (tag[0]) {
+		t->ref_name = strdup(tag);
+		assert(t->ref_name);
+	}
+	next_token(p);
+	while (!p->failed && !is_punct(p, "}"))
+		parse_fields(p, t);
+	expect(p, "}");
+
+	if ((kind == NT_STRUCT) && is_ident(p, "align")) {
+		next_token(p);
+		expect(p, "(");
+		parse_value(p, &v);
+		expect(p, ")");
+		check_align(p, (unsigned int)v.num);
+		if (v.num > t->align)
+			t->align = (unsigned int)v.num;
+	}
+	/* variants with the same name share their fields, not their tag */
+	if (name[0])
+		add_alias(p, name, t);
+	return t;
+}
+
+/*
+ * A type specifier. Type aliases may take several words: when name is
+ * given, the last word is the field name that follows the type.
+ */
+static struct ntype *parse_type(struct parser *p, char *name)
+{
+	char words[TOKEN_MAX] = "", last[TOKEN_MAX] = "";
+
+	if (p->type != TOKEN_IDENT) {
+		fail(p, "type expected");
+		return NULL;
+	}
+	if (is_ident(p, "integer")) {
+		next_token(p);
+		return parse_scalar(p, NT_INTEGER);
+	}
+	if (is_ident(p, "floating_point")) {
+		next_token(p);
+		return parse_scalar(p, NT_FLOAT);
+	}
+	if (is_ident(p, "string")) {
+		next_token(p);
+		return parse_scalar(p, NT_STRING);
+	}
+	if (is_ident(p, "enum")) {
+		next_token(p);
+		return parse_enum(p);
+	}
+	if (is_ident(p, "struct")) {
+		next_token(p);
+		return parse_compound(p, NT_STRUCT);
+	}
+	if (is_ident(p, "variant")) {
+		next_token(p);
+		return parse_compound(p, NT_VARIANT);
+	}
+
+	while (p->type == TOKEN_IDENT) {
+		if (last[0]) {
+			if (strlen(words)+strlen(last)+2 > TOKEN_MAX) {
+				fail(p, "type name too long");
+				return NULL;
+			}
+			if (words[0])
+				strcat(words, " ");
+			strcat(words, last);
+		}
+		strcpy(last, p->text);
+		next_token(p);
+	}
+	if (name && words[0]) {
+		strcpy(name, last);
+	} else {
+		if (strlen(words)+strlen(last)+2 > TOKEN_MAX) {
+			fail(p, "type name too long");
+			return NULL;
+		}
+		if (words[0])
+			strcat(words, " ");
+		strcat(words, last);
+	}
+	return find_alias(p, words);
+}
+
+/* array and sequence suffixes of a declarator, the first one outermost */
+static struct ntype *parse_dims(struct parser *p, struct ntype *base)
+{
+	struct ntype *dims[8], *t;
+	int i, n = 0;
+
+	while (!p->failed && accept(p, "[")) {
+		if (n == (int)(sizeof(dims)/sizeof(dims[0]))) {
+			fail(p, "too many dimensions");
+			return NULL;
+		}
+		t = dims[n++] = new_type(p, NT_ARRAY);
+		if (p->type == TOKEN_NUMBER) {
+			t->length = p->num;
+			next_token(p);
+		} else {
+			t->kind = NT_SEQUENCE;
+			t->ref_name = malloc(TOKEN_MAX);
+			assert(t->ref_name);
+			parse_path(p, t->ref_name);
+		}
+		expect(p, "]");
+	}
+	if (!base)
+		return NULL;
+	for (i = n-1; i >= 0; i--) {
+		dims[i]->elem = base;
+		dims[i]->align = base->align;
+		base = dims[i];
+	}
+	return base;
+}
+
+/* variant tags and sequence lengths are previous fields of the parent */
+static void resolve_ref(struct parser *p, struct ntype *parent,
+			struct ntype *t)
+{
+	int i;
+	unsigned int j, k;
+	const char *ref = field_name(t->ref_name);
+	const struct ntype *tag;
+
+	for (i = (int)parent->nfields-1; i >= 0; i--) {
+		if (strcmp(parent->fields[i].name, ref) == 0)
+			break;
+	}
+	if (i < 0)
+		return fail(p, "reference out of the structure");
+	tag = parent->fields[i].type;
+	t->ref = i;
+
+	if (t->kind == NT_SEQUENCE) {
+		if ((tag->kind != NT_INTEGER) && (tag->kind != NT_ENUM))
+			fail(p, "sequence length is not an integer");
+		return;
+	}
+	if (tag->kind != NT_ENUM)
+		return fail(p, "variant tag is not an enum");
+	t->tag = tag;
+	t->options = malloc(sizeof(*t->options)*(tag->nentries+1));
+	assert(t->options);
+	for (j = 0; j < tag->nentries; j++) {
+		t->options[j] = -1;
+		for (k = 0; k < t->nfields; k++) {
+			if (strcmp(t->fields[k].name,
+				   field_name(tag->entries[j].label)) == 0)
+				t->options[j] = (int)k;
+		}
+	}
+}
+
+static void add_field(struct parser *p, struct ntype *parent,
+		      const char *name, struct ntype *t)
+{
+	struct nfield *f;
+
+	if (!t || p->failed)
+		return;
+	if (parent->nfields == NATIVE_MAX_FIELDS)
+		return fail(p, "too many fields");
+	if (((t->kind == NT_SEQUENCE) || (t->kind == NT_VARIANT)) &&
+	    (parent->kind == NT_STRUCT))
+		resolve_ref(p, parent, t);
+
+	parent->fields = realloc(parent->fields,
+				 sizeof(*parent->fields)*(parent->nfields+1));
+	assert(parent->fields);
+	f = &parent->fields[parent->nfields++];
+	f->name = strdup(field_name(name));
+	assert(f->name);
+	f->type = t;
+	f->role = ROLE_NONE;
+	if ((parent->kind == NT_STRUCT) && (t->align > parent->align))
+		parent->align = t->align;
+}
+
+static void parse_typealias(struct parser *p)
+{
+	char name[TOKEN_MAX] = "";
+	struct ntype *t;
+
+	t = parse_type(p, NULL);
+	t = parse_dims(p, t);
+	expect(p, ":=");
+	while (p->type == TOKEN_IDENT) {
+		if (strlen(name)+strlen(p->text)+2 > TOKEN_MAX)
+			return fail(p, "type name too long");
+		if (name[0])
+			strcat(name, " ");
+		strcat(name, p->text);
+		next_token(p);
+	}
+	expect(p, ";");
+	add_alias(p, name, t);
+}
+
+static void parse_typedef(struct parser *p)
+{
+	char name[TOKEN_MAX] = "";
+	struct ntype *t;
+
+	t = parse_type(p, name);
+	do {
+		if (!name[0] && (p->type == TOKEN_IDENT)) {
+			strcpy(name, p->text);
+			next_token(p);
+		}
+		add_alias(p, name, parse_dims(p, t));
+		name[0] = '\0';
+	} while (accept(p, ","));
+	expect(p, ";");
+}
+
+/* declarations of a struct or variant body, up to their ';' */
+static void parse_fields(struct parser *p, struct ntype *parent)
+{
+	char name[TOKEN_MAX] = "";
+	struct ntype *t;
+
+	if (is_ident(p, "typealias")) {
+		next_token(p);
+		return parse_typealias(p);
+	}
+	if (is_ident(p, "typedef")) {
+		next_token(p);
+		return parse_typedef(p);
+	}
+
+	t = parse_type(p, name);
+	do {
+		if (!name[0]) {
+			if (p->type != TOKEN_IDENT)
+				return fail(p, "field name expected");
+			strcpy(name, p->text);
+			next_token(p);
+		}
+		add_field(p, parent, name, parse_dims(p, t));
+		name[0] = '\0';
+	} while (!p->failed && accept(p, ","));
+	expect(p, ";");
+}
+
+static struct ntype *parse_scope(struct parser *p)
+{
+	struct ntype *t = parse_type(p, NULL);
+
+	if (t && (t->kind != NT_STRUCT))
+		fail(p, "scope is not a struct");
+	return t;
+}
+
+/* trace, clock, stream and event blocks, others are skipped */
+static void parse_block(struct parser *p, const char *kind)
+{
+	char key[TOKEN_MAX];
+	struct value v;
+	struct ntrace *tr = p->trace;
+	struct nclock *clk = NULL;
+	struct nstream_class *sc = NULL;
+	struct nevent *ev = NULL;
+	struct ntype *t;
+
+	if (strcmp(kind, "clock") == 0) {
+		clk = calloc(1, sizeof(*clk));
+		assert(clk);
+		clk->freq = 1000000000ULL;
+		clk->next = tr->clocks;
+		tr->clocks = clk;
+	} else if (strcmp(kind, "stream") == 0) {
+		sc = calloc(1, sizeof(*sc));
+		assert(sc);
+		sc->next = tr->classes;
+		tr->classes = sc;
+	} else if (strcmp(kind, "event") == 0) {
+		ev = calloc(1, sizeof(*ev));
+		assert(ev);
+		ev->next = tr->events;
+		tr->events = ev;
+	}
+
+	expect(p, "{");
+	while (!p->failed && !is_punct(p, "}")) {
+		if (is_ident(p, "typealias")) {
+			next_token(p);
+			parse_typealias(p);
+			continue;
+		}
+		if (is_ident(p, "typedef")) {
+			next_token(p);
+			parse_typedef(p);
+			continue;
+		}
+		parse_path(p, key);
+
+		if (accept(p, ":=")) {
+			t = parse_scope(p);
+			expect(p, ";");
+			if (strcmp(key, "packet.header") == 0 && !sc && !ev)
+				tr->packet_header = t;
+			else if (sc && (strcmp(key, "event.header") == 0))
+				sc->header = t;
+			else if (sc && (strcmp(key, "event.context") == 0))
+				sc->context = t;
+			else if (sc && (strcmp(key, "packet.context") == 0))
+				sc->packet = t;
+			else if (ev && (strcmp(key, "context") == 0))
+				ev->context = t;
+			else if (ev && (strcmp(key, "fields") == 0))
+				ev->fields = t;
+			continue;
+		}
+
+		expect(p, "=");
+		parse_value(p, &v);
+		expect(p, ";");
+		if (strcmp(kind, "trace") == 0) {
+			if (strcmp(key, "byte_order") == 0) {
+				tr->order = value_order(p, &v);
+				if (tr->order == ORDER_TRACE)
+					fail(p, "no trace byte order");
+				p->has_order = 1;
+			}
+		} else if (clk) {
+			if (strcmp(key, "name") == 0) {
+				free(clk->name);
+				clk->name = strdup(v.text);
+				assert(clk->name);
+			} else if (strcmp(key, "freq") == 0) {
+				clk->freq = v.num;
+			} else if (strcmp(key, "offset") == 0) {
+				clk->offset = v.num;
+			} else if (strcmp(key, "offset_s") == 0) {
+				clk->offset_s = (int64_t)v.num;
+			}
+		} else if (sc) {
+			if (strcmp(key, "id") == 0)
+				sc->id = v.num;
+		} else if (ev) {
+			if (strcmp(key, "name") == 0) {
+				free(ev->name);
+				ev->name = strdup(v.text);
+				assert(ev->name);
+			} else if (strcmp(key, "id") == 0) {
+				ev->id = v.num;
+			} else if (strcmp(key, "stream_id") == 0) {
+				ev->stream_id = v.num;
+				ev->has_stream_id = 1;
+			}
+		}
+	}
+	expect(p, "}");
+	expect(p, ";");
+	if (ev && !ev->name)
+		fail(p, "event without name");
+	if (clk && (!clk->name || !clk->freq))
+		fail(p, "clock without name or frequency");
+}
+
+static void parse_metadata(struct parser *p)
+{
+	char kind[TOKEN_MAX];
+
+	next_token(p);
+	while (!p->failed && (p->type != TOKEN_END)) {
+		if (is_ident(p, "typealias")) {
+			next_token(p);
+			parse_typealias(p);
+		} else if (is_ident(p, "typedef")) {
+			next_token(p);
+			parse_typedef(p);
+		} else if (is_ident(p, "trace") || is_ident(p, "clock") ||
+			   is_ident(p, "stream") || is_ident(p, "event") ||
+			   is_ident(p, "env") || is_ident(p, "callsite")) {
+			strcpy(kind, p->text);
+			next_token(p);
+			parse_block(p, kind);
+		} else {
+			/* named struct, variant or enum declaration */
+			parse_type(p, NULL);
+			expect(p, ";");
+		}
+	}
+}
+
+/*
+ * Trace layout, once parsed: what babeltrace 1 reads in the packet and
+ * event headers, the clock of the timestamps, the arguments of events.
+ */
+
+/* integer field of a scope, -1 when missing */
+static int scope_field(const struct ntype *t, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; t && (i < t->nfields); i++) {
+		if (strcmp(t->fields[i].name, name))
+			continue;
+		if ((t->fields[i].type->kind == NT_INTEGER) ||
+		    (t->fields[i].type->kind == NT_ENUM))
+			return (int)i;
+		return -1;
+	}
+	return -1;
+}
+
+static struct nclock *find_clock(struct ntrace *tr, const char *map)
+{
+	size_t len;
+	struct nclock *clk;
+
+	/* clock.<name>.value */
+	if (strncmp(map, "clock.", 6))
+		return NULL;
+	map += 6;
+	len = strcspn(map, ".");
+	for (clk = tr->clocks; clk; clk = clk->next) {
+		if ((strlen(clk->name) == len) &&
+		    (strncmp(clk->name, map, len) == 0))
+			return clk;
+	}
+	return NULL;
+}
+
+static uint64_t cycles_to_ns(const struct nclock *clk, uint64_t cycles)
+{
+	if (clk->freq == 1000000000ULL)
+		return cycles;
+	return (uint64_t)((double)cycles*1000000000.0/(double)clk->freq);
+}
+
+/* babeltrace 1 ctf_get_real_timestamp() */
+static uint64_t clock_ns(const struct nclock *clk, uint64_t cycles)
+{
+	if (!clk)
+		return cycles;
+	return cycles_to_ns(clk, cycles)+clk->offset_ns;
+}
+
+/* the event id and the clock, from the header or its 'v' variant */
+static void set_roles(struct ntype *header)
+{
+	unsigned int i, j, k;
+	int timestamp = 0;
+	struct nfield *f, *g;
+	struct ntype *opt;
+
+	for (i = 0; header && (i < header->nfields); i++) {
+		f = &header->fields[i];
+		if ((strcmp(f->name, "id") == 0) &&
+		    ((f->type->kind == NT_INTEGER) ||
+		     (f->type->kind == NT_ENUM))) {
+			f->role = ROLE_ID;
+		} else if ((strcmp(f->name, "timestamp") == 0) &&
+			   (f->type->kind == NT_INTEGER)) {
+			f->role = ROLE_TIMESTAMP;
+			timestamp = 1;
+		}
+	}
+	for (i = 0; header && (i < header->nfields); i++) {
+		f = &header->fields[i];
+		if ((strcmp(f->name, "v") != 0) ||
+		    (f->type->kind != NT_VARIANT))
+			continue;
+		for (j = 0; j < f->type->nfields; j++) {
+			opt = f->type->fields[j].type;
+			if (opt->kind != NT_STRUCT)
+				continue;
+			for (k = 0; k < opt->nfields; k++) {
+				g = &opt->fields[k];
+				if ((strcmp(g->name, "id") == 0) &&
+				    (g->type->kind == NT_INTEGER))
+					g->role = ROLE_ID;
+				else if (!timestamp &&
+					 (strcmp(g->name, "timestamp") == 0) &&
+					 (g->type->kind == NT_INTEGER))
+					g->role = ROLE_TIMESTAMP;
+			}
+		}
+	}
+}
+
+/* payload fields as babeltrace 1 decode_event() turns them to arguments */
+static void plan_args(struct nevent *ev)
+{
+	unsigned int i;
+	const struct nfield *f;
+	const struct ntype *t;
+	struct narg *a;
+
+	for (i = 0; ev->fields && (i < ev->fields->nfields); i++) {
+		f = &ev->fields->fields[i];
+		t = f->type;
+		if ((t->kind != NT_INTEGER) && (t->kind != NT_STRING) &&
+		    (t->kind != NT_ARRAY))
+			continue;
+		/* only arrays of byte characters make arguments */
+		if ((t->kind == NT_ARRAY) &&
+		    ((t->elem->kind != NT_INTEGER) || !t->elem->encoded ||
+		     (t->elem->size != 8) || (t->elem->align != 8)))
+			continue;
+
+		ev->args = realloc(ev->args, sizeof(*ev->args)*(ev->nargs+1));
+		assert(ev->args);
+		a = &ev->args[ev->nargs++];
+		a->name = f->name;
+		a->field = i;
+		a->length = 0;
+		if (t->kind == NT_INTEGER) {
+			a->kind = t->is_signed ? NARG_I64 : NARG_U64;
+		} else if (t->kind == NT_STRING) {
+			a->kind = NARG_STRING;
+		} else {
+			a->kind = NARG_CHARS;
+			a->length = t->length;
+		}
+	}
+}
+
+static struct nstream_class *find_stream_class(struct ntrace *tr,
+					       uint64_t id)
+{
+	struct nstream_class *sc;
+
+	for (sc = tr->classes; sc; sc = sc->next) {
+		if (sc->id == id)
+			return sc;
+	}
+	return NULL;
+}
+
+static void finalize_trace(struct parser *p)
+{
+	struct ntrace *tr = p->trace;
+	struct ntype *t;
+	struct nclock *clk;
+	struct nstream_class *sc;
+	struct nevent *ev;
+	int i;
+
+	if (!p->has_order)
+		return fail(p, "no trace byte order");
+	if (!tr->classes)
+		return fail(p, "no stream class");
+
+	for (clk = tr->clocks; clk; clk = clk->next)
+		clk->offset_ns = clk->offset_s*1000000000ULL+
+			cycles_to_ns(clk, clk->offset);
+
+	for (t = tr->types; t; t = t->next) {
+		if (t->order == ORDER_TRACE)
+			t->order = tr->order;
+		if (t->map && !find_clock(tr, t->map))
+			return fail(p, "unknown clock");
+		if (((t->kind == NT_SEQUENCE) || (t->kind == NT_VARIANT)) &&
+		    (t->ref < 0))
+			return fail(p, "unresolved variant or sequence");
+	}
+
+	tr->magic = scope_field(tr->packet_header, "magic");
+	tr->stream_id = scope_field(tr->packet_header, "stream_id");
+
+	for (sc = tr->classes; sc; sc = sc->next) {
+		sc->ts_begin = scope_field(sc->packet, "timestamp_begin");
+		sc->ts_end = scope_field(sc->packet, "timestamp_end");
+		sc->content_size = scope_field(sc->packet, "content_size");
+		sc->packet_size = scope_field(sc->packet, "packet_size");
+		sc->discarded = scope_field(sc->packet, "events_discarded");
+		sc->seq = scope_field(sc->packet, "packet_seq_num");
+		sc->cpu_id = scope_field(sc->packet, "cpu_id");
+		/* the decoders need the CPU of every event */
+		if (sc->cpu_id < 0)
+			return fail(p, "no cpu_id in the packet context");
+
+		sc->clock = tr->clocks;
+		if ((sc->ts_begin >= 0) &&
+		    sc->packet->fields[sc->ts_begin].type->map)
+			sc->clock = find_clock(tr,
+				sc->packet->fields[sc->ts_begin].type->map);
+		set_roles(sc->header);
+	}
+
+	for (ev = tr->events; ev; ev = ev->next) {
+		sc = ev->has_stream_id ? find_stream_class(tr, ev->stream_id) :
+			tr->classes->next ? NULL : tr->classes;
+		if (!sc)
+			return fail(p, "event of an unknown stream class");
+		if (ev->id >= NATIVE_MAX_EVENTS)
+			return fail(p, "event id too large");
+		if (ev->id >= sc->nevents) {
+			sc->events = realloc(sc->events,
+					     sizeof(*sc->events)*(ev->id+1));
+			assert(sc->events);
+			for (i = (int)sc->nevents; i <= (int)ev->id; i++)
+				sc->events[i] = NULL;
+			sc->nevents = ev->id+1;
+		}
+		if (sc->events[ev->id])
+			return fail(p, "duplicate event id");
+		sc->events[ev->id] = ev;
+
+		/* filtered out events look like events without module */
+		if (!filter_event(ev->name))
+			ev->mod = find_module_by_name(ev->name);
+		ev->statedump = strncmp(ev->name, "lttng_statedump_",
+					strlen("lttng_statedump_")) == 0;
+		plan_args(ev);
+	}
+}
+
+static void free_trace_layout(struct ntrace *tr)
+{
+	unsigned int i;
+	struct ntype *t;
+	struct nclock *clk;
+	struct nstream_class *sc;
+	struct nevent *ev;
+
+	while ((t = tr->types)) {
+		tr->types = t->next;
+		/* tagged uses of a named variant share its fields */
+		if (!t->shared) {
+			for (i = 0; i < t->nfields; i++)
+				free(t->fields[i].name);
+			free(t->fields);
+		}
+		for (i = 0; i < t->nentries; i++)
+			free(t->entries[i].label);
+		free(t->entries);
+		free(t->map);
+		free(t->ref_name);
+		free(t->options);
+		free(t);
+	}
+	while ((clk = tr->clocks)) {
+		tr->clocks = clk->next;
+		free(clk->name);
+		free(clk);
+	}
+	while ((sc = tr->classes)) {
+		tr->classes = sc->next;
+		free(sc->events);
+		free(sc);
+	}
+	while ((ev = tr->events)) {
+		tr->events = ev->next;
+		free(ev->name);
+		free(ev->args);
+		free(ev);
+	}
+	tr->packet_header = NULL;
+	tr->order = 0;
+}
+
+/* metadata text, out of its packets if it has some */
+static char *read_metadata(const char *dir, const char **error)
+{
+	int order;
+	char *path, *buf, *text;
+	FILE *fp;
+	long size;
+	size_t off = 0, len = 0, content, packet;
+	uint32_t magic;
+	int ret;
+
+	ret = asprintf(&path, "%s/metadata", dir);
+	assert(ret > 0);
+	fp = fopen(path, "r");
+	free(path);
+	if (!fp) {
+		*error = "cannot open the metadata";
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	buf = malloc(size+1);
+	assert(buf);
+	if ((size < 0) || (fread(buf, 1, size, fp) != (size_t)size)) {
+		fclose(fp);
+		free(buf);
+		*error = "cannot read the metadata";
+		return NULL;
+	}
+	fclose(fp);
+	buf[size] = '\0';
+
+	/* plain text, or packets */
+	if (size < 4)
+		return buf;
+	memcpy(&magic, buf, sizeof(magic));
+	if ((magic != METADATA_MAGIC) &&
+	    (magic != __builtin_bswap32(METADATA_MAGIC)))
+		return buf;
+
+	order = (magic == METADATA_MAGIC) ? ORDER_HOST :
+		(ORDER_HOST == ORDER_LE) ? ORDER_BE : ORDER_LE;
+	text = malloc(size+1);
+	assert(text);
+	while (off+METADATA_HEADER <= (size_t)size) {
+		memcpy(&magic, buf+off+24, 4);
+		content = (order == ORDER_HOST) ? magic :
+			__builtin_bswap32(magic);
+		memcpy(&magic, buf+off+28, 4);
+		packet = (order == ORDER_HOST) ? magic :
+			__builtin_bswap32(magic);
+		if (buf[off+32] || buf[off+33]) {
+			*error = "compressed or encrypted metadata";
+			break;
+		}
+		if ((content < METADATA_HEADER*8) || (content > packet) ||
+		    (content % 8) || (packet % 8) ||
+		    (off+packet/8 > (size_t)size)) {
+			*error = "bad metadata packet";
+			break;
+		}
+		memcpy(text+len, buf+off+METADATA_HEADER,
+		       content/8-METADATA_HEADER);
+		len += content/8-METADATA_HEADER;
+		off += packet/8;
+	}
+	free(buf);
+	if (off != (size_t)size) {
+		if (off+METADATA_HEADER > (size_t)size)
+			*error = "truncated metadata packet";
+		free(text);
+		return NULL;
+	}
+	text[len] = '\0';
+	return text;
+}
+
+/* bytes of the metadata of a trace directory, 0 when it cannot be read */
+static uint64_t metadata_size(const char *dir)
+{
+	int ret;
+	char *path;
+	struct stat sb;
+
+	ret = asprintf(&path, "%s/metadata", dir);
+	assert(ret > 0);
+	ret = stat(path, &sb);
+	free(path);
+	return ret ? 0 : (uint64_t)sb.st_size;
+}
+
+static void parse_trace(struct ntrace *tr)
+{
+	struct parser p;
+	struct nalias *a;
+	const char *error = NULL;
+	char *text;
+
+	tr->failed = 0;
+	tr->metadata_size = metadata_size(tr->dir);
+	text = read_metadata(tr->dir, &error);
+	if (text) {
+		memset(&p, 0, sizeof(p));
+		p.trace = tr;
+		p.pos = text;
+		parse_metadata(&p);
+		if (!p.failed)
+			finalize_trace(&p);
+		while ((a = p.aliases)) {
+			p.aliases = a->next;
+			free(a->name);
+			free(a);
+		}
+		free(text);
+		if (p.failed)
+			error = p.error;
+	}
+	if (error) {
+		DIAG("trace '%s' is decoded by babeltrace: %s\n", tr->dir,
+		     error);
+		free_trace_layout(tr);
+		tr->failed = 1;
+	}
+}
+
+/*
+ * A trace by directory, parsed on its first stream. Under --follow, a live
+ * session may not have written all of its metadata yet: a trace that
+ * failed is parsed again once its metadata changed.
+ */
+static struct ntrace *get_trace(const char *dir)
+{
+	struct ntrace *tr;
+
+	for (tr = traces; tr; tr = tr->next) {
+		if (strcmp(tr->dir, dir) != 0)
+			continue;
+		if (tr->failed && (follow_interval > 0.0) &&
+		    (metadata_size(dir) != tr->metadata_size))
+			parse_trace(tr);
+		return tr;
+	}
+
+	tr = calloc(1, sizeof(*tr));
+	assert(tr);
+	tr->dir = strdup(dir);
+	assert(tr->dir);
+	tr->next = traces;
+	traces = tr;
+	parse_trace(tr);
+	return tr;
+}
+
+/*
+ * Decoding. Integers are read bit by bit but for the aligned ones of the
+ * host byte order; fields of a structure land in a frame, its sequences
+ * and variants read their length and tag there.
+ */
+
+static uint64_t align_up(uint64_t pos, unsigned int align)
+{
+	return (pos+align-1) & ~(uint64_t)(align-1);
+}
+
+static uint64_t read_bits(const unsigned char *p, uint64_t pos,
+			  unsigned int size, int order)
+{
+	uint64_t v = 0;
+	uint16_t v16;
+	uint32_t v32;
+	unsigned int got = 0, off, n;
+
+	if (!(pos & 7) && (order == ORDER_HOST)) {
+		switch (size) {
+		case 8:
+			return p[pos >> 3];
+		case 16:
+			memcpy(&v16, p+(pos >> 3), sizeof(v16));
+			return v16;
+		case 32:
+			memcpy(&v32, p+(pos >> 3), sizeof(v32));
+			return v32;
+		case 64:
+			memcpy(&v, p+(pos >> 3), sizeof(v));
+			return v;
+		}
+	}
+
+	/* CTF bit order: from the LSB in little endian, the MSB in big */
+	while (got < size) {
+		off = pos & 7;
+		n = 8-off;
+		if (n > size-got)
+			n = size-got;
+		if (order == ORDER_LE)
+			v |= (uint64_t)((p[pos >> 3] >> off) &
+					((1U << n)-1)) << got;
+		else
+			v = (v << n) | ((p[pos >> 3] >> (8-off-n)) &
+					((1U << n)-1));
+		got += n;
+		pos += n;
+	}
+	return v;
+}
+
+/* babeltrace 1 ctf_update_timestamp(): the field holds the low bits */
+static void header_role(struct native_stream *ns, const struct nfield *f,
+			uint64_t val)
+{
+	uint64_t mask, cycles;
+	unsigned int size = f->type->size;
+
+	if (f->role == ROLE_ID) {
+		ns->id = val;
+		return;
+	}
+	if (size >= 64) {
+		ns->cycles = val;
+		return;
+	}
+	mask = ((uint64_t)1 << size)-1;
+	cycles = (ns->cycles & ~mask) | val;
+	if (val < (ns->cycles & mask))
+		cycles += (uint64_t)1 << size;
+	ns->cycles = cycles;
+}
+
+static int variant_option(const struct ntype *t, uint64_t tag)
+{
+	unsigned int i;
+	const struct nenum_entry *e;
+
+	for (i = 0; i < t->tag->nentries; i++) {
+		e = &t->tag->entries[i];
+		if (t->tag->is_signed ?
+		    (((int64_t)tag >= (int64_t)e->start) &&
+		     ((int64_t)tag <= (int64_t)e->end)) :
+		    ((tag >= e->start) && (tag <= e->end)))
+			return t->options[i];
+	}
+	return -1;
+}
+
+static int decode_struct(const struct ntype *t, struct cursor *c,
+			 uint64_t *frame);
+
+/*
+ * Decode a field at the cursor: val gets integer values, and the byte
+ * offset in the packet of strings and arrays. frame holds the fields of
+ * the enclosing structure decoded so far.
+ */
+static int decode(const struct ntype *t, struct cursor *c, uint64_t *val,
+		  const uint64_t *frame)
+{
+	uint64_t local[NATIVE_MAX_FIELDS], n, i;
+	const unsigned char *nul;
+	const struct ntype *e;
+	int opt;
+
+	switch (t->kind) {
+
+	case NT_INTEGER:
+	case NT_ENUM:
+	case NT_FLOAT:
+		c->pos = align_up(c->pos, t->align);
+		if (c->pos+t->size > c->end)
+			return -1;
+		if (t->kind != NT_FLOAT) {
+			*val = read_bits(c->base, c->pos, t->size, t->order);
+			if (t->is_signed && (t->size < 64) &&
+			    ((*val >> (t->size-1)) & 1))
+				*val |= ~(uint64_t)0 << t->size;
+		}
+		c->pos += t->size;
+		return 0;
+
+	case NT_STRING:
+		c->pos = align_up(c->pos, 8);
+		if (c->pos >= c->end)
+			return -1;
+		*val = c->pos >> 3;
+		nul = memchr(c->base+*val, 0, (c->end >> 3)-*val);
+		if (!nul)
+			return -1;
+		c->pos = (uint64_t)(nul+1-c->base) << 3;
+		return 0;
+
+	case NT_STRUCT:
+		return decode_struct(t, c, local);
+
+	case NT_VARIANT:
+		opt = variant_option(t, frame[t->ref]);
+		if (opt < 0)
+			return -1;
+		return decode(t->fields[opt].type, c, val, frame);
+
+	case NT_ARRAY:
+	case NT_SEQUENCE:
+		e = t->elem;
+		n = (t->kind == NT_ARRAY) ? t->length : frame[t->ref];
+		c->pos = align_up(c->pos, e->align);
+		*val = c->pos >> 3;
+		/* elements of a fixed size are skipped at once */
+		if ((e->kind <= NT_FLOAT) && !(e->size % e->align)) {
+			if (n > (c->end-c->pos)/e->size)
+				return -1;
+			c->pos += n*e->size;
+			return 0;
+		}
+		for (i = 0; i < n; i++) {
+			if ((c->pos > c->end) || decode(e, c, local, frame))
+				return -1;
+		}
+		return 0;
+	}
+	return -1;
+}
+
+static int decode_struct(const struct ntype *t, struct cursor *c,
+			 uint64_t *frame)
+{
+	unsigned int i;
+	const struct nfield *f;
+
+	c->pos = align_up(c->pos, t->align);
+	for (i = 0; i < t->nfields; i++) {
+		f = &t->fields[i];
+		if (decode(f->type, c, &frame[i], frame))
+			return -1;
+		if (c->ns && f->role)
+			header_role(c->ns, f, frame[i]);
+	}
+	return 0;
+}
+
+/*
+ * Give back the mapped pages before offset: read once, they would stay in
+ * the RSS up to the trace size. Pages read again after a seek back come
+ * from the file once more.
+ */
+static void drop_behind(struct native_stream *ns, size_t offset)
+{
+	size_t end = offset & ~((size_t)sysconf(_SC_PAGESIZE)-1);
+
+	if (end < ns->dropped) {
+		ns->dropped = end;
+	} else if (end >= ns->dropped+DROP_BEHIND) {
+		madvise(ns->map+ns->dropped, end-ns->dropped, MADV_DONTNEED);
+		ns->dropped = end;
+	}
+}
+
+/*
+ * Packet headers and contexts from the last indexed one, the trace layout
+ * is checked on the way. Under --follow, a live session may be writing the
+ * last packet: indexing stops before it, native_grow() goes on from there.
+ */
+static const char *index_packets(struct native_stream *ns)
+{
+	struct ntrace *tr = ns->trace;
+	struct nstream_class *sc;
+	struct npacket *pkt;
+	struct cursor c = {NULL, 0, 0, NULL};
+	uint64_t frame[NATIVE_MAX_FIELDS], id, packet, content;
+	size_t off = ns->indexed, first = off;
+	const char *truncated = NULL;
+
+	while (off < ns->size) {
+		drop_behind(ns, off);
+		c.base = ns->map+off;
+		c.pos = 0;
+		c.end = (uint64_t)(ns->size-off)*8;
+		id = 0;
+		if (tr->packet_header) {
+			if (decode_struct(tr->packet_header, &c, frame)) {
+				truncated = "truncated packet header";
+				break;
+			}
+			if ((tr->magic >= 0) && (frame[tr->magic] != CTF_MAGIC))
+				return "bad packet magic";
+			if (tr->stream_id >= 0)
+				id = frame[tr->stream_id];
+		}
+		sc = find_stream_class(tr, id);
+		if (!sc)
+			return "unknown stream class";
+		if (ns->cls && (ns->cls != sc))
+			return "packets of several stream classes";
+		ns->cls = sc;
+		ns->stream_id = id;
+
+		if (ns->npackets == ns->alloc) {
+			ns->alloc = ns->alloc ? 2*ns->alloc : 64;
+			ns->packets = realloc(ns->packets,
+					      sizeof(*ns->packets)*ns->alloc);
+			assert(ns->packets);
+		}
+		pkt = &ns->packets[ns->npackets];
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->offset = off;
+		if (decode_struct(sc->packet, &c, frame)) {
+			truncated = "truncated packet context";
+			break;
+		}
+		packet = (sc->packet_size >= 0) ? frame[sc->packet_size] :
+			c.end;
+		content = (sc->content_size >= 0) ? frame[sc->content_size] :
+			packet;
+		if (!packet || (packet % 8) || (content > packet) ||
+		    (content < c.pos))
+			return "bad packet size";
+		if (packet > c.end) {
+			truncated = "bad packet size";
+			break;
+		}
+		pkt->content_size = content;
+		pkt->data = c.pos;
+		if (sc->ts_begin >= 0)
+			pkt->begin = frame[sc->ts_begin];
+		if (sc->ts_end >= 0)
+			pkt->end = frame[sc->ts_end];
+		if (sc->discarded >= 0)
+			pkt->discarded = frame[sc->discarded];
+		if (sc->seq >= 0)
+			pkt->seq = frame[sc->seq];
+		pkt->cpu_id = (int)frame[sc->cpu_id];
+		ns->npackets++;
+		off += packet/8;
+	}
+	ns->indexed = off;
+	/* the walk starts over from the first packet */
+	first &= ~((size_t)sysconf(_SC_PAGESIZE)-1);
+	if (ns->size > first)
+		madvise(ns->map+first, ns->size-first, MADV_DONTNEED);
+	ns->dropped = 0;
+	if (truncated && !(follow_interval > 0.0))
+		return truncated;
+	return NULL;
+}
+
+static void enter_packet(struct native_stream *ns)
+{
+	const struct npacket *pkt = &ns->packets[ns->packet];
+
+	drop_behind(ns, pkt->offset);
+	ns->pos = pkt->data;
+	/* babeltrace 1 starts the clock of a packet at its beginning */
+	if (ns->cls->ts_begin >= 0)
+		ns->cycles = pkt->begin;
+}
+
+/* first packet ending at or after ts, as a babeltrace time seek */
+static void seek_time(struct native_stream *ns, uint64_t ts)
+{
+	unsigned int i = 0;
+
+	if (ns->cls && (ns->cls->ts_end >= 0)) {
+		while ((i < ns->npackets) &&
+		       (clock_ns(ns->cls->clock, ns->packets[i].end) < ts))
+			i++;
+	}
+	ns->packet = i;
+	if (i < ns->npackets)
+		enter_packet(ns);
+	ns->seek = ts;
+}
+
+/* decode the next event of the stream, 0 at its end */
+static int next_event(struct native_stream *ns)
+{
+	struct cursor c;
+	struct nstream_class *sc = ns->cls;
+	const struct npacket *pkt;
+	struct nevent *ev;
+	uint64_t scratch[NATIVE_MAX_FIELDS];
+
+	for (;;) {
+		if (ns->packet >= ns->npackets)
+			return 0;
+		pkt = &ns->packets[ns->packet];
+		if (ns->pos >= pkt->content_size) {
+			if (++ns->packet < ns->npackets)
+				enter_packet(ns);
+			continue;
+		}
+
+		c.base = ns->map+pkt->offset;
+		c.pos = ns->pos;
+		c.end = pkt->content_size;
+		c.ns = ns;
+		ns->id = 0;
+		if (sc->header && decode_struct(sc->header, &c, ns->header))
+			break;
+		c.ns = NULL;
+		ev = (ns->id < sc->nevents) ? sc->events[ns->id] : NULL;
+		if (!ev)
+			FATAL("unknown event id %" PRIu64 " in stream '%s'\n",
+			      ns->id, ns->path);
+		if (sc->context && decode_struct(sc->context, &c, scratch))
+			break;
+		if (ev->context && decode_struct(ev->context, &c, scratch))
+			break;
+		if (ev->fields && decode_struct(ev->fields, &c, ns->fields))
+			break;
+		if (c.pos == ns->pos)
+			break;
+
+		ns->pos = c.pos;
+		ns->event = ev;
+		ns->ts = clock_ns(sc->clock, ns->cycles);
+		if (ns->ts < ns->seek)
+			continue;
+		ns->seek = 0;
+		return 1;
+	}
+	FATAL("corrupted event in stream '%s', packet %u\n", ns->path,
+	      ns->packet);
+}
+
+static void warn_fields(const struct ntype *fields)
+{
+	unsigned int i;
+	const struct nfield *f;
+
+	for (i = 0; i < fields->nfields; i++) {
+		f = &fields->fields[i];
+		if ((f->type->kind != NT_INTEGER) &&
+		    (f->type->kind != NT_STRING) &&
+		    (f->type->kind != NT_ARRAY))
+			DIAG("field '%s' has unsupported CTF type %d\n",
+			     f->name, ctf_type_ids[f->type->kind]);
+	}
+}
+
+/* what decode_event() makes of the event, -1 for events not to convert */
+static int make_record(struct native_stream *ns, struct event_record *rec,
+		       struct packet_counters *counters)
+{
+	unsigned int i;
+	const struct nevent *ev = ns->event;
+	const struct npacket *pkt = &ns->packets[ns->packet];
+	const unsigned char *base = ns->map+pkt->offset;
+	const struct narg *a;
+	struct event_arg *arg;
+	uint64_t val;
+
+	rec->timestamp = host_clock(ns->host, ns->ts);
+	if (!ev->mod)
+		return -1;
+	rec->mod = ev->mod;
+	rec->name = ev->name;
+	rec->host = ns->host;
+	rec->cpu_id = pkt->cpu_id;
+
+	/* the stream gap accounting sees every packet, filtered or not */
+	rec->lost_events = rec->lost_packets = 0;
+	rec->lost_channel = NULL;
+	if ((ns->cls->discarded >= 0) || (ns->cls->seq >= 0)) {
+		if (!ns->channel)
+			ns->channel = lost_channel(ns->host, ns->origin,
+						   ns->stream_id, pkt->cpu_id);
+		counters->channel = ns->channel;
+		counters->discarded = pkt->discarded;
+		counters->seq = pkt->seq;
+		counters->has_seq = ns->cls->seq >= 0;
+	}
+	if (filter_cpu(rec->cpu_id))
+		return -1;
+	rec->cpu_id = host_cpu_id(ns->host, rec->cpu_id);
+	/* host_cpu_id() warned already */
+	if ((nb_hosts > 1) && (rec->cpu_id >= MAX_CPU))
+		return -1;
+
+	rec->nargs = 0;
+	rec->strpos = 0;
+	rec->source = NULL;
+	for (i = 0; (i < ev->nargs) && (rec->nargs < MAX_EVENT_ARGS); i++) {
+		a = &ev->args[i];
+		arg = &rec->args[rec->nargs++];
+		arg->name = a->name;
+		val = ns->fields[a->field];
+		switch (a->kind) {
+
+		case NARG_I64:
+			arg->value.i64 = (int64_t)val;
+			arg->value.type = ARG_I64;
+			break;
+
+		case NARG_U64:
+			arg->value.u64 = val;
+			arg->value.type = ARG_U64;
+			break;
+
+		case NARG_STRING:
+			arg->value.s = (const char *)base+val;
+			arg->value.type = ARG_STR;
+			break;
+
+		case NARG_CHARS:
+			arg->value.s = record_strndup(rec,
+					(const char *)base+val, a->length);
+			arg->value.type = ARG_STR;
+			break;
+		}
+	}
+
+	/* babeltrace warns about the fields it cannot read, so do we */
+	if (ev->fields && (ev->nargs < ev->fields->nfields) &&
+	    !__atomic_exchange_n(&ns->event->warned, 1, __ATOMIC_RELAXED))
+		warn_fields(ev->fields);
+	return 0;
+}
+
+struct native_stream *native_open(const char *tracedir, const char *path,
+				  int host)
+{
+	int fd;
+	struct stat sb;
+	struct ntrace *tr;
+	struct native_stream *ns;
+	const char *error = NULL;
+
+	pthread_mutex_lock(&traces_lock);
+	tr = get_trace(tracedir);
+	pthread_mutex_unlock(&traces_lock);
+	if (tr->failed)
+		return NULL;
+	/* the layout of its other streams no longer describes the trace */
+	if ((follow_interval > 0.0) &&
+	    (metadata_size(tracedir) != tr->metadata_size)) {
+		DIAG("stream '%s' is decoded by babeltrace: metadata changed\n",
+		     path);
+		return NULL;
+	}
+
+	ns = calloc(1, sizeof(*ns));
+	assert(ns);
+	ns->trace = tr;
+	ns->host = host;
+	ns->path = strdup(path);
+	ns->origin = strdup(tracedir);
+	assert(ns->path && ns->origin);
+
+	fd = open(path, O_RDONLY);
+	if ((fd < 0) || fstat(fd, &sb)) {
+		error = strerror(errno);
+	} else if (sb.st_size > 0) {
+		ns->size = sb.st_size;
+		ns->map = mmap(NULL, ns->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ns->map == MAP_FAILED) {
+			ns->map = NULL;
+			error = strerror(errno);
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+	if (!error)
+		error = index_packets(ns);
+	if (error) {
+		DIAG("stream '%s' is decoded by babeltrace: %s\n", path,
+		     error);
+		native_close(ns);
+		return NULL;
+	}
+	INFO("stream '%s': %u packets, native decoder\n", path,
+	     ns->npackets);
+	return ns;
+}
+
+/*
+ * Under --follow: index the packets appended to the stream since the last
+ * call. Records point into the mapping, none may be left. Return 1 if the
+ * stream got packets, 0 if not, -1 if it is to be left to babeltrace: new
+ * packets are malformed, or the metadata of the trace changed (events were
+ * enabled in the session).
+ */
+int native_grow(struct native_stream *ns)
+{
+	int fd;
+	struct stat sb;
+	unsigned char *map;
+	unsigned int npackets = ns->npackets;
+	const char *error = NULL;
+
+	fd = open(ns->path, O_RDONLY);
+	if ((fd < 0) || fstat(fd, &sb) || ((size_t)sb.st_size <= ns->size)) {
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	if (metadata_size(ns->origin) != ns->trace->metadata_size) {
+		error = "metadata changed";
+	} else {
+		map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			error = strerror(errno);
+		} else {
+			if (ns->map)
+				munmap(ns->map, ns->size);
+			ns->map = map;
+			ns->size = sb.st_size;
+			error = index_packets(ns);
+		}
+	}
+	close(fd);
+	if (error) {
+		DIAG("stream '%s' is decoded by babeltrace from now on: %s\n",
+		     ns->path, error);
+		return -1;
+	}
+	return ns->npackets != npackets;
+}
+
+uint64_t native_stream_id(const struct native_stream *ns)
+{
+	return ns->stream_id;
+}
+
+/* time range of the stream, from its first and last packets */
+int native_range(const struct native_stream *ns, uint64_t *begin,
+		 uint64_t *end)
+{
+	if (!ns->npackets || (ns->cls->ts_begin < 0) || (ns->cls->ts_end < 0))
+		return -1;
+	*begin = clock_ns(ns->cls->clock, ns->packets[0].begin);
+	*end = clock_ns(ns->cls->clock, ns->packets[ns->npackets-1].end);
+	return 0;
+}
+
+/* walk_start() on the stream, from a timestamp if not 0 */
+void native_start(struct native_stream *ns, uint64_t from)
+{
+	const struct time_window *window = get_time_window();
+
+	ns->state = (window->enabled && !from) ? WALK_STATEDUMP : WALK_EVENTS;
+	ns->seek = 0;
+	if (from) {
+		seek_time(ns, from);
+	} else {
+		ns->packet = 0;
+		if (ns->npackets)
+			enter_packet(ns);
+	}
+}
+
+/*
+ * Next event of the walk: 1 with rec decoded, 0 for an event not to
+ * convert (rec only holds its timestamp), -1 at the end of the walk.
+ * Strings point into the mapped stream, or into rec.
+ */
+int native_read(struct native_stream *ns, struct event_record *rec,
+		struct packet_counters *counters)
+{
+	const struct time_window *window = get_time_window();
+
+	counters->channel = NULL;
+	while (ns->state != WALK_END) {
+		if (!next_event(ns)) {
+			if (ns->state == WALK_EVENTS) {
+				ns->state = WALK_END;
+				break;
+			}
+			seek_time(ns, window->lead_in);
+			ns->state = WALK_EVENTS;
+			continue;
+		}
+
+		if (ns->state == WALK_EVENTS) {
+			if (window->enabled && (ns->ts > window->end)) {
+				ns->state = WALK_END;
+				break;
+			}
+			return make_record(ns, rec, counters) ? 0 : 1;
+		}
+
+		/* statedump events up to the lead-in */
+		if ((ns->ts <= window->dump_end) &&
+		    (ns->ts < window->lead_in)) {
+			if (ns->event->statedump)
+				return make_record(ns, rec, counters) ? 0 : 1;
+			continue;
+		}
+		seek_time(ns, window->lead_in);
+		ns->state = WALK_EVENTS;
+	}
+	return -1;
+}
+
+void native_close(struct native_stream *ns)
+{
+	if (ns->map)
+		munmap(ns->map, ns->size);
+	free(ns->packets);
+	free(ns->path);
+	free(ns->origin);
+	free(ns);
+}
+
+/* trace layouts stay until every record pointing to them is gone */
+void native_free(void)
+{
+	struct ntrace *tr;
+
+	while ((tr = traces)) {
+		traces = tr->next;
+		free_trace_layout(tr);
+		free(tr->dir);
+		free(tr);
+	}
+}
@@ -0,0 +1,1363 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "ctf.h"
+
+#include <babeltrace/babeltrace.h>
+#include <babeltrace/ctf/iterator.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stddef.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+/* bytes of decoded events buffered per stream */
+#define RING_BYTES                (64*1024)
+/* strings of an event past this are truncated, a record fits the ring */
+#define RECORD_STRINGS            (RING_BYTES/8)
+/* events taken from each stream in turn, in pass 1 */
+#define STREAM_BATCH              (128)
+/* events a worker decodes from a stream before moving to the next one */
+#define WORKER_BATCH              (256)
+/* a stream that has not grown for this many rounds is no longer waited for */
+#define FOLLOW_IDLE_ROUNDS        (10)
+
+/*
+ * A decoded event in a stream ring: the used part of its record, up to its
+ * last argument, then its strings. Events without module are kept as bare
+ * timestamps, they move the merge heap as they do in babeltrace. Packet
+ * counters go along, the merge accounts gaps in the serial order.
+ */
+struct packed_event {
+	uint32_t                size;     /* ring record, 0 pads the end */
+	uint32_t                skipped;
+	struct packet_counters  counters;
+	struct event_record     rec;      /* truncated */
+};
+
+#define PACKED_SIZE(len) \
+	((offsetof(struct packed_event, rec)+(len)+7) & ~(size_t)7)
+
+struct worker;
+
+/*
+ * Babeltrace opens whole trace directories; give each stream file a private
+ * directory holding only the metadata and that stream, and a context of its
+ * own. Workers decode the streams into per-stream rings, events are then
+ * merged by timestamp in the main thread. Ring positions are only updated
+ * with atomics, sides only take the worker lock to sleep.
+ */
+struct stream {
+	int                  index;
+	int                  trace;    /* trace directory order */
+	int                  host;
+	char                *path;
+	char                *origin;  /* trace directory of the stream */
+	char                *name;     /* of the stream file, in its trace */
+	uint64_t             size;     /* of the stream file */
+	uint64_t             stream_id;
+	struct worker       *worker;
+	pthread_cond_t       cond;     /* consumer sleeps here */
+	size_t               head;
+	size_t               tail;
+	int                  done;
+	int                  consumer_waits;
+	struct packed_event *next;     /* peeked by the consumer */
+	uint64_t             last_ts;  /* of the last event merged */
+	unsigned int         same;     /* events merged at last_ts */
+	/* where the decoder starts, see merge_save() */
+	uint64_t             from;
+	unsigned int         skip;
+	int                  exhausted;
+	/* follow mode, see parallel_follow() */
+	int                  fallback; /* left to babeltrace */
+	int                  grown;
+	unsigned int         idle;     /* rounds it did not grow during */
+	/* decoder side, native streams have no babeltrace context */
+	struct native_stream *native;
+	struct bt_context   *ctx;
+	int                  tid;
+	struct bt_ctf_iter  *iter;
+	struct event_walk    walk;
+	int                  started;
+	int                  finished;
+	int                  pending;  /* scratch holds the current event */
+	size_t               need;     /* ring bytes of the pending event */
+	struct decode_cache  cache;
+	struct event_record  scratch;
+	uint64_t             ring[RING_BYTES/sizeof(uint64_t)];
+};
+
+/*
+ * One worker per online CPU, each one decodes several streams in turn, a
+ * batch at a time. It only sleeps when none of its streams has room left.
+ */
+struct worker {
+	pthread_t            thread;
+	pthread_mutex_t      lock;
+	pthread_cond_t       cond;     /* worker sleeps here */
+	int                  waits;
+	int                  stop;
+	struct stream      **streams;
+	int                  nb_streams;
+	uint64_t             load;     /* bytes of its stream files */
+};
+
+static char *tmpdir;
+static struct stream **streams;
+static int nb_streams;
+static int nb_traces;
+static struct worker *workers;
+static int nb_workers;
+/* merge heap, and the layout to restore, see merge_save() */
+static struct stream **heap;
+static int heap_len = -1;      /* -1 when not merging */
+static int *resume_heap;
+static int resume_len = -1;    /* -1 to merge from the start */
+/* follow mode: each round goes on from the merge position of the last one */
+static int following;
+static uint64_t follow_last;   /* timestamp of the last event merged */
+
+static void link_or_die(const char *target, const char *fmt, ...)
+{
+	va_list ap;
+	char path[PATH_MAX];
+
+	va_start(ap, fmt);
+	vsnprintf(path, sizeof(path), fmt, ap);
+	va_end(ap);
+
+	if (symlink(target, path))
+		FATAL("cannot link '%s': %s\n", path, strerror(errno));
+}
+
+static int current_host;
+
+static struct stream *find_stream(const char *tracedir, const char *file)
+{
+	int i;
+	size_t len = strlen(tracedir);
+	const char *name;
+
+	for (i = 0; i < nb_streams; i++) {
+		name = streams[i]->name;
+		if ((strncmp(name, tracedir, len) == 0) &&
+		    (name[len] == '/') && (strcmp(name+len+1, file) == 0))
+			return streams[i];
+	}
+	return NULL;
+}
+
+static void add_stream(const char *tracedir, const char *file,
+		       uint64_t size)
+{
+	int ret;
+	char *path, *index;
+	struct stream *st;
+	char real[PATH_MAX];
+
+	st = calloc(1, sizeof(*st));
+	assert(st);
+	st->index = nb_streams;
+	st->trace = nb_traces;
+	st->host = current_host;
+	st->size = size;
+	st->origin = strdup(tracedir);
+	assert(st->origin);
+	ret = asprintf(&st->name, "%s/%s", tracedir, file);
+	assert(ret > 0);
+
+	ret = asprintf(&st->path, "%s/%d", tmpdir, nb_streams);
+	assert(ret > 0);
+	if (mkdir(st->path, 0700))
+		FATAL("cannot create '%s': %s\n", st->path, strerror(errno));
+
+	/* files may be links to memory files (archives), keep them */
+	if (!realpath(tracedir, real))
+		FATAL("cannot resolve '%s'\n", tracedir);
+
+	ret = asprintf(&path, "%s/metadata", real);
+	assert(ret > 0);
+	link_or_die(path, "%s/metadata", st->path);
+	free(path);
+
+	ret = asprintf(&path, "%s/%s", real, file);
+	assert(ret > 0);
+	link_or_die(path, "%s/%s", st->path, file);
+	free(path);
+
+	/* reuse the LTTng packet index when there is one */
+	ret = asprintf(&path, "%s/index/%s.idx", real, file);
+	assert(ret > 0);
+	if (access(path, R_OK) == 0) {
+		ret = asprintf(&index, "%s/index", st->path);
+		assert(ret > 0);
+		if (mkdir(index, 0700) && (errno != EEXIST))
+			FATAL("cannot create '%s': %s\n", index,
+			      strerror(errno));
+		link_or_die(path, "%s/%s.idx", index, file);
+		free(index);
+	}
+	free(path);
+
+	pthread_cond_init(&st->cond, NULL);
+
+	streams = realloc(streams, sizeof(*streams)*(nb_streams+1));
+	assert(streams);
+	streams[nb_streams++] = st;
+	INFO("stream %d: %s/%s\n", nb_streams-1, tracedir, file);
+}
+
+static int traverse_stream_dir(const char *fpath, const struct stat *sb,
+			       int tflag, struct FTW *ftwbuf)
+{
+	int ret;
+	DIR *dir;
+	char *metadata;
+	struct dirent *ent;
+	struct stat st;
+
+	if (tflag != FTW_D)
+		return 0;
+
+	ret = asprintf(&metadata, "%s/metadata", fpath);
+	assert(ret > 0);
+	ret = access(metadata, R_OK);
+	free(metadata);
+	if (ret)
+		return 0;
+
+	dir = opendir(fpath);
+	if (!dir)
+		FATAL("cannot open trace '%s'\n", fpath);
+
+	while ((ent = readdir(dir))) {
+		if ((ent->d_name[0] == '.') ||
+		    (strcmp(ent->d_name, "metadata") == 0))
+			continue;
+		if (fstatat(dirfd(dir), ent->d_name, &st, 0) ||
+		    !S_ISREG(st.st_mode))
+			continue;
+		/* follow mode walks the trace again on every round */
+		if (following && find_stream(fpath, ent->d_name))
+			continue;
+		add_stream(fpath, ent->d_name, following ? 0 : st.st_size);
+	}
+	closedir(dir);
+	nb_traces++;
+	return 0;
+}
+
+static void make_tmpdir(void)
+{
+	int ret;
+
+	if (tmpdir)
+		return;
+	ret = asprintf(&tmpdir, "%s/lttng2lxt-XXXXXX",
+		       getenv("TMPDIR") ? : "/tmp");
+	assert(ret > 0);
+	if (!mkdtemp(tmpdir))
+		FATAL("cannot create '%s': %s\n", tmpdir, strerror(errno));
+}
+
+/* add the streams of a trace, merged hosts call this once each */
+void parallel_open(const char *name, int host)
+{
+	int ret, first = nb_streams;
+
+	make_tmpdir();
+	current_host = host;
+	ret = nftw(name, traverse_stream_dir, 10, 0);
+	if (ret < 0)
+		FATAL("cannot open trace '%s'\n", name);
+	if (nb_streams == first)
+		FATAL("no stream found in trace '%s'\n", name);
+}
+
+static void stream_close_context(struct stream *st)
+{
+	decode_cache_free(&st->cache);
+	bt_context_remove_trace(st->ctx, st->tid);
+	bt_context_put(st->ctx);
+	st->ctx = NULL;
+}
+
+/*
+ * A babeltrace context on the private directory of the stream, -1 if it
+ * cannot be opened. The context it replaces, if any, is closed.
+ */
+static int stream_open_context(struct stream *st)
+{
+	int tid;
+	struct bt_context *ctx;
+
+	ctx = bt_context_create();
+	assert(ctx);
+	tid = bt_context_add_trace(ctx, st->path, "ctf", NULL, NULL, NULL);
+	if (tid < 0) {
+		bt_context_put(ctx);
+		return -1;
+	}
+	if (st->ctx)
+		stream_close_context(st);
+	st->ctx = ctx;
+	st->tid = tid;
+	decode_cache_load(&st->cache, st->ctx, st->tid);
+	st->cache.host = st->host;
+	st->cache.path = st->origin;
+	st->cache.defer_lost = 1;
+	return 0;
+}
+
+static int remove_entry(const char *fpath, const struct stat *sb,
+			int tflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+static void free_workers(void)
+{
+	int i;
+
+	for (i = 0; i < nb_workers; i++) {
+		pthread_mutex_destroy(&workers[i].lock);
+		pthread_cond_destroy(&workers[i].cond);
+		free(workers[i].streams);
+	}
+	free(workers);
+	workers = NULL;
+	nb_workers = 0;
+}
+
+void parallel_close(void)
+{
+	int i;
+	struct stream *st;
+
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		if (st->native)
+			native_close(st->native);
+		if (st->ctx)
+			stream_close_context(st);
+		pthread_cond_destroy(&st->cond);
+		free(st->path);
+		free(st->origin);
+		free(st->name);
+		free(st);
+	}
+	free(streams);
+	streams = NULL;
+	nb_streams = 0;
+	free(resume_heap);
+	resume_heap = NULL;
+	resume_len = -1;
+	following = 0;
+	follow_last = 0;
+	nb_traces = 0;
+	free_workers();
+	native_free();
+
+	/* private directories only hold symlinks, do not follow them */
+	(void)nftw(tmpdir, remove_entry, 10, FTW_DEPTH|FTW_PHYS);
+	free(tmpdir);
+	tmpdir = NULL;
+}
+
+static int compare_sizes(const void *a, const void *b)
+{
+	const struct stream *sa = *(struct stream * const *)a;
+	const struct stream *sb = *(struct stream * const *)b;
+
+	if (sa->size != sb->size)
+		return (sa->size < sb->size) ? 1 : -1;
+	return sa->index-sb->index;
+}
+
+/* biggest streams first, each one to the least loaded worker */
+static void assign_workers(void)
+{
+	int i, j, n;
+	struct stream **order;
+	struct worker *w;
+
+	n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	nb_workers = (n < 1) ? 1 : (n > nb_streams) ? nb_streams : n;
+	workers = calloc(nb_workers, sizeof(*workers));
+	order = malloc(nb_streams*sizeof(*order));
+	assert(workers && order);
+
+	memcpy(order, streams, nb_streams*sizeof(*order));
+	qsort(order, nb_streams, sizeof(*order), compare_sizes);
+	for (i = 0; i < nb_streams; i++) {
+		w = &workers[0];
+		for (j = 1; j < nb_workers; j++) {
+			if (workers[j].load < w->load)
+				w = &workers[j];
+		}
+		w->streams = realloc(w->streams,
+				     sizeof(*w->streams)*(w->nb_streams+1));
+		assert(w->streams);
+		w->streams[w->nb_streams++] = order[i];
+		w->load += order[i]->size;
+		order[i]->worker = w;
+	}
+	free(order);
+
+	for (i = 0; i < nb_workers; i++) {
+		pthread_mutex_init(&workers[i].lock, NULL);
+		pthread_cond_init(&workers[i].cond, NULL);
+	}
+	INFO("decoding %d streams on %d workers\n", nb_streams, nb_workers);
+}
+
+static size_t load(size_t *pos)
+{
+	return __atomic_load_n(pos, __ATOMIC_SEQ_CST);
+}
+
+static void store(size_t *pos, size_t val)
+{
+	__atomic_store_n(pos, val, __ATOMIC_SEQ_CST);
+}
+
+static int flag(int *flag)
+{
+	return __atomic_load_n(flag, __ATOMIC_SEQ_CST);
+}
+
+static void set_flag(int *flag, int val)
+{
+	__atomic_store_n(flag, val, __ATOMIC_SEQ_CST);
+}
+
+static struct packed_event *ring_at(struct stream *st, size_t pos)
+{
+	return (struct packed_event *)((char *)st->ring+pos);
+}
+
+/* ring bytes taken by a record of len bytes at tail, with padding */
+static size_t ring_need(size_t tail, size_t len)
+{
+	size_t need = PACKED_SIZE(len);
+	size_t pos = tail % RING_BYTES;
+
+	/* records do not wrap */
+	return (RING_BYTES-pos < need) ? need+RING_BYTES-pos : need;
+}
+
+/* bytes a string takes in a record with room bytes left for strings */
+static size_t string_size(const char *s, size_t room)
+{
+	size_t len = strlen(s)+1;
+
+	return (len < room) ? len : room;
+}
+
+/* packet header stream id, babeltrace merges streams in this order */
+static uint64_t get_stream_id(struct bt_ctf_event *ctf_event)
+{
+	const struct bt_definition *header, *def;
+
+	header = bt_ctf_get_top_level_scope(ctf_event, BT_TRACE_PACKET_HEADER);
+	def = header ? bt_ctf_get_field(ctf_event, header, "stream_id") : NULL;
+	return def ? bt_ctf_get_uint64(def) : 0;
+}
+
+/* decode the current event to scratch, its strings stay in babeltrace */
+static void stream_decode(struct stream *st, struct bt_ctf_event *ctf_event)
+{
+	struct event_record *rec = &st->scratch;
+
+	if (!st->started) {
+		st->stream_id = get_stream_id(ctf_event);
+		st->started = 1;
+	}
+
+	st->cache.counters.channel = NULL;
+	if (decode_event(ctf_event, rec, &st->cache)) {
+		rec->nargs = -1;
+		rec->timestamp = host_clock(st->host,
+					    bt_ctf_get_timestamp(ctf_event));
+	}
+}
+
+/* ring bytes of the event in scratch */
+static void stream_measure(struct stream *st)
+{
+	int i;
+	size_t room = RECORD_STRINGS;
+	struct event_record *rec = &st->scratch;
+
+	if (rec->nargs < 0) {
+		st->need = sizeof(rec->timestamp);
+		return;
+	}
+
+	/* strings follow the arguments */
+	for (i = 0; i < rec->nargs; i++) {
+		if (rec->args[i].value.type == ARG_STR)
+			room -= string_size(rec->args[i].value.s, room);
+	}
+	st->need = offsetof(struct event_record, args[rec->nargs])+
+		RECORD_STRINGS-room;
+}
+
+/* copy the decoded event to the ring, total bytes at tail */
+static void stream_pack(struct stream *st, size_t tail, size_t total)
+{
+	int i;
+	size_t len, room = RECORD_STRINGS;
+	struct event_record *rec = &st->scratch;
+	struct packed_event *pe;
+	struct event_arg *arg;
+	char *strings;
+
+	pe = ring_at(st, tail % RING_BYTES);
+	if (total != PACKED_SIZE(st->need)) {
+		pe->size = 0;
+		pe = ring_at(st, 0);
+	}
+	pe->size = total;
+	pe->counters = st->cache.counters;
+
+	if (rec->nargs < 0) {
+		pe->skipped = 1;
+		pe->rec.timestamp = rec->timestamp;
+		return;
+	}
+
+	pe->skipped = 0;
+	len = offsetof(struct event_record, args[rec->nargs]);
+	memcpy(&pe->rec, rec, len);
+	strings = (char *)&pe->rec+len;
+	for (i = 0; i < rec->nargs; i++) {
+		arg = &pe->rec.args[i];
+		if (arg->value.type != ARG_STR)
+			continue;
+		len = string_size(arg->value.s, room);
+		if (len == 0) {
+			arg->value.s = "";
+			continue;
+		}
+		memcpy(strings, arg->value.s, len-1);
+		strings[len-1] = '\0';
+		arg->value.s = strings;
+		strings += len;
+		room -= len;
+	}
+}
+
+/* make what the worker decoded visible, wake the consumer if it sleeps */
+static void stream_publish(struct stream *st, size_t tail, int done)
+{
+	store(&st->tail, tail);
+	if (done)
+		set_flag(&st->done, 1);
+	if (flag(&st->consumer_waits)) {
+		pthread_mutex_lock(&st->worker->lock);
+		pthread_cond_signal(&st->cond);
+		pthread_mutex_unlock(&st->worker->lock);
+	}
+}
+
+/* decode the next event to scratch, 0 at the end of the walk */
+static int stream_next(struct stream *st)
+{
+	int ret;
+	struct bt_ctf_event *ctf_event;
+
+	if (st->native) {
+		ret = native_read(st->native, &st->scratch,
+				  &st->cache.counters);
+		if (ret < 0)
+			return 0;
+		if (ret == 0)
+			st->scratch.nargs = -1;
+	} else {
+		ctf_event = walk_event(&st->walk);
+		if (!ctf_event)
+			return 0;
+		stream_decode(st, ctf_event);
+	}
+	stream_measure(st);
+	return 1;
+}
+
+/* events of a native stream, from the same position as walk_start() */
+static void native_stream_start(struct stream *st)
+{
+	unsigned int i;
+
+	native_start(st->native,
+		     st->from ? st->from-host_clock(st->host, 0) : 0);
+	st->stream_id = native_stream_id(st->native);
+	st->started = 1;
+	for (i = 0; i < st->skip; i++) {
+		if (native_read(st->native, &st->scratch,
+				&st->cache.counters) < 0)
+			break;
+	}
+}
+
+static void stream_start(struct stream *st)
+{
+	unsigned int i;
+	struct bt_iter_pos begin_pos;
+
+	/* streams the native decoder cannot read fall back to babeltrace */
+	if (native_decode && !st->native && !st->ctx && !following)
+		st->native = native_open(st->origin, st->name, st->host);
+
+	st->finished = 0;
+	st->pending = 0;
+	if (st->native) {
+		native_stream_start(st);
+		goto positioned;
+	}
+
+	/* contexts stay open across passes, metadata is parsed once */
+	if (!st->ctx) {
+		/* follow mode opens streams between rounds */
+		if (following)
+			goto positioned;
+		if (stream_open_context(st))
+			FATAL("cannot open stream '%s' for reading\n",
+			      st->path);
+	}
+
+	begin_pos.type = BT_SEEK_BEGIN;
+	st->iter = bt_ctf_iter_create(st->ctx, &begin_pos, NULL);
+	if (!st->iter)
+		FATAL("cannot iterate on stream '%s'\n", st->path);
+	/* back to the stream clock, host offsets included */
+	walk_start(&st->walk, st->iter, st->path,
+		   st->from ? st->from-host_clock(st->host, 0) : 0);
+
+	/* events at the start timestamp the merge has taken already */
+	for (i = 0; i < st->skip; i++) {
+		if (!walk_event(&st->walk))
+			break;
+		walk_next(&st->walk);
+	}
+positioned:
+	if (st->exhausted) {
+		st->finished = 1;
+		stream_publish(st, 0, 1);
+	}
+}
+
+static void stream_stop(struct stream *st)
+{
+	if (st->iter)
+		bt_ctf_iter_destroy(st->iter);
+	st->iter = NULL;
+}
+
+/*
+ * Decode a batch of events while the ring has room for them, return how
+ * many. The tail is only published at the end of the batch.
+ */
+static int stream_fill(struct stream *st)
+{
+	int n;
+	size_t head = load(&st->head), tail = st->tail, total;
+
+	for (n = 0; n < WORKER_BATCH; n++) {
+		if (!st->pending) {
+			if (!stream_next(st)) {
+				st->finished = 1;
+				break;
+			}
+			st->pending = 1;
+		}
+		total = ring_need(tail, st->need);
+		if ((RING_BYTES-(tail-head) < total) &&
+		    (RING_BYTES-(tail-(head = load(&st->head))) < total))
+			break;
+		stream_pack(st, tail, total);
+		tail += total;
+		st->pending = 0;
+		if (!st->native)
+			walk_next(&st->walk);
+	}
+
+	if ((tail != st->tail) || st->finished)
+		stream_publish(st, tail, st->finished);
+	return n;
+}
+
+/* the consumer wakes the worker up once a ring is half empty */
+static int worker_has_room(struct worker *w)
+{
+	int i;
+	struct stream *st;
+
+	for (i = 0; i < w->nb_streams; i++) {
+		st = w->streams[i];
+		if (!st->finished && (st->tail-load(&st->head) <= RING_BYTES/2))
+			return 1;
+	}
+	return 0;
+}
+
+static void *worker_run(void *arg)
+{
+	int i, live, decoded;
+	struct worker *w = arg;
+	struct stream *st;
+
+	for (i = 0; i < w->nb_streams; i++)
+		stream_start(w->streams[i]);
+
+	do {
+		live = decoded = 0;
+		for (i = 0; i < w->nb_streams; i++) {
+			st = w->streams[i];
+			if (st->finished)
+				continue;
+			decoded += stream_fill(st);
+			if (!st->finished)
+				live++;
+		}
+		if (!live || decoded)
+			continue;
+
+		/* every ring is full */
+		pthread_mutex_lock(&w->lock);
+		for (;;) {
+			set_flag(&w->waits, 1);
+			if (flag(&w->stop) || worker_has_room(w))
+				break;
+			pthread_cond_wait(&w->cond, &w->lock);
+		}
+		set_flag(&w->waits, 0);
+		pthread_mutex_unlock(&w->lock);
+	} while (live && !flag(&w->stop));
+
+	for (i = 0; i < w->nb_streams; i++)
+		stream_stop(w->streams[i]);
+	return NULL;
+}
+
+/* consumer side: oldest decoded event, NULL once the stream is exhausted */
+static struct packed_event *stream_peek(struct stream *st)
+{
+	struct packed_event *pe;
+
+	if (st->head == load(&st->tail)) {
+		pthread_mutex_lock(&st->worker->lock);
+		for (;;) {
+			set_flag(&st->consumer_waits, 1);
+			if ((st->head != load(&st->tail)) || flag(&st->done))
+				break;
+			pthread_cond_wait(&st->cond, &st->worker->lock);
+		}
+		set_flag(&st->consumer_waits, 0);
+		pthread_mutex_unlock(&st->worker->lock);
+	}
+
+	if (st->head == load(&st->tail)) {
+		st->next = NULL;
+		return NULL;
+	}
+	pe = ring_at(st, st->head % RING_BYTES);
+	/* the record after a pad starts the ring, its size covers both */
+	if (pe->size == 0)
+		pe = ring_at(st, 0);
+	st->next = pe;
+	return pe;
+}
+
+static void stream_release(struct stream *st)
+{
+	struct worker *w = st->worker;
+
+	store(&st->head, st->head+st->next->size);
+	/* let the worker refill half the ring at once */
+	if (flag(&w->waits) && (load(&st->tail)-st->head <= RING_BYTES/2)) {
+		pthread_mutex_lock(&w->lock);
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+/*
+ * Streams are merged the way the babeltrace 1 iterator does it: same
+ * priority heap (prio_heap.c), with streams inserted in the same order and
+ * every event taken into account, events without module included. Events
+ * with equal timestamps thus come out in the order of a serial conversion,
+ * and the output is identical. Except in a time window: each stream skips
+ * to the window on its own, where babeltrace seeks all of them at once.
+ */
+static int stream_gt(struct stream *a, struct stream *b)
+{
+	return a->next->rec.timestamp < b->next->rec.timestamp;
+}
+
+static void heap_insert(struct stream **heap, int *n, struct stream *st)
+{
+	int pos = (*n)++;
+
+	while ((pos > 0) && stream_gt(st, heap[(pos-1)/2])) {
+		heap[pos] = heap[(pos-1)/2];
+		pos = (pos-1)/2;
+	}
+	heap[pos] = st;
+}
+
+static void heapify(struct stream **heap, int n, int i)
+{
+	int l, r, largest;
+	struct stream *tmp;
+
+	for (;;) {
+		l = 2*i+1;
+		r = 2*i+2;
+		largest = ((l < n) && stream_gt(heap[l], heap[i])) ? l : i;
+		if ((r < n) && stream_gt(heap[r], heap[largest]))
+			largest = r;
+		if (largest == i)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[largest];
+		heap[largest] = tmp;
+		i = largest;
+	}
+}
+
+/* babeltrace adds streams by trace, then stream id, then directory order */
+static int compare_streams(const void *a, const void *b)
+{
+	const struct stream *sa = *(struct stream * const *)a;
+	const struct stream *sb = *(struct stream * const *)b;
+
+	if (sa->trace != sb->trace)
+		return (sa->trace < sb->trace) ? -1 : 1;
+	if (sa->stream_id != sb->stream_id)
+		return (sa->stream_id < sb->stream_id) ? -1 : 1;
+	return sa->index-sb->index;
+}
+
+/*
+ * Take the peeked event, NULL when it is not dispatched. Its packet is
+ * accounted here, in merge order, as the serial decoder does. The record
+ * is unpacked to rec, its strings stay in the ring until released.
+ */
+static struct event_record *stream_take(struct stream *st,
+					struct event_record *rec)
+{
+	struct packed_event *pe = st->next;
+
+	if (pe->rec.timestamp == st->last_ts) {
+		st->same++;
+	} else {
+		st->last_ts = pe->rec.timestamp;
+		st->same = 1;
+	}
+
+	if (!pe->skipped)
+		memcpy(rec, &pe->rec,
+		       offsetof(struct event_record, args[pe->rec.nargs]));
+	if (pe->counters.channel)
+		lost_check(pe->counters.channel, pe->counters.discarded,
+			   pe->counters.has_seq, pe->counters.seq, rec);
+	return pe->skipped ? NULL : rec;
+}
+
+/*
+ * Merge position, saved in checkpoints and time shard snapshots: the heap
+ * layout, with the next event of each stream in it as a timestamp and the
+ * events of the stream merged at that timestamp already. Streams out of the
+ * heap are exhausted. A merge restored from it goes on in the same order,
+ * same timestamp events included.
+ */
+static void merge_save(FILE *fp)
+{
+	int i;
+	uint64_t ts;
+	unsigned int skip;
+	struct stream *st;
+
+	state_put(fp, &heap_len, sizeof(heap_len));
+	for (i = 0; i < heap_len; i++) {
+		st = heap[i];
+		ts = st->next->rec.timestamp;
+		skip = (ts == st->last_ts) ? st->same : 0;
+		state_put_str(fp, st->name);
+		state_put(fp, &ts, sizeof(ts));
+		state_put(fp, &skip, sizeof(skip));
+	}
+}
+
+static void merge_restore(FILE *fp)
+{
+	int i, j;
+	char name[LINEBUF_MAX];
+	struct stream *st;
+
+	state_get(fp, &resume_len, sizeof(resume_len));
+	if (resume_len > nb_streams)
+		state_error("stream count");
+	for (i = 0; i < nb_streams; i++) {
+		streams[i]->from = 0;
+		streams[i]->skip = 0;
+		streams[i]->exhausted = (resume_len >= 0);
+	}
+
+	resume_heap = realloc(resume_heap, sizeof(*resume_heap)*nb_streams);
+	assert(resume_heap || !nb_streams);
+	for (i = 0; i < resume_len; i++) {
+		state_get_str(fp, name, sizeof(name));
+		for (j = 0; j < nb_streams; j++) {
+			if (strcmp(streams[j]->name, name) == 0)
+				break;
+		}
+		if (j == nb_streams)
+			state_error("stream");
+		st = streams[j];
+		state_get(fp, &st->from, sizeof(st->from));
+		state_get(fp, &st->skip, sizeof(st->skip));
+		st->exhausted = 0;
+		resume_heap[i] = j;
+	}
+}
+STATE(merge);
+
+/* time range of a stream, from the packet index of its decoder */
+static int stream_bounds(struct stream *st, uint64_t *begin, uint64_t *end)
+{
+	int64_t first, last;
+
+	if (st->native) {
+		if (native_range(st->native, begin, end))
+			return -1;
+	} else if (st->ctx) {
+		first = bt_trace_handle_get_timestamp_begin(st->ctx, st->tid,
+							    BT_CLOCK_REAL);
+		last = bt_trace_handle_get_timestamp_end(st->ctx, st->tid,
+							 BT_CLOCK_REAL);
+		if ((first < 0) || (last < 0))
+			return -1;
+		*begin = first;
+		*end = last;
+	} else {
+		return -1;
+	}
+	*begin = host_clock(st->host, *begin);
+	*end = host_clock(st->host, *end);
+	return 0;
+}
+
+/* time range of the streams */
+static int stream_range(uint64_t *begin, uint64_t *end)
+{
+	int i;
+	uint64_t first, last;
+
+	*begin = UINT64_MAX;
+	*end = 0;
+	for (i = 0; i < nb_streams; i++) {
+		if (stream_bounds(streams[i], &first, &last))
+			continue;
+		if (first < *begin)
+			*begin = first;
+		if (last > *end)
+			*end = last;
+	}
+	return (*begin > *end) ? -1 : 0;
+}
+
+/*
+ * Heap of a restored merge, streams at their saved positions. Under
+ * --follow, the streams out of it that got events since then join it.
+ */
+static void resume_merge(struct stream **order)
+{
+	int i, count = 0;
+	char *resumed;
+	struct stream *st;
+
+	resumed = calloc(nb_streams, 1);
+	assert(resumed);
+	for (i = 0; i < resume_len; i++) {
+		st = streams[resume_heap[i]];
+		if (!stream_peek(st) || (st->next->rec.timestamp != st->from))
+			state_error("stream position");
+		heap[heap_len++] = st;
+		resumed[st->index] = 1;
+	}
+
+	for (i = 0; i < nb_streams; i++) {
+		if (!resumed[i] && stream_peek(streams[i]))
+			order[count++] = streams[i];
+	}
+	qsort(order, count, sizeof(*order), compare_streams);
+	for (i = 0; i < count; i++)
+		heap_insert(heap, &heap_len, order[i]);
+	free(resumed);
+}
+
+/* follow mode: where each stream goes on from on the next round */
+static void follow_keep(void)
+{
+	int i;
+	uint64_t ts;
+	struct stream *st;
+
+	/* streams out of the heap, after the events they had */
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		st->from = st->last_ts;
+		st->skip = st->same;
+		if (st->last_ts > follow_last)
+			follow_last = st->last_ts;
+	}
+	resume_heap = realloc(resume_heap, sizeof(*resume_heap)*nb_streams);
+	assert(resume_heap);
+	for (i = 0; i < heap_len; i++) {
+		st = heap[i];
+		ts = st->next->rec.timestamp;
+		st->skip = (ts == st->last_ts) ? st->same : 0;
+		st->from = ts;
+		resume_heap[i] = st->index;
+	}
+	resume_len = heap_len;
+}
+
+/*
+ * Merge streams in timestamp order, up to end (excluded), return how many
+ * events were dispatched.
+ */
+static unsigned long process_merged(int pass, int rebase_clock, uint64_t end)
+{
+	int i, count;
+	unsigned long events = 0;
+	uint64_t ts, first, last;
+	struct stream **order;
+	struct stream *st;
+	static struct event_record rec;
+
+	order = malloc(nb_streams*sizeof(*order));
+	heap = malloc(nb_streams*sizeof(*heap));
+	assert(order && heap);
+
+	heap_len = 0;
+	if (resume_len >= 0) {
+		resume_merge(order);
+	} else {
+		for (i = 0, count = 0; i < nb_streams; i++) {
+			if (stream_peek(streams[i]))
+				order[count++] = streams[i];
+		}
+		qsort(order, count, sizeof(*order), compare_streams);
+		for (i = 0; i < count; i++)
+			heap_insert(heap, &heap_len, order[i]);
+	}
+
+	/* every stream has been opened to be peeked */
+	if ((pass == 1) && shard_tracking()) {
+		if (stream_range(&first, &last))
+			FATAL("cannot find the trace time range for "
+			      "--shards\n");
+		shard_range(first, last);
+	}
+
+	while (heap_len > 0) {
+		st = heap[0];
+		ts = st->next->rec.timestamp;
+		if (ts >= end)
+			break;
+		/* snapshots come before the event changes any state */
+		if ((pass == 2) && (checkpoint_interval > 0.0))
+			checkpoint_event(ts);
+		if ((pass == 1) && shard_tracking())
+			shard_event(ts);
+		if (stream_take(st, &rec)) {
+			dispatch_event(&rec, pass, rebase_clock);
+			events++;
+		}
+		stream_release(st);
+
+		if (!stream_peek(st)) {
+			/* the last stream takes the top */
+			if (--heap_len == 0)
+				break;
+			heap[0] = heap[heap_len];
+		}
+		heapify(heap, heap_len, 0);
+	}
+	if (following)
+		follow_keep();
+	heap_len = -1;
+	free(heap);
+	heap = NULL;
+	free(order);
+	return events;
+}
+
+/*
+ * Discovery only cares about the latest task and IRQ names, which modules
+ * reconcile with the event clock: take streams in turn, without merging.
+ */
+static void process_unordered(int pass, int rebase_clock)
+{
+	int i, n, live;
+	uint64_t first = UINT64_MAX;
+	struct stream *st;
+	struct packed_event *pe;
+	static struct event_record rec;
+
+	/* each stream is ordered, the oldest event heads one of them */
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		while ((pe = stream_peek(st)) && pe->skipped) {
+			stream_take(st, &rec);
+			stream_release(st);
+		}
+		if (pe && (pe->rec.timestamp < first))
+			first = pe->rec.timestamp;
+	}
+	if (rebase_clock && (first != UINT64_MAX))
+		set_clock_base(first);
+
+	do {
+		live = 0;
+		for (i = 0; i < nb_streams; i++) {
+			st = streams[i];
+			/* fixed batches keep the dispatch order reproducible */
+			for (n = 0; n < STREAM_BATCH; n++) {
+				if (!stream_peek(st))
+					break;
+				if (stream_take(st, &rec))
+					dispatch_event(&rec, pass,
+						       rebase_clock);
+				stream_release(st);
+			}
+			if (n == STREAM_BATCH)
+				live++;
+		}
+	} while (live);
+}
+
+/* the merge may stop before the end (time shards), so may the decoders */
+static void stop_workers(void)
+{
+	int i;
+	struct worker *w;
+
+	for (i = 0; i < nb_workers; i++) {
+		w = &workers[i];
+		pthread_mutex_lock(&w->lock);
+		set_flag(&w->stop, 1);
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+/* events before end, from a restored merge position if any */
+static unsigned long process_events(int pass, int rebase_clock, uint64_t end)
+{
+	int i, ret;
+	unsigned long events = 0;
+	struct stream *st;
+
+	if (!workers)
+		assign_workers();
+
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		st->head = st->tail = 0;
+		st->done = 0;
+		st->consumer_waits = 0;
+		st->started = 0;
+		/* events the merge has taken already, see merge_save() */
+		st->last_ts = st->from;
+		st->same = st->skip;
+	}
+	for (i = 0; i < nb_workers; i++) {
+		workers[i].waits = 0;
+		workers[i].stop = 0;
+		ret = pthread_create(&workers[i].thread, NULL, worker_run,
+				     &workers[i]);
+		if (ret)
+			FATAL("cannot create decoder thread: %s\n",
+			      strerror(ret));
+	}
+
+	/* time shard snapshots need pass 2 order */
+	if ((pass == 1) && !shard_tracking())
+		process_unordered(pass, rebase_clock);
+	else
+		events = process_merged(pass, rebase_clock, end);
+
+	stop_workers();
+	for (i = 0; i < nb_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+	if (following)
+		return events;
+
+	/* a restored position only holds for the pass after it */
+	resume_len = -1;
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		st->from = 0;
+		st->skip = 0;
+		st->exhausted = 0;
+	}
+	return events;
+}
+
+void parallel_process_events(int pass, int rebase_clock, uint64_t end)
+{
+	process_events(pass, rebase_clock, end);
+}
+
+/*
+ * Follow mode: let the decoder of a stream see what was appended to it,
+ * return 1 if the stream grew. The native decoder indexes the new packets
+ * only; babeltrace 1 indexes a stream once, its context is opened again.
+ * A stream that cannot be opened yet (a live session may be writing its
+ * first packet) is tried again on the next round.
+ */
+static int follow_stream(struct stream *st)
+{
+	int ret = 1;
+	struct stat sb;
+
+	if (stat(st->name, &sb) || !sb.st_size)
+		return 0;
+	if (!st->native && !st->ctx && !st->fallback) {
+		st->native = native_open(st->origin, st->name, st->host);
+		st->fallback = !st->native;
+	} else if (st->native) {
+		ret = native_grow(st->native);
+		if (ret < 0) {
+			native_close(st->native);
+			st->native = NULL;
+		}
+	}
+	if (st->native) {
+		st->size = sb.st_size;
+		return ret;
+	}
+
+	if (st->ctx && ((uint64_t)sb.st_size == st->size))
+		return 0;
+	if (stream_open_context(st))
+		return 0;
+	st->size = sb.st_size;
+	return 1;
+}
+
+/*
+ * Count the rounds each stream did not grow during, return 1 if one went
+ * idle: the watermark can then move past it. A stream active again goes
+ * on from the last event merged, what it had before is lost.
+ */
+static int follow_idle(void)
+{
+	int i, idle = 0;
+	struct stream *st;
+
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		if (!st->grown) {
+			if (++st->idle == FOLLOW_IDLE_ROUNDS) {
+				DIAG("stream '%s' is idle, not waiting for "
+				     "it\n", st->name);
+				idle = 1;
+			}
+			continue;
+		}
+		if ((st->idle >= FOLLOW_IDLE_ROUNDS) &&
+		    (st->from < follow_last)) {
+			DIAG("stream '%s' is active again, its events before "
+			     "%" PRIu64 " ns are lost\n", st->name,
+			     follow_last);
+			st->from = follow_last;
+			st->skip = 0;
+		}
+		st->grown = 0;
+		st->idle = 0;
+	}
+	return idle;
+}
+
+/*
+ * Oldest end of the streams waited for. Streams are flushed independently:
+ * a stream may still get events up to the end of its last whole packet,
+ * and from there on only. A stream without packets holds the others until
+ * it goes idle.
+ */
+static uint64_t follow_watermark(void)
+{
+	int i;
+	uint64_t begin, end, watermark = UINT64_MAX;
+	struct stream *st;
+
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		if (st->idle >= FOLLOW_IDLE_ROUNDS)
+			continue;
+		if (stream_bounds(st, &begin, &end))
+			end = 0;
+		if (end < watermark)
+			watermark = end;
+	}
+	return watermark;
+}
+
+/*
+ * Follow mode, one round: add the streams that appeared, take in the
+ * packets appended to the others, and convert the events before the
+ * watermark. Decoders keep their streams open across rounds, the merge goes
+ * on from where the last round stopped. The last round converts what is
+ * left, whatever the streams. Return how many events were converted.
+ */
+unsigned long parallel_follow(const char *name, int rebase_clock, int last)
+{
+	int i, first = nb_streams, grown = 0, idle;
+	uint64_t watermark;
+	struct stream *st;
+
+	following = 1;
+	make_tmpdir();
+	nb_traces = 0;
+	if (nftw(name, traverse_stream_dir, 10, 0) < 0)
+		DIAG("cannot walk trace '%s', retrying\n", name);
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		/* streams that appear late only have what comes next */
+		if ((i >= first) && (st->from < follow_last))
+			st->from = follow_last;
+		st->grown = follow_stream(st);
+		grown += st->grown;
+	}
+	idle = follow_idle();
+	if (!grown && !idle && !last)
+		return 0;
+
+	watermark = last ? UINT64_MAX : follow_watermark();
+	if (!nb_streams || (watermark <= follow_last))
+		return 0;
+
+	/* streams not readable yet take no part in the round */
+	for (i = 0; i < nb_streams; i++) {
+		st = streams[i];
+		st->exhausted = !st->native && !st->ctx;
+	}
+	if (nb_streams != first)
+		free_workers();
+	return process_events(0, rebase_clock, watermark);
+}
@@ -0,0 +1,374 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "ctf.h"
+
+#include <ftw.h>
+#include <sys/stat.h>
+
+/*
+ * Pass 1 results are cached next to the trace, in '<trace>.disc'. Rather
+ * than serializing every module table, the cache logs the decoded events
+ * pass 1 dispatched, in dispatch order. Replaying them rebuilds the same
+ * tables and module context (current tasks, IRQ states) without going
+ * through babeltrace; events without module are not logged.
+ */
+
+#define DISCOVERY_MAGIC           (0x4458544cU) /* "LTXD" */
+#define DISCOVERY_VERSION         (2)
+
+int discovery_cache = 1;
+
+static uint64_t trace_key;
+static char *cache_name;
+static char *tmp_name;
+static FILE *log_fp;
+static uint32_t nb_logged;
+static uint64_t first_ts;
+
+uint64_t fnv1a(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static size_t root_len;
+
+static int hash_entry(const char *fpath, const struct stat *sb,
+		      int tflag, struct FTW *ftwbuf)
+{
+	FILE *fp;
+	size_t len;
+	char buf[4096];
+	uint64_t h = FNV1A_SEED;
+	const char *rel = fpath+root_len;
+
+	if (tflag != FTW_F)
+		return 0;
+
+	h = fnv1a(h, rel, strlen(rel));
+	if (strcmp(&fpath[ftwbuf->base], "metadata") == 0) {
+		/* metadata may be rewritten in place, hash its content */
+		fp = fopen(fpath, "rb");
+		if (!fp)
+			return -1;
+		while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+			h = fnv1a(h, buf, len);
+		fclose(fp);
+	} else {
+		h = fnv1a(h, &sb->st_size, sizeof(sb->st_size));
+		h = fnv1a(h, &sb->st_mtim, sizeof(sb->st_mtim));
+	}
+	/* sum entries, nftw order is not stable */
+	trace_key += h;
+	return 0;
+}
+
+/* options that change what pass 1 does, or the order it does it in */
+static uint64_t options_key(void)
+{
+	int options[] = {
+		DISCOVERY_VERSION,
+		gtkwave_parrot,
+		show_cpu_switch,
+		atag_enabled,
+		parallel_decode,
+	};
+
+	return fnv1a(FNV1A_SEED, options, sizeof(options));
+}
+
+static int compute_key(const char *name)
+{
+	root_len = strlen(name);
+	trace_key = options_key();
+	return nftw(name, hash_entry, 10, 0);
+}
+
+static void put_u32(FILE *fp, uint32_t v)
+{
+	fwrite(&v, sizeof(v), 1, fp);
+}
+
+static void put_u64(FILE *fp, uint64_t v)
+{
+	fwrite(&v, sizeof(v), 1, fp);
+}
+
+static void put_str(FILE *fp, const char *s)
+{
+	uint32_t len = strlen(s);
+
+	put_u32(fp, len);
+	fwrite(s, 1, len, fp);
+}
+
+static int get_u32(FILE *fp, uint32_t *v)
+{
+	return (fread(v, sizeof(*v), 1, fp) == 1) ? 0 : -1;
+}
+
+static int get_u64(FILE *fp, uint64_t *v)
+{
+	return (fread(v, sizeof(*v), 1, fp) == 1) ? 0 : -1;
+}
+
+static const char *get_str(FILE *fp, struct event_record *rec)
+{
+	uint32_t len;
+	char buf[LINEBUF_MAX];
+
+	if (get_u32(fp, &len) || (len >= sizeof(buf)) ||
+	    (fread(buf, 1, len, fp) != len))
+		return NULL;
+	buf[len] = '\0';
+	return record_strdup(rec, buf);
+}
+
+/* field names must stay valid, see get_field() */
+static const char *get_name(FILE *fp)
+{
+	uint32_t len;
+	char buf[LINEBUF_MAX];
+
+	if (get_u32(fp, &len) || (len >= sizeof(buf)) ||
+	    (fread(buf, 1, len, fp) != len))
+		return NULL;
+	buf[len] = '\0';
+	return intern_string(buf)->str;
+}
+
+static void set_names(const char *name)
+{
+	int ret;
+	size_t len = strlen(name);
+
+	/* strip trailing '/' */
+	while ((len > 1) && (name[len-1] == '/'))
+		len--;
+
+	ret = asprintf(&cache_name, "%.*s.disc", (int)len, name);
+	assert(ret > 0);
+	ret = asprintf(&tmp_name, "%s.tmp", cache_name);
+	assert(ret > 0);
+}
+
+static void free_names(void)
+{
+	free(cache_name);
+	free(tmp_name);
+	cache_name = tmp_name = NULL;
+}
+
+/* records of single host traces, also spooled by the babeltrace 2 sink */
+int record_read(FILE *fp, struct event_record *rec)
+{
+	int i;
+	uint32_t cpu_id, nargs, type;
+	struct event_arg *arg;
+
+	rec->strpos = 0;
+	if (get_u64(fp, &rec->timestamp) || get_u32(fp, &cpu_id))
+		return -1;
+	rec->cpu_id = (int)cpu_id;
+	rec->host = 0;
+	rec->lost_channel = NULL;
+	if (get_u64(fp, &rec->lost_events) ||
+	    get_u64(fp, &rec->lost_packets))
+		return -1;
+	rec->name = get_str(fp, rec);
+	if (!rec->name || get_u32(fp, &nargs) || (nargs > MAX_EVENT_ARGS))
+		return -1;
+
+	rec->mod = find_module_by_name(rec->name);
+	if (!rec->mod)
+		return -1;
+
+	rec->source = NULL;
+	rec->nargs = nargs;
+	for (i = 0; i < rec->nargs; i++) {
+		arg = &rec->args[i];
+		arg->name = get_name(fp);
+		if (!arg->name || get_u32(fp, &type))
+			return -1;
+		arg->value.type = type;
+		if (type == ARG_STR) {
+			arg->value.s = get_str(fp, rec);
+			if (!arg->value.s)
+				return -1;
+		} else if (get_u64(fp, &arg->value.u64)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* the cache of a trace with its header checked, NULL without a valid one */
+static FILE *open_cache(const char *name, uint64_t *first, uint32_t *count)
+{
+	FILE *fp;
+	uint32_t magic;
+	uint64_t key;
+
+	if (!discovery_cache)
+		return NULL;
+
+	if (compute_key(name) < 0) {
+		INFO("cannot hash trace '%s', discovery cache disabled\n",
+		     name);
+		discovery_cache = 0;
+		return NULL;
+	}
+
+	set_names(name);
+	fp = fopen(cache_name, "rb");
+	if (!fp)
+		return NULL;
+
+	if (get_u32(fp, &magic) || (magic != DISCOVERY_MAGIC) ||
+	    get_u64(fp, &key) || (key != trace_key) ||
+	    get_u64(fp, first) || get_u32(fp, count)) {
+		INFO("discovery cache '%s' is stale\n", cache_name);
+		fclose(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+/* return 1 if the trace has a valid cache, without replaying it */
+int discovery_cached(const char *name)
+{
+	FILE *fp;
+	uint32_t count;
+	uint64_t first;
+
+	fp = open_cache(name, &first, &count);
+	if (!fp)
+		return 0;
+	fclose(fp);
+	return 1;
+}
+
+/* replay the cached discovery log, return 1 when pass 1 can be skipped */
+int discovery_load(const char *name, int rebase_clock)
+{
+	FILE *fp;
+	uint32_t count, i;
+	uint64_t first;
+	static struct event_record rec;
+
+	fp = open_cache(name, &first, &count);
+	if (!fp)
+		return 0;
+
+	INFO("replaying %u events from discovery cache '%s'\n", count,
+	     cache_name);
+	/* the first logged event may be a later one, under -j */
+	if (rebase_clock && count)
+		set_clock_base(first);
+
+	for (i = 0; i < count; i++) {
+		/* modules already ran on a valid cache, this is corruption */
+		if (record_read(fp, &rec))
+			FATAL("corrupted discovery cache '%s', remove it\n",
+			      cache_name);
+		dispatch_event(&rec, 1, rebase_clock);
+	}
+	fclose(fp);
+	free_names();
+	return 1;
+}
+
+void discovery_open(void)
+{
+	if (!discovery_cache || !cache_name)
+		return;
+
+	log_fp = fopen(tmp_name, "wb");
+	if (!log_fp) {
+		INFO("cannot write discovery cache '%s': %s\n", tmp_name,
+		     strerror(errno));
+		return;
+	}
+	nb_logged = 0;
+	first_ts = UINT64_MAX;
+	/* header is completed in discovery_close() */
+	put_u32(log_fp, 0);
+	put_u64(log_fp, trace_key);
+	put_u64(log_fp, 0);
+	put_u32(log_fp, 0);
+}
+
+void record_write(FILE *fp, const struct event_record *rec)
+{
+	int i;
+	const struct event_arg *arg;
+
+	put_u64(fp, rec->timestamp);
+	put_u32(fp, rec->cpu_id);
+	put_u64(fp, rec->lost_events);
+	put_u64(fp, rec->lost_packets);
+	put_str(fp, rec->name);
+	put_u32(fp, rec->nargs);
+	for (i = 0; i < rec->nargs; i++) {
+		arg = &rec->args[i];
+		put_str(fp, arg->name);
+		put_u32(fp, arg->value.type);
+		if (arg->value.type == ARG_STR)
+			put_str(fp, arg->value.s);
+		else
+			put_u64(fp, arg->value.u64);
+	}
+}
+
+/* called after each pass 1 event */
+void discovery_log(struct event_record *rec)
+{
+	if (!log_fp)
+		return;
+
+	record_decode(rec);
+	record_write(log_fp, rec);
+	nb_logged++;
+	if (rec->timestamp < first_ts)
+		first_ts = rec->timestamp;
+}
+
+void discovery_close(void)
+{
+	int ret;
+
+	if (log_fp) {
+		rewind(log_fp);
+		put_u32(log_fp, DISCOVERY_MAGIC);
+		put_u64(log_fp, trace_key);
+		put_u64(log_fp, first_ts);
+		put_u32(log_fp, nb_logged);
+		ret = ferror(log_fp);
+		ret |= fclose(log_fp);
+		log_fp = NULL;
+
+		if (ret || rename(tmp_name, cache_name)) {
+			INFO("cannot write discovery cache '%s'\n",
+			     cache_name);
+			unlink(tmp_name);
+		} else {
+			INFO("saved %u events to discovery cache '%s'\n",
+			     nb_logged, cache_name);
+		}
+	}
+	free_names();
+}
@@ -57,30 +57,32 @@ static char *sofirq_tag[] = {
 	str(RCU_SOFTIRQ),
 };
 #undef str
+static const struct ltt_string *sofirq_name[ARRAY_SIZE(sofirq_tag)];
 
 /* nested irq stack */
 static int irqtab[MAX_CPU][MAX_IRQS];
 static int irqlevel[MAX_CPU];
 static char *irq_tag[MAX_IRQS];
+static uint64_t irq_tag_clock[MAX_IRQS];
 static struct {
-	double entry_time;
-	double max_delta_us;
-	double max_delta_position;
-	double total_time;
+	uint64_t entry_time;
+	uint64_t max_delta;
+	uint64_t max_delta_position;
+	uint64_t total_time;
 	unsigned int counter;
 } irqstat[MAX_CPU][MAX_IRQS] = {
-	[0 ... MAX_CPU-1][ 0 ... MAX_IRQS-1] = { 0.0, 0.0, 0.0, 0.0, 0}
+	[0 ... MAX_CPU-1][ 0 ... MAX_IRQS-1] = { 0, 0, 0, 0, 0}
 };
 
 static int softirqstate[MAX_CPU];
 static struct {
-	double entry_time;
-	double max_delta_us;
-	double max_delta_position;
-	double total_time;
+	uint64_t entry_time;
+	uint64_t max_delta;
+	uint64_t max_delta_position;
+	uint64_t total_time;
 	unsigned int counter;
 } softirqstat[MAX_CPU] = {
-	[0 ... MAX_CPU-1] = { 0.0, 0.0, 0.0, 0.0, 0}
+	[0 ... MAX_CPU-1] = { 0, 0, 0, 0, 0}
 };
 
 /*
@@ -100,6 +102,10 @@ static void update_irq_name(int irq, const char *name)
 	symbol_clean_name(buf);
 
 	if (irq < MAX_IRQS) {
+		/* events may come out of order (-j pass 1), keep the latest */
+		if (irq_tag[irq] && (get_event_clock() < irq_tag_clock[irq]))
+			return;
+		irq_tag_clock[irq] = get_event_clock();
 		if (!irq_tag[irq] || strcmp(irq_tag[irq], buf)) {
 			INFO("%s -> %s\n", irq_tag[irq] ? : "<null>", buf);
 			free(irq_tag[irq]);
@@ -109,13 +115,15 @@ static void update_irq_name(int irq, const char *name)
 }
 
 static void irq_handler_entry_process(const char *modname, int pass,
-				      double clock, int cpu, void *args)
+				      uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_irq = ARG_FIELD("irq");
+	static struct arg_field f_name = ARG_FIELD("name");
 	int irq;
 	const char *name;
 
-	irq  = (int)get_arg_i64(args, "irq");
-	name = get_arg_str(args, "name");
+	irq  = (int)get_field_i64(args, &f_irq);
+	name = get_field_str(args, &f_name);
 
 	/*
 	  INFO("irq_handler_entry: irq %d name '%s'\n", irq, name);
@@ -129,7 +137,7 @@ static void irq_handler_entry_process(const char *modname, int pass,
 	if (pass == 1) {
 		update_irq_name(irq, name);
 		init_trace(&trace[cpu][irq], TG_IRQ, 1.0+irq, TRACE_SYM_F_BITS,
-			   "%s/%d", irq_tag[irq], cpu);
+			   "%s/%d", irq_tag[irq], host_cpu(cpu));
 		/*atag_store(ip);*/
 		init_cpu(cpu);
 	}
@@ -166,7 +174,7 @@ static void irq_handler_entry_process(const char *modname, int pass,
 MODULE(irq_handler_entry);
 
 static void irq_handler_exit_process(const char *modname, int pass,
-				     double clock, int cpu, void *args)
+				     uint64_t clock, int cpu, void *args)
 {
 	if ((pass == 1) || (irqlevel[cpu] <= 0))
 		return;
@@ -176,9 +184,9 @@ static void irq_handler_exit_process(const char *modname, int pass,
 
 	if (do_stats & STAT_IRQ) {
 		int irq = irqtab[cpu][irqlevel[cpu]];
-		double delta = clock - irqstat[cpu][irq].entry_time;
-		if (delta > irqstat[cpu][irq].max_delta_us) {
-			irqstat[cpu][irq].max_delta_us = delta;
+		uint64_t delta = clock - irqstat[cpu][irq].entry_time;
+		if (delta > irqstat[cpu][irq].max_delta) {
+			irqstat[cpu][irq].max_delta = delta;
 			irqstat[cpu][irq].max_delta_position = irqstat[cpu][irq].entry_time;
 		}
 		irqstat[cpu][irq].total_time += delta;
@@ -197,45 +205,48 @@ void irq_stats(void)
 {
 	int i;
 	int cpu;
-	double max = 0.0;
+	uint64_t max = 0;
 	if (!(do_stats & STAT_IRQ))
 		return;
 
 	DIAG("irq stat\n");
 	for (cpu = 0; cpu < MAX_CPU; cpu++) {
 		for (i = 0; i < MAX_IRQS; i++) {
-			if (irqstat[cpu][i].max_delta_position != 0.0) {
+			if (irqstat[cpu][i].max_delta_position != 0) {
 				DIAG("irq %3d/%d count %d (%f s) max time %f us @%f s for %s/%d\n",
 						i, cpu, irqstat[cpu][i].counter,
-						irqstat[cpu][i].total_time,
-						irqstat[cpu][i].max_delta_us,
-						irqstat[cpu][i].max_delta_position,
+						irqstat[cpu][i].total_time/1e9,
+						irqstat[cpu][i].max_delta/1e3,
+						irqstat[cpu][i].max_delta_position/1e9,
 						irq_tag[i], cpu);
-				if (irqstat[cpu][i].max_delta_us > max)
-					max = irqstat[cpu][i].max_delta_us;
+				if (irqstat[cpu][i].max_delta > max)
+					max = irqstat[cpu][i].max_delta;
 			}
 		}
 	}
-	DIAG(" max %f\n", max);
+	DIAG(" max %f us\n", max/1e3);
 }
 
 static void init_traces_softirq(int cpu)
 {
 	init_trace(&sirq[cpu][0], TG_IRQ, 100.0+0.02*cpu, TRACE_SYM_F_BITS,
-		   "softirq/%d", cpu);
+		   "softirq/%d", host_cpu(cpu));
 	init_trace(&sirq[cpu][1], TG_IRQ, 100.01+0.02*cpu, TRACE_SYM_F_STRING,
-		   "softirq/%d (info)", cpu);
+		   "softirq/%d (info)", host_cpu(cpu));
 }
 
-static void softirq_entry_process(const char *modname, int pass, double clock,
+static void softirq_entry_process(const char *modname, int pass, uint64_t clock,
 				  int cpu, void *args)
 {
+	static struct arg_field f_vec = ARG_FIELD("vec");
 	int vec;
 
-	vec = (int)get_arg_i64(args, "vec");
+	vec = (int)get_field_i64(args, &f_vec);
 
 	if (pass == 1) {
 		init_traces_softirq(cpu);
+		/* cpu_preempt() may come before any IRQ of this CPU */
+		init_cpu(cpu);
 		return;
 	}
 
@@ -243,10 +254,13 @@ static void softirq_entry_process(const char *modname, int pass, double clock,
 	emit_trace(&sirq[cpu][0], (union ltt_value)SOFTIRQ_RUNNING);
 	cpu_preempt(clock, cpu);
 
-	if ((vec < ARRAY_SIZE(sofirq_tag)) && sofirq_tag[vec])
-		emit_trace(&sirq[cpu][1], (union ltt_value)sofirq_tag[vec]);
-	else
-		emit_trace(&sirq[cpu][1], (union ltt_value)"softirq %d", vec);
+	if ((vec < ARRAY_SIZE(sofirq_tag)) && sofirq_tag[vec]) {
+		if (!sofirq_name[vec])
+			sofirq_name[vec] = intern_string(sofirq_tag[vec]);
+		emit_interned(&sirq[cpu][1], sofirq_name[vec]);
+	} else {
+		emit_interned(&sirq[cpu][1], intern_format("softirq %d", vec));
+	}
 
 	softirqstate[cpu] = SOFTIRQS_RUN;
 
@@ -255,7 +269,7 @@ static void softirq_entry_process(const char *modname, int pass, double clock,
 }
 MODULE(softirq_entry);
 
-static void softirq_exit_process(const char *modname, int pass, double clock,
+static void softirq_exit_process(const char *modname, int pass, uint64_t clock,
 				 int cpu, void *args)
 {
 	if (pass == 1) {
@@ -273,9 +287,9 @@ static void softirq_exit_process(const char *modname, int pass, double clock,
 	softirqstate[cpu] = SOFTIRQS_IDLE;
 
 	if (do_stats & STAT_SOFTIRQ) {
-		double delta = clock - softirqstat[cpu].entry_time;
-		if (delta > softirqstat[cpu].max_delta_us) {
-			softirqstat[cpu].max_delta_us = delta;
+		uint64_t delta = clock - softirqstat[cpu].entry_time;
+		if (delta > softirqstat[cpu].max_delta) {
+			softirqstat[cpu].max_delta = delta;
 			softirqstat[cpu].max_delta_position = softirqstat[cpu].entry_time;
 		}
 		softirqstat[cpu].total_time += delta;
@@ -285,21 +299,21 @@ static void softirq_exit_process(const char *modname, int pass, double clock,
 MODULE(softirq_exit);
 
 static void irq_softirq_entry_process(const char *modname, int pass,
-					double clock, int cpu, void *args)
+					uint64_t clock, int cpu, void *args)
 {
 	softirq_entry_process(modname, pass, clock, cpu, args);
 }
 MODULE(irq_softirq_entry);
 
 static void irq_softirq_exit_process(const char *modname, int pass,
-					double clock, int cpu, void *args)
+					uint64_t clock, int cpu, void *args)
 {
 	softirq_exit_process(modname, pass, clock, cpu, args);
 }
 MODULE(irq_softirq_exit);
 
 static void irq_softirq_raise_process(const char *modname, int pass,
-					double clock, int cpu, void *args)
+					uint64_t clock, int cpu, void *args)
 {
 	if (pass == 1) {
 		init_traces_softirq(cpu);
@@ -321,12 +335,51 @@ void softirq_stats(void)
 
 	DIAG("softirq stat\n");
 	for (cpu = 0; cpu < MAX_CPU; cpu++) {
-		if (softirqstat[cpu].max_delta_position != 0.0) {
+		if (softirqstat[cpu].max_delta_position != 0) {
 			DIAG("softirq/%d count %d (%f s) max time %f us @%f s\n",
 					cpu, softirqstat[cpu].counter,
-					softirqstat[cpu].total_time,
-					softirqstat[cpu].max_delta_us,
-					softirqstat[cpu].max_delta_position);
+					softirqstat[cpu].total_time/1e9,
+					softirqstat[cpu].max_delta/1e3,
+					softirqstat[cpu].max_delta_position/1e9);
 		}
 	}
 }
+
+/* IRQ stacks and softirq states, and statistics when enabled */
+static void kernel_save(FILE *fp)
+{
+	int cpu, stats = do_stats;
+
+	state_put(fp, irqlevel, sizeof(irqlevel));
+	for (cpu = 0; cpu < MAX_CPU; cpu++)
+		state_put(fp, irqtab[cpu], irqlevel[cpu]*sizeof(int));
+	state_put(fp, softirqstate, sizeof(softirqstate));
+
+	state_put(fp, &stats, sizeof(stats));
+	if (stats & STAT_IRQ)
+		state_put(fp, irqstat, sizeof(irqstat));
+	if (stats & STAT_SOFTIRQ)
+		state_put(fp, softirqstat, sizeof(softirqstat));
+}
+
+static void kernel_restore(FILE *fp)
+{
+	int cpu, stats;
+
+	state_get(fp, irqlevel, sizeof(irqlevel));
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if ((irqlevel[cpu] < 0) || (irqlevel[cpu] > MAX_IRQS))
+			state_error("IRQ level");
+		state_get(fp, irqtab[cpu], irqlevel[cpu]*sizeof(int));
+	}
+	state_get(fp, softirqstate, sizeof(softirqstate));
+
+	state_get(fp, &stats, sizeof(stats));
+	if (stats != do_stats)
+		state_error("statistics");
+	if (stats & STAT_IRQ)
+		state_get(fp, irqstat, sizeof(irqstat));
+	if (stats & STAT_SOFTIRQ)
+		state_get(fp, softirqstat, sizeof(softirqstat));
+}
+STATE(kernel);
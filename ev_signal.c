@@ -39,25 +39,28 @@ static void emit_signal(struct task *task, int sig, int cpu)
 
 	if ((sig < (int)ARRAY_SIZE(signal_name)) && (signal_name[sig]))
 		name = signal_name[sig];
-	emit_trace(task->info_trace, (union ltt_value)"%d: SIG%s(%d)", cpu,
-		   name, sig);
+	emit_interned(task->info_trace,
+		      intern_format("%d: SIG%s(%d)", host_cpu(cpu), name, sig));
 }
 
 static void signal_generate_process(const char *modname, int pass,
-				    double clock, int cpu, void *args)
+				    uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_comm = ARG_FIELD("comm");
+	static struct arg_field f_pid = ARG_FIELD("pid");
+	static struct arg_field f_sig = ARG_FIELD("sig");
 	int sig, pid;
 	const char *comm;
 	struct task *task;
 
-	comm = get_arg_str(args, "comm");
-	pid = (int)get_arg_u64(args, "pid");
+	comm = get_field_str(args, &f_comm);
+	pid = (int)get_field_u64(args, &f_pid);
 
 	if (pass == 1)
 		(void)find_or_add_task(comm, pid);
 
 	if (pass == 2) {
-		sig = (int)get_arg_u64(args, "sig");
+		sig = (int)get_field_u64(args, &f_sig);
 		task = find_or_add_task(NULL, pid);
 		if (task)
 			emit_signal(task, sig, cpu);
@@ -66,13 +69,14 @@ static void signal_generate_process(const char *modname, int pass,
 MODULE(signal_generate);
 
 static void signal_deliver_process(const char *modname, int pass,
-				    double clock, int cpu, void *args)
+				    uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_sig = ARG_FIELD("sig");
 	int sig;
 	struct task *task;
 
 	if (pass == 2) {
-		sig = (int)get_arg_u64(args, "sig");
+		sig = (int)get_field_u64(args, &f_sig);
 		task = get_current_task(cpu);
 		if (task)
 			emit_signal(task, sig, cpu);
@@ -55,7 +55,7 @@ static void dump_syscall_arg(void *cookie, const char *name,
 	}
 }
 
-static void sys_process(const char *modname, int pass, double clock, int cpu,
+static void sys_process(const char *modname, int pass, uint64_t clock, int cpu,
 			void *args)
 {
 	char argbuf[MAX_ARGS_LEN] = "";
@@ -65,11 +65,11 @@ static void sys_process(const char *modname, int pass, double clock, int cpu,
 	if (pass == 2) {
 		/* dump syscall arguments */
 		for_each_arg(args, dump_syscall_arg, argbuf);
-		snprintf(buf, sizeof(buf), "%d: %s(%s)", cpu,
+		snprintf(buf, sizeof(buf), "%d: %s(%s)", host_cpu(cpu),
 			 &modname[4], argbuf);
 		task = get_current_task(cpu);
 		if (task) {
-			emit_trace(task->info_trace, (union ltt_value)buf);
+			emit_str(task->info_trace, buf, strlen(buf));
 			task->mode = PROCESS_KERNEL;
 			emit_trace(task->state_trace,
 				   (union ltt_value)task->mode);
@@ -78,23 +78,23 @@ static void sys_process(const char *modname, int pass, double clock, int cpu,
 }
 MODULE_PATTERN(sys, sys_*);
 
-static void compat_syscall_entry_process(const char *modname, int pass, double clock, int cpu, void *args)
+static void compat_syscall_entry_process(const char *modname, int pass, uint64_t clock, int cpu, void *args)
 {
 	sys_process(modname + 17, pass, clock, cpu, args);
 }
 MODULE_PATTERN(compat_syscall_entry, compat_syscall_entry_*);
 
-static void syscall_entry_process(const char *modname, int pass, double clock, int cpu, void *args)
+static void syscall_entry_process(const char *modname, int pass, uint64_t clock, int cpu, void *args)
 {
 	sys_process(modname + 10, pass, clock, cpu, args);
 }
 MODULE_PATTERN(syscall_entry, syscall_entry_*);
 
-static void exit_syscall_process(const char *modname, int pass, double clock,
+static void exit_syscall_process(const char *modname, int pass, uint64_t clock,
 				 int cpu, void *args)
 {
+	static struct arg_field f_ret = ARG_FIELD("ret");
 	int ret;
-	char buf[80];
 	struct task *task;
 
 	if (pass == 1)
@@ -108,16 +108,16 @@ static void exit_syscall_process(const char *modname, int pass, double clock,
 		 * 'ret' is normally the syscall id; or the syscall return
 		 * value if lttng-modules is patched accordingly
 		 */
-		ret = (int)get_arg_i64(args, "ret");
-		snprintf(buf, sizeof(buf), "%d: ret=%d", cpu, ret);
-		emit_trace(task->info_trace, (union ltt_value)buf);
+		ret = (int)get_field_i64(args, &f_ret);
+		emit_interned(task->info_trace,
+			      intern_format("%d: ret=%d", host_cpu(cpu), ret));
 		task->mode = PROCESS_USER;
 		emit_trace(task->state_trace, (union ltt_value)task->mode);
 	}
 }
 MODULE(exit_syscall);
 
-static void compat_syscall_exit_process(const char *modname, int pass, double clock,
+static void compat_syscall_exit_process(const char *modname, int pass, uint64_t clock,
 				 int cpu, void *args)
 {
 	exit_syscall_process(modname, pass, clock, cpu, args);
@@ -125,7 +125,7 @@ static void compat_syscall_exit_process(const char *modname, int pass, double cl
 
 MODULE_PATTERN(compat_syscall_exit, compat_syscall_exit_*);
 
-static void syscall_exit_process(const char *modname, int pass, double clock,
+static void syscall_exit_process(const char *modname, int pass, uint64_t clock,
 				 int cpu, void *args)
 {
 	exit_syscall_process(modname, pass, clock, cpu, args);
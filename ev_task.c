@@ -16,6 +16,10 @@
 
 static void *root;
 static struct task *current_task[MAX_CPU];
+/* dead tasks are freed, see task_set_single_pass() */
+static int evict_dead;
+/* cpu numbers of the info traces */
+static const struct ltt_string *cpu_name[MAX_CPU];
 
 struct task *get_current_task(int cpu)
 {
@@ -26,7 +30,12 @@ static int compare(const void *pa, const void *pb)
 {
 	int a = ((struct task *)pa)->pid;
 	int b = ((struct task *)pb)->pid;
+	int ha = ((struct task *)pa)->host;
+	int hb = ((struct task *)pb)->host;
 
+	/* pids are only unique on a host */
+	if (ha != hb)
+		return ha-hb;
 	if (a < b)
 		return -1;
 	if (a > b)
@@ -35,31 +44,47 @@ static int compare(const void *pa, const void *pb)
 	return 0;
 }
 
+static void filter_task_traces(struct task *task)
+{
+	task->state_trace->filtered = filter_task(task->pid, task->tgid,
+						  task->name);
+	task->info_trace->filtered = task->state_trace->filtered;
+}
+
 static void update_task(struct task *task, const char *name, int pid, int tgid)
 {
 	int need_refresh = 0;
-
-	if (name && strcmp(name, task->name)) {
-		free(task->name);
-		task->name = strdup(name);
-		need_refresh = 1;
+	uint64_t clock = get_event_clock();
+
+	/* events may come out of order (-j pass 1), keep the latest values */
+	if (name && (clock >= task->name_clock)) {
+		task->name_clock = clock;
+		if (!task->name || strcmp(name, task->name)) {
+			free(task->name);
+			task->name = strdup(name);
+			need_refresh = 1;
+		}
 	}
 	if (pid && (pid != task->pid)) {
 		task->pid = pid;
 		need_refresh = 1;
 	}
 
-	if (tgid && (tgid != task->tgid)) {
-		task->tgid = tgid;
-		need_refresh = 1;
+	if (tgid && (clock >= task->tgid_clock)) {
+		task->tgid_clock = clock;
+		if (tgid != task->tgid) {
+			task->tgid = tgid;
+			need_refresh = 1;
+		}
 	}
 
-	/* refresh trace name if necessary */
-	if (need_refresh) {
+	/* refresh trace name if necessary, dead tasks wait for a name */
+	if (need_refresh && task->name) {
 		refresh_name(task->state_trace, PROCESS_STATE, task->tgid,
 			     task->pid, task->name);
 		refresh_name(task->info_trace, PROCESS_INFO, task->tgid,
 			     task->pid, task->name);
+		filter_task_traces(task);
 	}
 }
 
@@ -70,8 +95,11 @@ void emit_state_trace(struct task *task, union ltt_value value, int cpu)
 	emit_trace(task->state_trace, value);
 	if (show_cpu_switch && task->current_cpu != cpu) {
 		task->current_cpu = cpu;
-		snprintf(buf, sizeof(buf), "%d", cpu);
-		emit_trace(task->info_trace, (union ltt_value)buf);
+		if (!cpu_name[cpu]) {
+			snprintf(buf, sizeof(buf), "%d", host_cpu(cpu));
+			cpu_name[cpu] = intern_string(buf);
+		}
+		emit_interned(task->info_trace, cpu_name[cpu]);
 	}
 }
 
@@ -80,17 +108,22 @@ static struct task *new_task(const char *name, int pid)
 	struct task *task;
 	struct ltt_trace *data;
 
-	/* this can happen if we on the first cs from this process */
-	if (!name)
-		name = "????";
-
 	data = calloc(2, sizeof(struct ltt_trace));
 	assert(data);
 
 	task = malloc(sizeof(struct task));
 	assert(task);
 
+	/* any name or tgid beats the default ones */
+	task->name_clock = name ? get_event_clock() : 0;
+	task->tgid_clock = 0;
+
+	/* this can happen if we on the first cs from this process */
+	if (!name)
+		name = "????";
+
 	task->name = strdup(name);
+	task->host = get_event_host();
 	task->pid = pid;
 	/* tgid will be updated later */
 	task->tgid = 0;
@@ -108,6 +141,7 @@ static struct task *new_task(const char *name, int pid)
 		   1.1 + (task->tgid << 16) + task->pid,
 		   TRACE_SYM_F_STRING, PROCESS_INFO, task->tgid,
 		   task->pid, task->name);
+	filter_task_traces(task);
 
 	/* add new task to tree */
 	task = tsearch(task, &root, compare);
@@ -117,12 +151,52 @@ static struct task *new_task(const char *name, int pid)
 	return task;
 }
 
+/*
+ * A dead task keeps its pid slot and its traces, which a reused pid takes
+ * over, but not its names.
+ */
+static void release_task(struct task *task)
+{
+	free(task->name);
+	task->name = NULL;
+	release_trace_name(task->state_trace);
+	release_trace_name(task->info_trace);
+}
+
+/*
+ * With --max-memory in a single pass, a dead task goes for good with its
+ * traces: a reused pid gets new ones. Two passes cannot do it, pass 2 needs
+ * the tasks pass 1 found.
+ */
+void task_set_single_pass(void)
+{
+	evict_dead = (memory_limit != 0);
+}
+
+static void evict_task(struct task *task)
+{
+	int cpu;
+
+	tdelete(task, &root, compare);
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		if (current_task[cpu] == task)
+			current_task[cpu] = NULL;
+	}
+	retire_trace(task->state_trace);
+	retire_trace(task->info_trace);
+	/* both traces are in one block, see new_task() */
+	free(task->state_trace);
+	free(task->name);
+	free(task);
+}
+
 struct task *find_or_add_task(const char *name, int pid)
 {
 	int cpu;
 	struct task task, *ret;
 	char buf[32];
 
+	task.host = get_event_host();
 	task.pid = pid;
 	ret = tfind(&task, &root, compare);
 
@@ -151,20 +225,113 @@ struct task *find_or_add_task(const char *name, int pid)
 	return ret;
 }
 
+/* pass 2 state of a task, in checkpoints */
+struct task_state {
+	int host;
+	int pid;
+	int user_mode;
+	int current_cpu;
+};
+
+static FILE *state_fp;
+
+static void save_task(const void *nd, const VISIT which, const int depth)
+{
+	struct task *task = *(struct task **)nd;
+	struct task_state ts;
+
+	if ((which != leaf) && (which != postorder))
+		return;
+	ts.host = task->host;
+	ts.pid = task->pid;
+	ts.user_mode = (strcmp(task->mode, PROCESS_USER) == 0);
+	ts.current_cpu = task->current_cpu;
+	state_put(state_fp, &ts, sizeof(ts));
+}
+
+static struct task *lookup_task(int host, int pid)
+{
+	struct task key, **ret;
+
+	key.host = host;
+	key.pid = pid;
+	ret = tfind(&key, &root, compare);
+	/* pass 1 found every task */
+	if (!ret)
+		state_error("task");
+	return *ret;
+}
+
+static void task_save(FILE *fp)
+{
+	int cpu;
+	struct task_state ts = {.host = -1};
+
+	state_fp = fp;
+	twalk(root, save_task);
+	state_put(fp, &ts, sizeof(ts));
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		ts.host = current_task[cpu] ? current_task[cpu]->host : -1;
+		ts.pid = current_task[cpu] ? current_task[cpu]->pid : 0;
+		state_put(fp, &ts, sizeof(ts));
+	}
+}
+
+static void reset_task(const void *nd, const VISIT which, const int depth)
+{
+	struct task *task = *(struct task **)nd;
+
+	if ((which != leaf) && (which != postorder))
+		return;
+	task->mode = PROCESS_KERNEL;
+	task->current_cpu = -1;
+}
+
+/* tasks discovered after the state was saved start afresh */
+static void task_restore(FILE *fp)
+{
+	int cpu;
+	struct task *task;
+	struct task_state ts;
+
+	twalk(root, reset_task);
+	for (;;) {
+		state_get(fp, &ts, sizeof(ts));
+		if (ts.host < 0)
+			break;
+		task = lookup_task(ts.host, ts.pid);
+		task->mode = ts.user_mode ? PROCESS_USER : PROCESS_KERNEL;
+		task->current_cpu = ts.current_cpu;
+	}
+
+	for (cpu = 0; cpu < MAX_CPU; cpu++) {
+		state_get(fp, &ts, sizeof(ts));
+		current_task[cpu] = (ts.host < 0) ? NULL :
+			lookup_task(ts.host, ts.pid);
+	}
+}
+STATE(task);
+
 static
 void lttng_statedump_process_state_process(const char *modname, int pass,
-					   double clock, int cpu, void *args)
+					   uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_tid = ARG_FIELD("tid");
+	static struct arg_field f_name = ARG_FIELD("name");
+	static struct arg_field f_pid = ARG_FIELD("pid");
+	static struct arg_field f_mode = ARG_FIELD("mode");
+	static struct arg_field f_status = ARG_FIELD("status");
 	int tid, pid, /*type,*/ mode, status;
 	const char *name;
 	union ltt_value value;
 	struct task *task;
 
-	tid = (int)get_arg_u64(args, "tid");
+	tid = (int)get_field_u64(args, &f_tid);
 
 	if (pass == 1) {
-		name = get_arg_str(args, "name");
-		pid = (int)get_arg_u64(args, "pid");
+		name = get_field_str(args, &f_name);
+		pid = (int)get_field_u64(args, &f_pid);
 		task = find_or_add_task(name, tid);
 		/* set tgid */
 		update_task(task, NULL, 0, pid);
@@ -172,8 +339,8 @@ void lttng_statedump_process_state_process(const char *modname, int pass,
 
 	if (pass == 2) {
 		/*type = (int)get_arg_u64(args, "type");*/
-		mode = (int)get_arg_u64(args, "mode");
-		status = (int)get_arg_u64(args, "status");
+		mode = (int)get_field_u64(args, &f_mode);
+		status = (int)get_field_u64(args, &f_status);
 		task = find_or_add_task(NULL, tid);
 
 		switch (status) {
@@ -208,9 +375,14 @@ void lttng_statedump_process_state_process(const char *modname, int pass,
 }
 MODULE(lttng_statedump_process_state);
 
-static void sched_switch_process(const char *modname, int pass, double clock,
+static void sched_switch_process(const char *modname, int pass, uint64_t clock,
 				 int cpu, void *args)
 {
+	static struct arg_field f_prev_comm = ARG_FIELD("prev_comm");
+	static struct arg_field f_prev_tid = ARG_FIELD("prev_tid");
+	static struct arg_field f_prev_state = ARG_FIELD("prev_state");
+	static struct arg_field f_next_comm = ARG_FIELD("next_comm");
+	static struct arg_field f_next_tid = ARG_FIELD("next_tid");
 	int prev_tid, next_tid, prev_state;
 	const char *prev_comm, *next_comm;
 	struct task *task;
@@ -219,21 +391,23 @@ static void sched_switch_process(const char *modname, int pass, double clock,
   { 1, "S"} , { 2, "D" }, { 4, "T" }, { 8, "t" }, { 16, "Z" }, { 32, "X" },
   { 64, "x" }, { 128, "W" }) : "R",
 */
-	prev_comm = get_arg_str(args, "prev_comm");
-	prev_tid = (int)get_arg_u64(args, "prev_tid");
-	prev_state = (int)get_arg_u64(args, "prev_state");
-	next_comm = get_arg_str(args, "next_comm");
-	next_tid = (int)get_arg_u64(args, "next_tid");
+	prev_comm = get_field_str(args, &f_prev_comm);
+	prev_tid = (int)get_field_u64(args, &f_prev_tid);
+	prev_state = (int)get_field_u64(args, &f_prev_state);
+	next_comm = get_field_str(args, &f_next_comm);
+	next_tid = (int)get_field_u64(args, &f_next_tid);
 
 	/* hack to have different line for per cpu idle */
 	if (prev_tid == 0)
-		prev_tid = -cpu;
+		prev_tid = -host_cpu(cpu);
 	if (next_tid == 0)
-		next_tid = -cpu;
+		next_tid = -host_cpu(cpu);
 
 	if (pass == 1) {
 		find_or_add_task(prev_comm, prev_tid);
 		find_or_add_task(next_comm, next_tid);
+		/* set_cpu_idle() may come before any IRQ of this CPU */
+		init_cpu(cpu);
 	}
 
 	if (pass == 2) {
@@ -260,17 +434,19 @@ static void sched_switch_process(const char *modname, int pass, double clock,
 }
 MODULE(sched_switch);
 
-static void sched_wakeup_process(const char *modname, int pass, double clock,
+static void sched_wakeup_process(const char *modname, int pass, uint64_t clock,
 				 int cpu, void *args)
 {
+	static struct arg_field f_tid = ARG_FIELD("tid");
+	static struct arg_field f_comm = ARG_FIELD("comm");
 	int tid;
 	const char *comm;
 	struct task *task;
 
-	tid = (int)get_arg_u64(args, "tid");
+	tid = (int)get_field_u64(args, &f_tid);
 
 	if (pass == 1) {
-		comm = get_arg_str(args, "comm");
+		comm = get_field_str(args, &f_comm);
 		find_or_add_task(comm, tid);
 	}
 
@@ -282,27 +458,29 @@ static void sched_wakeup_process(const char *modname, int pass, double clock,
 MODULE(sched_wakeup);
 
 static void sched_wakeup_new_process(const char *modname, int pass,
-				     double clock, int cpu, void *args)
+				     uint64_t clock, int cpu, void *args)
 {
 	sched_wakeup_process(modname, pass, clock, cpu, args);
 }
 MODULE(sched_wakeup_new);
 
 static void sched_process_wait_process(const char *modname, int pass,
-				       double clock, int cpu, void *args)
+				       uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_tid = ARG_FIELD("tid");
+	static struct arg_field f_comm = ARG_FIELD("comm");
 	int tid;
 	const char *comm;
 	struct task *task;
 
-	tid = (int)get_arg_u64(args, "tid");
+	tid = (int)get_field_u64(args, &f_tid);
 
 	/* why is tid == 0 on some sched_process_wait events ? */
 	if (!tid)
 		return;
 
 	if (pass == 1) {
-		comm = get_arg_str(args, "comm");
+		comm = get_field_str(args, &f_comm);
 		find_or_add_task(comm, tid);
 	}
 
@@ -318,22 +496,28 @@ MODULE(sched_process_wait);
  * state using 'sched_process_free' instead.
  */
 static void sched_process_free_process(const char *modname, int pass,
-				       double clock, int cpu, void *args)
+				       uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_tid = ARG_FIELD("tid");
+	static struct arg_field f_comm = ARG_FIELD("comm");
 	int tid;
 	const char *comm;
 	struct task *task;
 
-	tid = (int)get_arg_u64(args, "tid");
+	tid = (int)get_field_u64(args, &f_tid);
 
 	if (pass == 1) {
-		comm = get_arg_str(args, "comm");
+		comm = get_field_str(args, &f_comm);
 		find_or_add_task(comm, tid);
 	}
 
 	if (pass == 2) {
 		task = find_or_add_task(NULL, tid);
 		emit_state_trace(task, (union ltt_value)PROCESS_DEAD, cpu);
+		if (evict_dead)
+			evict_task(task);
+		else
+			release_task(task);
 	}
 }
 MODULE(sched_process_free);
@@ -341,34 +525,38 @@ MODULE(sched_process_free);
 static struct ltt_trace sched_fork[MAX_CPU];
 
 static void sched_process_fork_process(const char *modname, int pass,
-				       double clock, int cpu, void *args)
+				       uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_parent_comm = ARG_FIELD("parent_comm");
+	static struct arg_field f_parent_tid = ARG_FIELD("parent_tid");
+	static struct arg_field f_child_tid = ARG_FIELD("child_tid");
 	const char *parent_comm;
 	int parent_tid, child_tid;
 
 	if (pass == 1)
 		init_trace(&sched_fork[cpu], TG_GLOBAL, 1.0+0.1*cpu,
-			   TRACE_SYM_F_STRING, "fork/%d", cpu);
+			   TRACE_SYM_F_STRING, "fork/%d", host_cpu(cpu));
 
 	if (pass == 2) {
-		parent_comm = get_arg_str(args, "parent_comm");
-		parent_tid = (int)get_arg_u64(args, "parent_tid");
-		child_tid = (int)get_arg_u64(args, "child_tid");
+		parent_comm = get_field_str(args, &f_parent_comm);
+		parent_tid = (int)get_field_u64(args, &f_parent_tid);
+		child_tid = (int)get_field_u64(args, &f_child_tid);
 
-		emit_trace(&sched_fork[cpu], (union ltt_value)"[%d] %s -> [%d]",
-			   parent_tid, parent_comm, child_tid);
+		emit_fmt(&sched_fork[cpu], "[%d] %s -> [%d]", parent_tid,
+			 parent_comm, child_tid);
 	}
 }
 MODULE(sched_process_fork);
 
 static void sched_process_exec_process(const char *modname, int pass,
-				       double clock, int cpu, void *args)
+				       uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_pid = ARG_FIELD("pid");
 	int pid;
 	struct task *task;
 
 	if (pass == 1) {
-		pid = (int)get_arg_u64(args, "pid");
+		pid = (int)get_field_u64(args, &f_pid);
 		task = find_or_add_task(NULL, pid);
 		/* after exec we know this task's tgid */
 		update_task(task, NULL, 0, pid);
@@ -377,42 +565,47 @@ static void sched_process_exec_process(const char *modname, int pass,
 MODULE(sched_process_exec);
 
 static void sched_migrate_task_process(const char *modname, int pass,
-				       double clock, int cpu, void *args)
+				       uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_tid = ARG_FIELD("tid");
+	static struct arg_field f_comm = ARG_FIELD("comm");
+	static struct arg_field f_orig_cpu = ARG_FIELD("orig_cpu");
+	static struct arg_field f_dest_cpu = ARG_FIELD("dest_cpu");
 	const char *comm;
 	struct task *task;
 	int orig_cpu, dest_cpu, tid;
 
-	tid = (int)get_arg_u64(args, "tid");
+	tid = (int)get_field_u64(args, &f_tid);
 
 	if (pass == 1) {
-		comm = get_arg_str(args, "comm");
+		comm = get_field_str(args, &f_comm);
 		(void)find_or_add_task(comm, tid);
 	}
 
 	if (pass == 2) {
-		orig_cpu = (int)get_arg_u64(args, "orig_cpu");
-		dest_cpu = (int)get_arg_u64(args, "dest_cpu");
+		orig_cpu = (int)get_field_u64(args, &f_orig_cpu);
+		dest_cpu = (int)get_field_u64(args, &f_dest_cpu);
 
 		task = find_or_add_task(NULL, tid);
 		if (task) {
-			emit_trace(task->info_trace,
-				   (union ltt_value)"cpu%d->cpu%d",
-				   orig_cpu, dest_cpu);
+			emit_fmt(task->info_trace, "cpu%d->cpu%d", orig_cpu,
+				 dest_cpu);
 		}
 	}
 }
 MODULE(sched_migrate_task);
 
 static void sched_stat_runtime_process(const char *modname, int pass,
-				       double clock, int cpu, void *args)
+				       uint64_t clock, int cpu, void *args)
 {
+	static struct arg_field f_comm = ARG_FIELD("comm");
+	static struct arg_field f_tid = ARG_FIELD("tid");
 	const char *comm;
 	int tid;
 
 	if (pass == 1) {
-		comm = get_arg_str(args, "comm");
-		tid = (int)get_arg_u64(args, "tid");
+		comm = get_field_str(args, &f_comm);
+		tid = (int)get_field_u64(args, &f_tid);
 		(void)find_or_add_task(comm, tid);
 	}
 }
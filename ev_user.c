@@ -13,20 +13,22 @@
 #define MAX_USER_EVENTS		32
 #define MAX_KERNEL_EVENTS	32
 
-static struct ltt_trace user_trace_g;
-static struct ltt_trace kernel_trace_g;
-static struct ltt_trace user_traces[MAX_USER_EVENTS];
-static struct ltt_trace kernel_traces[MAX_KERNEL_EVENTS];
+/* merged hosts each have their own user traces */
+static struct ltt_trace user_trace_g[MAX_HOSTS];
+static struct ltt_trace kernel_trace_g[MAX_HOSTS];
+static struct ltt_trace user_traces[MAX_HOSTS][MAX_USER_EVENTS];
+static struct ltt_trace kernel_traces[MAX_HOSTS][MAX_KERNEL_EVENTS];
 
 static void user_event_start_process(const char *modname, int pass,
-				     double clock, int cpu, void *args)
+				     uint64_t clock, int cpu, void *args)
 {
-	int num = (int)get_arg_i64(args, "event_start");
+	static struct arg_field f_event_start = ARG_FIELD("event_start");
+	int host = get_event_host();
+	int num = (int)get_field_i64(args, &f_event_start);
 
 	if (pass == 1) {
-		if (num < (int)(sizeof(user_traces) /
-				sizeof(user_traces[0])) && num >= 0)
-			init_trace(&user_traces[num],
+		if (num < MAX_USER_EVENTS && num >= 0)
+			init_trace(&user_traces[host][num],
 				   TG_USER,
 				   1 + 0.1 * num,
 				   TRACE_SYM_F_BITS,
@@ -35,22 +37,23 @@ static void user_event_start_process(const char *modname, int pass,
 	}
 
 	if (pass == 2) {
-		if (num < (int)(sizeof(user_traces) /
-				sizeof(user_traces[0])) && num >= 0)
-			emit_trace(&user_traces[num], (union ltt_value)LT_S0);
+		if (num < MAX_USER_EVENTS && num >= 0)
+			emit_trace(&user_traces[host][num],
+				   (union ltt_value)LT_S0);
 	}
 }
 MODULE2(user, event_start);
 
 static void user_event_stop_process(const char *modname, int pass,
-				    double clock, int cpu, void *args)
+				    uint64_t clock, int cpu, void *args)
 {
-	int num = (int)get_arg_i64(args, "event_stop");
+	static struct arg_field f_event_stop = ARG_FIELD("event_stop");
+	int host = get_event_host();
+	int num = (int)get_field_i64(args, &f_event_stop);
 
 	if (pass == 1) {
-		if (num < (int)(sizeof(user_traces) /
-				sizeof(user_traces[0])) && num >= 0)
-			init_trace(&user_traces[num],
+		if (num < MAX_USER_EVENTS && num >= 0)
+			init_trace(&user_traces[host][num],
 				   TG_USER,
 				   1 + 0.1 * num,
 				   TRACE_SYM_F_BITS,
@@ -59,36 +62,39 @@ static void user_event_stop_process(const char *modname, int pass,
 	}
 
 	if (pass == 2) {
-		if (num < (int)(sizeof(user_traces) /
-				sizeof(user_traces[0])) && num >= 0)
-			emit_trace(&user_traces[num], (union ltt_value)LT_IDLE);
+		if (num < MAX_USER_EVENTS && num >= 0)
+			emit_trace(&user_traces[host][num],
+				   (union ltt_value)LT_IDLE);
 	}
 }
 MODULE2(user, event_stop);
 
 static void user_message_process(const char *modname, int pass,
-				 double clock, int cpu, void *args)
+				 uint64_t clock, int cpu, void *args)
 {
-	const char *str = get_arg_str(args, "message");
+	static struct arg_field f_message = ARG_FIELD("message");
+	int host = get_event_host();
+	const char *str = get_field_str(args, &f_message);
 
 	if (pass == 1)
-		init_trace(&user_trace_g, TG_USER, 1,
+		init_trace(&user_trace_g[host], TG_USER, 1,
 			   TRACE_SYM_F_STRING, "user event");
 
-	if (pass == 2)
-		emit_trace(&user_trace_g, (union ltt_value)"%s", str);
+	if ((pass == 2) && str)
+		emit_str(&user_trace_g[host], str, strlen(str));
 }
 MODULE2(user, message);
 
 static void user_kevent_start_process(const char *modname, int pass,
-				      double clock, int cpu, void *args)
+				      uint64_t clock, int cpu, void *args)
 {
-	int num = (int)get_arg_i64(args, "event_start");
+	static struct arg_field f_event_start = ARG_FIELD("event_start");
+	int host = get_event_host();
+	int num = (int)get_field_i64(args, &f_event_start);
 
 	if (pass == 1) {
-		if (num < (int)(sizeof(kernel_traces) /
-				sizeof(kernel_traces[0])) && num >= 0)
-			init_trace(&kernel_traces[num],
+		if (num < MAX_KERNEL_EVENTS && num >= 0)
+			init_trace(&kernel_traces[host][num],
 				   TG_USER,
 				   0.1 * num,
 				   TRACE_SYM_F_BITS,
@@ -97,22 +103,23 @@ static void user_kevent_start_process(const char *modname, int pass,
 	}
 
 	if (pass == 2) {
-		if (num < (int)(sizeof(kernel_traces) /
-				sizeof(kernel_traces[0])) && num >= 0)
-			emit_trace(&kernel_traces[num], (union ltt_value)LT_S0);
+		if (num < MAX_KERNEL_EVENTS && num >= 0)
+			emit_trace(&kernel_traces[host][num],
+				   (union ltt_value)LT_S0);
 	}
 }
 MODULE(user_kevent_start);
 
 static void user_kevent_stop_process(const char *modname, int pass,
-				     double clock, int cpu, void *args)
+				     uint64_t clock, int cpu, void *args)
 {
-	int num = (int)get_arg_i64(args, "event_stop");
+	static struct arg_field f_event_stop = ARG_FIELD("event_stop");
+	int host = get_event_host();
+	int num = (int)get_field_i64(args, &f_event_stop);
 
 	if (pass == 1) {
-		if (num < (int)(sizeof(kernel_traces) /
-				sizeof(kernel_traces[0])) && num >= 0)
-			init_trace(&kernel_traces[num],
+		if (num < MAX_KERNEL_EVENTS && num >= 0)
+			init_trace(&kernel_traces[host][num],
 				   TG_USER,
 				   0.1 * num,
 				   TRACE_SYM_F_BITS,
@@ -121,24 +128,25 @@ static void user_kevent_stop_process(const char *modname, int pass,
 	}
 
 	if (pass == 2) {
-		if (num < (int)(sizeof(kernel_traces) /
-				sizeof(kernel_traces[0])) && num >= 0)
-			emit_trace(&kernel_traces[num],
+		if (num < MAX_KERNEL_EVENTS && num >= 0)
+			emit_trace(&kernel_traces[host][num],
 				   (union ltt_value)LT_IDLE);
 	}
 }
 MODULE(user_kevent_stop);
 
 static void user_kmessage_process(const char *modname, int pass,
-				  double clock, int cpu, void *args)
+				  uint64_t clock, int cpu, void *args)
 {
-	const char *str = get_arg_str(args, "message");
+	static struct arg_field f_message = ARG_FIELD("message");
+	int host = get_event_host();
+	const char *str = get_field_str(args, &f_message);
 
 	if (pass == 1)
-		init_trace(&kernel_trace_g, TG_USER, 0,
+		init_trace(&kernel_trace_g[host], TG_USER, 0,
 			   TRACE_SYM_F_STRING, "kernel event");
 
-	if (pass == 2)
-		emit_trace(&kernel_trace_g, (union ltt_value)"%s", str);
+	if ((pass == 2) && str)
+		emit_str(&kernel_trace_g[host], str, strlen(str));
 }
 MODULE(user_kmessage);
@@ -16,9 +16,10 @@ static struct ltt_trace trace_g;
 static struct ltt_trace traces[MAX_USER_EVENTS];
 
 static void userspace_event_start_process(const char *modname, int pass,
-					  double clock, int cpu, void *args)
+					  uint64_t clock, int cpu, void *args)
 {
-	int num = (int)get_arg_i64(args, "event_start");
+	static struct arg_field f_event_start = ARG_FIELD("event_start");
+	int num = (int)get_field_i64(args, &f_event_start);
 
 	if (pass == 1) {
 		if (num < (int)(sizeof(traces)/sizeof(traces[0])) && num >= 0)
@@ -35,9 +36,10 @@ static void userspace_event_start_process(const char *modname, int pass,
 MODULE2(userspace, event_start);
 
 static void userspace_event_stop_process(const char *modname, int pass,
-					 double clock, int cpu, void *args)
+					 uint64_t clock, int cpu, void *args)
 {
-	int num = (int)get_arg_i64(args, "event_stop");
+	static struct arg_field f_event_stop = ARG_FIELD("event_stop");
+	int num = (int)get_field_i64(args, &f_event_stop);
 
 	if (pass == 1) {
 		if (num < (int)(sizeof(traces)/sizeof(traces[0])) && num >= 0)
@@ -54,16 +56,17 @@ static void userspace_event_stop_process(const char *modname, int pass,
 MODULE2(userspace, event_stop);
 
 static void userspace_message_process(const char *modname, int pass,
-				      double clock, int cpu, void *args)
+				      uint64_t clock, int cpu, void *args)
 {
-	const char * str = get_arg_str(args, "message");
+	static struct arg_field f_message = ARG_FIELD("message");
+	const char * str = get_field_str(args, &f_message);
 
 	if (pass == 1)
 		init_trace(&trace_g, TG_PROCESS, 0.1,
 			   TRACE_SYM_F_STRING, "user event");
 
-	if (pass == 2)
-		emit_trace(&trace_g, (union ltt_value)"%s", str);
+	if ((pass == 2) && str)
+		emit_str(&trace_g, str, strlen(str));
 
 }
 MODULE2(userspace, message);
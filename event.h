@@ -0,0 +1,68 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+#ifndef LTTNG2LXT_EVENT_H
+#define LTTNG2LXT_EVENT_H
+
+/*
+ * Decoded events, whatever the reader: this header does not depend on
+ * babeltrace, see ctf.h for the babeltrace 1 decoder.
+ */
+
+struct lost_channel;
+struct event_source;
+
+#define MAX_EVENT_ARGS            (32)
+
+struct event_arg {
+	const char       *name;
+	struct arg_value  value;
+};
+
+/*
+ * An event decoded out of babeltrace. This is what modules receive as
+ * 'args'. Its strings point into babeltrace until the iterator moves:
+ * record_keep_strings() copies them to strbuf for records that outlive it.
+ * Serial events leave the arguments in babeltrace ('source' is set) and
+ * record_decode() fetches them when a record needs them all.
+ */
+struct event_record {
+	uint64_t                  timestamp;
+	const struct ltt_module  *mod;
+	const char               *name;
+	int                       cpu_id;
+	int                       host;
+	/* gap before this event, see lost.c */
+	uint64_t                  lost_events;
+	uint64_t                  lost_packets;
+	struct lost_channel      *lost_channel;
+	const struct event_source *source;
+	int                       nargs;
+	struct event_arg          args[MAX_EVENT_ARGS];
+	unsigned int              strpos;
+	char                      strbuf[LINEBUF_MAX];
+};
+
+void dispatch_event(struct event_record *rec, int pass, int rebase_clock);
+void set_clock_base(uint64_t timestamp);
+uint64_t get_clock_base(void);
+const char *record_strdup(struct event_record *rec, const char *s);
+const char *record_strndup(struct event_record *rec, const char *s,
+			   size_t max);
+void record_keep_strings(struct event_record *rec);
+void record_decode(struct event_record *rec);
+
+void record_write(FILE *fp, const struct event_record *rec);
+int record_read(FILE *fp, struct event_record *rec);
+
+struct lost_channel *lost_channel(int host, const char *path,
+				  uint64_t stream_id, int cpu);
+void lost_reset(void);
+
+#endif /* LTTNG2LXT_EVENT_H */
@@ -32,6 +32,7 @@
  * FST_DEBUG : not for production use, only enable for development
  * FST_REMOVE_DUPLICATE_VC : glitch removal (has writer performance impact)
  * HAVE_LIBPTHREAD -> FST_WRITER_PARALLEL : enables inclusion of parallel writer code
+ * HAVE_LIBZSTD : enables the zstd pack type of value change data
  * FST_DO_MISALIGNED_OPS (defined automatically for x86 and some others) : CPU architecture can handle misaligned loads/stores
  * _WAVE_HAVE_JUDY : use Judy arrays instead of Jenkins (undefine if LGPL is not acceptable)
  *
@@ -41,6 +42,19 @@
 #include "fastlz.h"
 #include "lz4.h"
 
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+
+/* packed lengths of the reader may include trailing bytes, zstd wants the frame only */
+static int fstZstdDecompress(unsigned char *dst, unsigned long dstlen, const unsigned char *src, unsigned long srclen)
+{
+size_t len = ZSTD_findFrameCompressedSize(src, srclen);
+
+if(ZSTD_isError(len)) return(Z_DATA_ERROR);
+return((ZSTD_decompress(dst, dstlen, src, len) == dstlen) ? Z_OK : Z_DATA_ERROR);
+}
+#endif
+
 #ifndef HAVE_LIBPTHREAD
 #undef FST_WRITER_PARALLEL
 #endif
@@ -107,6 +121,7 @@ void **JenkinsIns(void *base_i, const unsigned char *mem, uint32_t length, uint3
 #define FST_ACTIVATE_HUGE_INC           (1000000)
 
 #define FST_WRITER_STR                  "fstWriter"
+#define FST_WRITER_CHECKPOINT_VERSION   (1)
 #define FST_ID_NAM_SIZ                  (512)
 #define FST_ID_NAM_ATTR_SIZ             (65536+4096)
 #define FST_DOUBLE_ENDTEST              (2.7182818284590452354)
@@ -728,6 +743,8 @@ unsigned vc_emitted : 1;
 unsigned is_initial_time : 1;
 unsigned fourpack : 1;
 unsigned fastpack : 1;
+unsigned zstdpack : 1;
+int pack_level;
 
 int64_t timezero;
 off_t section_header_truncpos;
@@ -947,7 +964,14 @@ fflush(xc->handle);
  */
 static void fstWriterCreateMmaps(struct fstWriterContext *xc)
 {
-off_t curpos = ftello(xc->handle);
+off_t curpos;
+
+#ifdef FST_WRITER_PARALLEL
+pthread_mutex_lock(&xc->mutex); /* a block may still be written to xc->handle */
+pthread_mutex_unlock(&xc->mutex);
+#endif
+
+curpos = ftello(xc->handle);
 
 fflush(xc->hier_handle);
 
@@ -1272,7 +1296,7 @@ vchg_mem = xc->vchg_mem;
 
 f = xc->handle;
 fstWriterVarint(f, xc->maxhandle);      /* emit current number of handles */
-fputc(xc->fourpack ? '4' : (xc->fastpack ? 'F' : 'Z'), f);
+fputc(xc->zstdpack ? 'S' : (xc->fourpack ? '4' : (xc->fastpack ? 'F' : 'Z')), f);
 fpos = 1;
 
 packmemlen = 1024;                      /* maintain a running "longest" allocation to */
@@ -1441,7 +1465,7 @@ for(i=0;i<xc->maxhandle;i++)
                                         dmem = packmem = malloc(compressBound(packmemlen = wrlen));
                                         }
 
-                                rc = compress2(dmem, &destlen, scratchpnt, wrlen, 4);
+                                rc = compress2(dmem, &destlen, scratchpnt, wrlen, xc->pack_level ? xc->pack_level : 4);
                                 if(rc == Z_OK)
                                         {
 #ifndef FST_DYNAMIC_ALIAS_DISABLE
@@ -1486,17 +1510,37 @@ for(i=0;i<xc->maxhandle;i++)
                                 else
                                 {
                                 /* this is extremely conservative: fastlz needs +5% for worst case, lz4 needs siz+(siz/255)+16 */
-                                if(((wrlen * 2) + 2) <= packmemlen)
+                                unsigned int dmemlen = (wrlen * 2) + 2;
+#ifdef HAVE_LIBZSTD
+                                if(xc->zstdpack) dmemlen = ZSTD_compressBound(wrlen); /* small inputs need more than twice their size */
+#endif
+                                if(dmemlen <= packmemlen)
                                         {
                                         dmem = packmem;
                                         }
                                         else
                                         {
                                         free(packmem);
-                                        dmem = packmem = malloc(packmemlen = (wrlen * 2) + 2);
+                                        dmem = packmem = malloc(packmemlen = dmemlen);
                                         }
 
-                                rc = (xc->fourpack) ? LZ4_compress((char *)scratchpnt, (char *)dmem, wrlen) : fastlz_compress(scratchpnt, wrlen, dmem);
+#ifdef HAVE_LIBZSTD
+                                if(xc->zstdpack)
+                                        {
+                                        size_t zrc = ZSTD_compress(dmem, dmemlen, scratchpnt, wrlen, xc->pack_level);
+                                        rc = ZSTD_isError(zrc) ? destlen : zrc; /* stored as is on error */
+                                        }
+                                        else
+#endif
+                                if(xc->fourpack)
+                                        {
+                                        /* for lz4, the level is the acceleration: higher is faster */
+                                        rc = xc->pack_level ? LZ4_compress_fast((char *)scratchpnt, (char *)dmem, wrlen, dmemlen, xc->pack_level) : LZ4_compress((char *)scratchpnt, (char *)dmem, wrlen);
+                                        }
+                                        else
+                                        {
+                                        rc = xc->pack_level ? fastlz_compress_level(xc->pack_level, scratchpnt, wrlen, dmem) : fastlz_compress(scratchpnt, wrlen, dmem);
+                                        }
                                 if(rc < destlen)
                                         {
 #ifndef FST_DYNAMIC_ALIAS_DISABLE
@@ -2189,6 +2233,266 @@ if(xc && !xc->already_in_close && !xc->already_in_flush)
 }
 
 
+/*
+ * checkpoint and resume: the writer state is saved right after a value
+ * change block is flushed, resuming truncates the file back to that point
+ */
+static int fstWriterCopyBlock(FILE *dst, FILE *src, uint64_t len)
+{
+char buf[FST_GZIO_LEN];
+size_t this_len;
+
+while(len)
+        {
+        this_len = (len > sizeof(buf)) ? sizeof(buf) : len;
+        if(fstFread(buf, this_len, 1, src) != 1) return(0);
+        if(fstFwrite(buf, this_len, 1, dst) != 1) return(0);
+        len -= this_len;
+        }
+
+return(1);
+}
+
+
+static int fstWriterSaveTmpfile(struct fstWriterContext *xc, FILE *f, FILE *tmp, const void *mem, uint64_t len)
+{
+int rc;
+
+if(mem)
+        {
+        return(!len || (fstFwrite(mem, len, 1, f) == 1));
+        }
+
+fflush(tmp);
+fstWriterFseeko(xc, tmp, 0, SEEK_SET);
+rc = fstWriterCopyBlock(f, tmp, len);
+fstWriterFseeko(xc, tmp, 0, SEEK_END);
+
+return(rc);
+}
+
+
+int fstWriterCheckpoint(void *ctx, FILE *f)
+{
+struct fstWriterContext *xc = (struct fstWriterContext *)ctx;
+struct fstBlackoutChain *b;
+off_t geom_len, tchn_len;
+
+if((!xc) || (!f) || (xc->is_initial_time) || (xc->size_limit_locked) || (xc->already_in_flush) || (xc->already_in_close))
+        {
+        return(0);
+        }
+
+if(xc->vchg_siz > 1)
+        {
+        if(!xc->valpos_mem)
+                {
+                fstWriterCreateMmaps(xc);
+                }
+        /* same as a flush on time change, the new block starts at curtime */
+        xc->flush_context_pending = 0;
+        fstWriterFlushContextPrivate(xc);
+#ifdef FST_WRITER_PARALLEL
+        pthread_mutex_lock(&xc->mutex);
+        pthread_mutex_unlock(&xc->mutex);
+#endif
+        xc->tchn_cnt++;
+        fstWriterVarint(xc->tchn_handle, xc->curtime);
+        }
+
+fflush(xc->handle);
+#ifndef __MINGW32__
+fsync(fileno(xc->handle));
+#endif
+
+fflush(xc->geom_handle);
+geom_len = ftello(xc->geom_handle);
+fflush(xc->tchn_handle);
+tchn_len = ftello(xc->tchn_handle);
+
+fstWriterUint64(f, FST_WRITER_CHECKPOINT_VERSION);
+fstWriterUint64(f, ftello(xc->handle));
+fstWriterUint64(f, xc->section_start);
+fstWriterUint64(f, xc->section_header_truncpos);
+fstWriterUint64(f, xc->section_header_only);
+fstWriterUint64(f, xc->hier_file_len);
+fstWriterUint64(f, geom_len);
+fstWriterUint64(f, tchn_len);
+fstWriterUint64(f, xc->maxhandle);
+fstWriterUint64(f, xc->numsigs);
+fstWriterUint64(f, xc->maxvalpos);
+fstWriterUint64(f, xc->vc_emitted);
+fstWriterUint64(f, xc->fourpack);
+fstWriterUint64(f, xc->fastpack);
+fstWriterUint64(f, xc->timezero);
+fstWriterUint64(f, xc->tchn_cnt);
+fstWriterUint64(f, xc->tchn_idx);
+fstWriterUint64(f, xc->curtime);
+fstWriterUint64(f, xc->firsttime);
+fstWriterUint64(f, xc->secnum);
+fstWriterUint64(f, xc->numscopes);
+fstWriterUint64(f, xc->dump_size_limit);
+fstWriterUint64(f, xc->filetype);
+fstWriterUint64(f, xc->compress_hier);
+fstWriterUint64(f, xc->repack_on_close);
+fstWriterUint64(f, xc->skip_writing_section_hdr);
+fstWriterUint64(f, xc->parallel_enabled);
+fstWriterUint64(f, xc->fst_break_size);
+fstWriterUint64(f, xc->fst_break_add_size);
+fstWriterUint64(f, xc->next_huge_break);
+fstWriterUint64(f, xc->vchg_alloc_siz);
+fstWriterUint64(f, xc->num_blackouts);
+for(b = xc->blackout_head; b; b = b->next)
+        {
+        fstWriterUint64(f, b->tim);
+        fstWriterUint64(f, b->active);
+        }
+
+fflush(xc->hier_handle);
+fstWriterFseeko(xc, xc->hier_handle, 0, SEEK_SET);
+if(!fstWriterCopyBlock(f, xc->hier_handle, xc->hier_file_len)) return(0);
+fstWriterFseeko(xc, xc->hier_handle, 0, SEEK_END);
+
+if(!fstWriterSaveTmpfile(xc, f, xc->geom_handle, NULL, geom_len)) return(0);
+if(!fstWriterSaveTmpfile(xc, f, xc->valpos_handle, xc->valpos_mem, (uint64_t)xc->maxhandle * 4 * sizeof(uint32_t))) return(0);
+if(!fstWriterSaveTmpfile(xc, f, xc->curval_handle, xc->curval_mem, xc->maxvalpos)) return(0);
+if(!fstWriterSaveTmpfile(xc, f, xc->tchn_handle, NULL, tchn_len)) return(0);
+
+return(!ferror(f));
+}
+
+
+void *fstWriterResume(const char *nam, FILE *f)
+{
+struct fstWriterContext *xc;
+struct fstBlackoutChain *b;
+off_t pos;
+uint64_t geom_len, tchn_len;
+uint32_t i;
+char *hf;
+int ok;
+
+if((!nam) || (!f) || (fstReaderUint64(f) != FST_WRITER_CHECKPOINT_VERSION))
+        {
+        return(NULL);
+        }
+
+xc = calloc(1, sizeof(struct fstWriterContext));
+fstDetermineBreakSize(xc);
+
+pos = fstReaderUint64(f);
+xc->section_start = fstReaderUint64(f);
+xc->section_header_truncpos = fstReaderUint64(f);
+xc->section_header_only = fstReaderUint64(f);
+xc->hier_file_len = fstReaderUint64(f);
+geom_len = fstReaderUint64(f);
+tchn_len = fstReaderUint64(f);
+xc->maxhandle = fstReaderUint64(f);
+xc->numsigs = fstReaderUint64(f);
+xc->maxvalpos = fstReaderUint64(f);
+xc->vc_emitted = fstReaderUint64(f);
+xc->fourpack = fstReaderUint64(f);
+xc->fastpack = fstReaderUint64(f);
+xc->timezero = fstReaderUint64(f);
+xc->tchn_cnt = fstReaderUint64(f);
+xc->tchn_idx = fstReaderUint64(f);
+xc->curtime = fstReaderUint64(f);
+xc->firsttime = fstReaderUint64(f);
+xc->secnum = fstReaderUint64(f);
+xc->numscopes = fstReaderUint64(f);
+xc->dump_size_limit = fstReaderUint64(f);
+xc->filetype = fstReaderUint64(f);
+xc->compress_hier = fstReaderUint64(f);
+xc->repack_on_close = fstReaderUint64(f);
+xc->skip_writing_section_hdr = fstReaderUint64(f);
+xc->parallel_enabled = fstReaderUint64(f);
+xc->parallel_was_enabled = xc->parallel_enabled;
+xc->fst_break_size = fstReaderUint64(f);
+xc->fst_break_add_size = fstReaderUint64(f);
+xc->next_huge_break = fstReaderUint64(f);
+xc->vchg_alloc_siz = fstReaderUint64(f);
+xc->num_blackouts = fstReaderUint64(f);
+for(i=0;i<xc->num_blackouts;i++)
+        {
+        b = calloc(1, sizeof(struct fstBlackoutChain));
+        b->tim = fstReaderUint64(f);
+        b->active = (fstReaderUint64(f) != 0);
+        if(xc->blackout_curr)
+                {
+                xc->blackout_curr->next = b;
+                }
+                else
+                {
+                xc->blackout_head = b;
+                }
+        xc->blackout_curr = b;
+        }
+
+hf = calloc(1, strlen(nam) + 6);
+strcpy(hf, nam);
+strcat(hf, ".hier");
+
+xc->handle = fopen(nam, "r+b");
+xc->hier_handle = unlink_fopen(hf, "w+b");
+xc->geom_handle = tmpfile_open(&xc->geom_handle_nam);           /* .geom */
+xc->valpos_handle = tmpfile_open(&xc->valpos_handle_nam);       /* .offs */
+xc->curval_handle = tmpfile_open(&xc->curval_handle_nam);       /* .bits */
+xc->tchn_handle = tmpfile_open(&xc->tchn_handle_nam);           /* .tchn */
+xc->vchg_mem = malloc(xc->vchg_alloc_siz);
+
+ok = xc->handle && xc->hier_handle && xc->geom_handle && xc->valpos_handle && xc->curval_handle && xc->tchn_handle && xc->vchg_mem && !feof(f) && !ferror(f);
+ok = ok && fstWriterCopyBlock(xc->hier_handle, f, xc->hier_file_len);
+ok = ok && fstWriterCopyBlock(xc->geom_handle, f, geom_len);
+ok = ok && fstWriterCopyBlock(xc->valpos_handle, f, (uint64_t)xc->maxhandle * 4 * sizeof(uint32_t));
+ok = ok && fstWriterCopyBlock(xc->curval_handle, f, xc->maxvalpos);
+ok = ok && fstWriterCopyBlock(xc->tchn_handle, f, tchn_len);
+/* blocks written after the checkpoint are dropped */
+ok = ok && !fstFtruncate(fileno(xc->handle), pos);
+
+if(!ok)
+        {
+        if(xc->handle) fclose(xc->handle);
+        if(xc->hier_handle) { fclose(xc->hier_handle); unlink(hf); }
+        tmpfile_close(&xc->geom_handle, &xc->geom_handle_nam);
+        tmpfile_close(&xc->valpos_handle, &xc->valpos_handle_nam);
+        tmpfile_close(&xc->curval_handle, &xc->curval_handle_nam);
+        tmpfile_close(&xc->tchn_handle, &xc->tchn_handle_nam);
+        while(xc->blackout_head)
+                {
+                b = xc->blackout_head->next;
+                free(xc->blackout_head);
+                xc->blackout_head = b;
+                }
+        free(xc->vchg_mem);
+        free(xc);
+        free(hf);
+        return(NULL);
+        }
+
+/* the block in progress may have been finalized after the checkpoint */
+if(xc->section_start)
+        {
+        fstWriterFseeko(xc, xc->handle, xc->section_start - 1, SEEK_SET);
+        fputc(FST_BL_SKIP, xc->handle);
+        }
+fstWriterFseeko(xc, xc->handle, pos, SEEK_SET);
+fflush(xc->handle);
+
+xc->vchg_mem[0] = '!';
+xc->vchg_siz = 1;
+xc->filename = strdup(nam);
+xc->nan = strtod("NaN", NULL);
+#ifdef FST_WRITER_PARALLEL
+pthread_mutex_init(&xc->mutex, NULL);
+pthread_attr_init(&xc->thread_attr);
+pthread_attr_setdetachstate(&xc->thread_attr, PTHREAD_CREATE_DETACHED);
+#endif
+
+free(hf);
+return(xc);
+}
+
+
 /*
  * functions to set miscellaneous header/block information
  */
@@ -2452,6 +2756,24 @@ if(xc)
         {
         xc->fastpack     = (typ != FST_WR_PT_ZLIB);
         xc->fourpack     = (typ == FST_WR_PT_LZ4);
+        xc->zstdpack     = (typ == FST_WR_PT_ZSTD);
+#ifndef HAVE_LIBZSTD
+        if(xc->zstdpack)
+                {
+                fprintf(stderr, "ERROR: fstWriterSetPackType(), HAVE_LIBZSTD not enabled during compile, exiting.\n");
+                exit(255);
+                }
+#endif
+        }
+}
+
+
+void fstWriterSetPackLevel(void *ctx, int level)
+{
+struct fstWriterContext *xc = (struct fstWriterContext *)ctx;
+if(xc)
+        {
+        xc->pack_level = level;
         }
 }
 
@@ -2543,6 +2865,10 @@ if(xc && nam)
         {
         if(xc->valpos_mem)
                 {
+#ifdef FST_WRITER_PARALLEL
+                pthread_mutex_lock(&xc->mutex); /* a block may still be reading curval_mem */
+                pthread_mutex_unlock(&xc->mutex);
+#endif
                 fstDestroyMmaps(xc, 0);
                 }
 
@@ -5074,6 +5400,7 @@ for(;;)
         pnt = chain_cmem;
         idx = 0;
         pval = 0;
+        pidx = 0;       /* a stale pidx from the previous block corrupts a chain length, read as an alias */
 
         if(sectype == FST_BL_VCDATA_DYN_ALIAS2)
                 {
@@ -5217,6 +5544,10 @@ for(;;)
                                                           break;
                                                 case 'F': fastlz_decompress(mc, sourcelen, mu, destlen); /* rc appears unreliable */
                                                           break;
+#ifdef HAVE_LIBZSTD
+                                                case 'S': rc = fstZstdDecompress(mu, destlen, mc, sourcelen);
+                                                          break;
+#endif
                                                 default:  rc = uncompress(mu, &destlen, mc, sourcelen);
                                                           break;
                                                 }
@@ -6061,6 +6392,10 @@ if(!xc->rvat_chain_mem)
                         	break;
                         case 'F': fastlz_decompress(mc, sourcelen, mu, destlen); /* rc appears unreliable */
                         	break;
+#ifdef HAVE_LIBZSTD
+                        case 'S': rc = fstZstdDecompress(mu, destlen, mc, sourcelen);
+                        	break;
+#endif
                         default:  rc = uncompress(mu, &destlen, mc, sourcelen);
                         	break;
                         }
@@ -43,7 +43,8 @@ typedef uint32_t fstHandle;
 enum fstWriterPackType {
     FST_WR_PT_ZLIB             = 0,
     FST_WR_PT_FASTLZ           = 1,
-    FST_WR_PT_LZ4              = 2
+    FST_WR_PT_LZ4              = 2,
+    FST_WR_PT_ZSTD             = 3     /* needs HAVE_LIBZSTD */
 };
 
 enum fstFileType {
@@ -323,6 +324,7 @@ union {
 /*
  * writer functions
  */
+int             fstWriterCheckpoint(void *ctx, FILE *f);
 void            fstWriterClose(void *ctx);
 void *          fstWriterCreate(const char *nam, int use_compressed_hier);
                 /* used for Verilog/SV */
@@ -340,6 +342,7 @@ void            fstWriterEmitTimeChange(void *ctx, uint64_t tim);
 void            fstWriterFlushContext(void *ctx);
 int             fstWriterGetDumpSizeLimitReached(void *ctx);
 int             fstWriterGetFseekFailed(void *ctx);
+void *          fstWriterResume(const char *nam, FILE *f);
 void            fstWriterSetAttrBegin(void *ctx, enum fstAttrType attrtype, int subtype,
                         const char *attrname, uint64_t arg);
 void            fstWriterSetAttrEnd(void *ctx);
@@ -349,6 +352,7 @@ void            fstWriterSetDumpSizeLimit(void *ctx, uint64_t numbytes);
 void            fstWriterSetEnvVar(void *ctx, const char *envvar);
 void            fstWriterSetFileType(void *ctx, enum fstFileType filetype);
 void            fstWriterSetPackType(void *ctx, enum fstWriterPackType typ);
+void            fstWriterSetPackLevel(void *ctx, int level);    /* 0 is the default of the pack type */
 void            fstWriterSetParallelMode(void *ctx, int enable);
 void            fstWriterSetRepackOnClose(void *ctx, int enable);       /* type = 0 (none), 1 (libz) */
 void            fstWriterSetScope(void *ctx, enum fstScopeType scopetype,
@@ -0,0 +1,189 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+
+/*
+ * Ingest-time filters. Event names and CPUs are checked before decoding,
+ * so dropped events cost a table lookup. Tasks are resolved through the
+ * task table: traces of filtered tasks are never declared nor emitted.
+ */
+
+struct glob_list {
+	char **globs;
+	int    count;
+};
+
+struct id_set {
+	int   *ids;
+	int    count;
+};
+
+int filter_enabled;
+
+static struct glob_list event_include;
+static struct glob_list event_exclude;
+static struct glob_list comm_include;
+static struct id_set tid_set;
+static struct id_set tgid_set;
+static int cpu_filtered;
+static int cpu_set[MAX_CPU];
+
+static void add_globs(struct glob_list *list, const char *arg)
+{
+	char *copy, *glob, *saveptr;
+
+	copy = strdup(arg);
+	assert(copy);
+
+	for (glob = strtok_r(copy, ",", &saveptr); glob;
+	     glob = strtok_r(NULL, ",", &saveptr)) {
+		list->globs = realloc(list->globs,
+				      sizeof(*list->globs)*(list->count+1));
+		assert(list->globs);
+		list->globs[list->count] = strdup(glob);
+		assert(list->globs[list->count]);
+		list->count++;
+	}
+	free(copy);
+	filter_enabled = 1;
+}
+
+static int match_globs(const struct glob_list *list, const char *name)
+{
+	int i;
+
+	for (i = 0; i < list->count; i++)
+		if (fnmatch(list->globs[i], name, 0) == 0)
+			return 1;
+	return 0;
+}
+
+/* call fn on each id of a "1,4-7" style list */
+static void parse_ranges(const char *arg, const char *what,
+			 void (*fn)(void *cookie, int id), void *cookie)
+{
+	long first, last;
+	char *end;
+	const char *p = arg;
+
+	while (*p) {
+		first = strtol(p, &end, 0);
+		if (end == p)
+			FATAL("invalid %s list '%s'\n", what, arg);
+		last = first;
+		if (*end == '-') {
+			p = end+1;
+			last = strtol(p, &end, 0);
+			if ((end == p) || (last < first))
+				FATAL("invalid %s list '%s'\n", what, arg);
+		}
+		for (; first <= last; first++)
+			fn(cookie, (int)first);
+		if (*end == ',')
+			end++;
+		else if (*end)
+			FATAL("invalid %s list '%s'\n", what, arg);
+		p = end;
+	}
+	filter_enabled = 1;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+	int ia = *(const int *)a;
+	int ib = *(const int *)b;
+
+	return (ia > ib)-(ia < ib);
+}
+
+static void add_id(void *cookie, int id)
+{
+	struct id_set *set = cookie;
+
+	set->ids = realloc(set->ids, sizeof(*set->ids)*(set->count+1));
+	assert(set->ids);
+	set->ids[set->count++] = id;
+	qsort(set->ids, set->count, sizeof(*set->ids), compare_ids);
+}
+
+static int in_set(const struct id_set *set, int id)
+{
+	return bsearch(&id, set->ids, set->count, sizeof(*set->ids),
+		       compare_ids) != NULL;
+}
+
+static void add_cpu(void *cookie, int cpu)
+{
+	if ((cpu < 0) || (cpu >= MAX_CPU))
+		FATAL("cpu %d out of range (max %d)\n", cpu, MAX_CPU-1);
+	cpu_set[cpu] = 1;
+	cpu_filtered = 1;
+}
+
+void filter_add_events(const char *globs)
+{
+	add_globs(&event_include, globs);
+}
+
+void filter_exclude_events(const char *globs)
+{
+	add_globs(&event_exclude, globs);
+}
+
+void filter_add_comms(const char *globs)
+{
+	add_globs(&comm_include, globs);
+}
+
+void filter_add_cpus(const char *list)
+{
+	parse_ranges(list, "cpu", add_cpu, NULL);
+}
+
+void filter_add_tids(const char *list)
+{
+	parse_ranges(list, "tid", add_id, &tid_set);
+}
+
+void filter_add_tgids(const char *list)
+{
+	parse_ranges(list, "tgid", add_id, &tgid_set);
+}
+
+/* return 1 if events with this name are dropped */
+int filter_event(const char *name)
+{
+	if (event_include.count && !match_globs(&event_include, name))
+		return 1;
+	return match_globs(&event_exclude, name);
+}
+
+/* return 1 if events from this CPU are dropped */
+int filter_cpu(int cpu)
+{
+	return cpu_filtered && ((cpu >= MAX_CPU) || !cpu_set[cpu]);
+}
+
+/* return 1 if the traces of this task are left out */
+int filter_task(int tid, int tgid, const char *comm)
+{
+	/* with no task filter, every task is selected */
+	if (!tid_set.count && !tgid_set.count && !comm_include.count)
+		return 0;
+
+	if (tid_set.count && in_set(&tid_set, tid))
+		return 0;
+	if (tgid_set.count && in_set(&tgid_set, tgid))
+		return 0;
+	if (comm_include.count && match_globs(&comm_include, comm))
+		return 0;
+	return 1;
+}
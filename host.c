@@ -0,0 +1,201 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+
+/*
+ * Traces captured simultaneously on several hosts are merged on a single
+ * timeline. Each host has its own clock offset, its own range of virtual
+ * CPUs and its own FST scope. Host 0 is the trace given on the command
+ * line, and the reference clock. A host may start before it: the merged
+ * timeline is shifted so that no shifted timestamp is negative, and the
+ * clock base then puts time zero at the earliest event of all hosts.
+ */
+
+struct host {
+	char    *dir;
+	char    *name;
+	int64_t  offset;  /* ns, added to the host timestamps */
+	int      dropped; /* a CPU did not fit in the host slice */
+};
+
+int nb_hosts;
+char *sync_event;
+
+static struct host hosts[MAX_HOSTS];
+/* ns added to every host timestamp, the most negative offset */
+static uint64_t bias;
+
+static void update_bias(void)
+{
+	int i;
+
+	bias = 0;
+	for (i = 0; i < nb_hosts; i++) {
+		if ((hosts[i].offset < 0) &&
+		    ((uint64_t)-hosts[i].offset > bias))
+			bias = (uint64_t)-hosts[i].offset;
+	}
+}
+
+static char *make_name(const char *dir)
+{
+	char *name, *p;
+	size_t len = archive_base_len(dir);
+
+	/* basename, without trailing '/' */
+	while ((len > 1) && (dir[len-1] == '/'))
+		len--;
+	name = strndup(dir, len);
+	assert(name);
+	p = strrchr(name, '/');
+	if (p) {
+		p = strdup(p+1);
+		assert(p);
+		free(name);
+		name = p;
+	}
+	symbol_clean_name(name);
+	return name;
+}
+
+/* archives are read from their unpacked tree */
+static char *open_dir(const char *path)
+{
+	char *dir;
+
+	if (archive_is_archive(path))
+		dir = strdup(archive_open(path));
+	else
+		dir = strdup(path);
+	assert(dir);
+	return dir;
+}
+
+/* "<dir>[@<seconds>]", the offset may be negative */
+void host_add(const char *arg)
+{
+	char *path, *at, *end;
+	double offset = 0.0;
+	struct host *h;
+
+	/* keep room for the command line trace */
+	if (nb_hosts+1 >= MAX_HOSTS)
+		FATAL("too many hosts (max %d)\n", MAX_HOSTS);
+
+	path = strdup(arg);
+	assert(path);
+	at = strrchr(path, '@');
+	if (at) {
+		*at = '\0';
+		offset = strtod(at+1, &end);
+		if ((end == at+1) || *end)
+			FATAL("invalid host offset '%s', expecting seconds\n",
+			      at+1);
+	}
+
+	h = &hosts[++nb_hosts];
+	h->dir = open_dir(path);
+	h->offset = (int64_t)(offset*1000000000.0);
+	h->name = make_name(path);
+	free(path);
+	update_bias();
+}
+
+void host_init(const char *dir)
+{
+	int i, j;
+
+	hosts[0].dir = open_dir(dir);
+	hosts[0].name = make_name(dir);
+	hosts[0].offset = 0;
+	nb_hosts++;
+	update_bias();
+
+	/* scopes are looked up by name */
+	for (i = 1; i < nb_hosts; i++) {
+		for (j = 0; j < i; j++) {
+			if (strcmp(hosts[i].name, hosts[j].name) == 0)
+				FATAL("hosts '%s' and '%s' share a name\n",
+				      hosts[i].dir, hosts[j].dir);
+		}
+	}
+}
+
+void host_free(void)
+{
+	int i;
+
+	for (i = 0; i < nb_hosts; i++) {
+		free(hosts[i].dir);
+		free(hosts[i].name);
+	}
+	nb_hosts = 0;
+	archive_close();
+}
+
+const char *host_dir(int host)
+{
+	return hosts[host].dir;
+}
+
+/* FST scope of the host traces, NULL when there is a single host */
+const char *host_name(int host)
+{
+	return (nb_hosts > 1) ? hosts[host].name : NULL;
+}
+
+/* offsets must be final before the first host_clock() call */
+void host_adjust_offset(int host, int64_t delta)
+{
+	hosts[host].offset += delta;
+	update_bias();
+}
+
+/* shift a host timestamp to the reference clock, plus the common bias */
+uint64_t host_clock(int host, uint64_t timestamp)
+{
+	return timestamp+(uint64_t)(hosts[host].offset+(int64_t)bias);
+}
+
+/* ns every host timestamp is shifted by, on top of the host offsets */
+uint64_t host_bias(void)
+{
+	return bias;
+}
+
+/* hosts share the CPU tables, each one gets a slice */
+static int cpus_per_host(void)
+{
+	return (nb_hosts > 1) ? MAX_CPU/nb_hosts : MAX_CPU;
+}
+
+/* virtual CPU of a host CPU, MAX_CPU when it does not fit */
+int host_cpu_id(int host, int cpu)
+{
+	if ((cpu < 0) || (cpu >= cpus_per_host())) {
+		/* decoder threads call this, warn once per host */
+		if ((nb_hosts > 1) &&
+		    !__atomic_exchange_n(&hosts[host].dropped, 1,
+					 __ATOMIC_RELAXED))
+			DIAG("host %s: %d hosts get %d CPUs each, dropping "
+			     "the events of cpu %d and above\n",
+			     hosts[host].name, nb_hosts, cpus_per_host(),
+			     cpus_per_host());
+		return MAX_CPU;
+	}
+	return host*cpus_per_host()+cpu;
+}
+
+/* host CPU number of a virtual CPU, for trace names */
+int host_cpu(int cpu)
+{
+	return cpu % cpus_per_host();
+}
@@ -0,0 +1,267 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "ctf.h"
+
+#include <pthread.h>
+
+/*
+ * Lost events accounting. LTTng packet contexts carry a running count of
+ * the events the tracer discarded on the stream (events_discarded), and a
+ * packet sequence number (packet_seq_num) whose gaps are lost packets.
+ * Decoders compare them with the previous packet of the same stream; the
+ * differences end up in per-CPU traces and in a per-channel summary.
+ * Decoding may start in the middle of a stream (time window, shard, follow
+ * round): the first packet seen then only primes the channel, its counts
+ * hold what was lost before it.
+ */
+
+struct lost_channel {
+	int                  host;
+	char                *path;
+	uint64_t             stream_id;
+	int                  cpu;
+	/* packet context values of the last packet decoded */
+	int                  primed;
+	uint64_t             discarded;
+	uint64_t             seq;
+	int                  seq_valid;
+	/* totals, accounted on emission */
+	uint64_t             lost_events;
+	uint64_t             lost_packets;
+	struct lost_channel *next;
+};
+
+static struct lost_channel *channels;
+static int nb_channels;
+/* decoder threads create channels, each one then owns its channel */
+static pthread_mutex_t channels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct ltt_trace lost_count[MAX_CPU];
+static struct ltt_trace lost_info[MAX_CPU];
+static uint64_t lost_total[MAX_CPU];
+
+struct lost_channel *lost_channel(int host, const char *path,
+				  uint64_t stream_id, int cpu)
+{
+	struct lost_channel *ch;
+
+	pthread_mutex_lock(&channels_lock);
+	for (ch = channels; ch; ch = ch->next) {
+		if ((ch->host == host) && (ch->stream_id == stream_id) &&
+		    (ch->cpu == cpu) && (strcmp(ch->path, path) == 0))
+			break;
+	}
+	if (!ch) {
+		ch = calloc(1, sizeof(*ch));
+		assert(ch);
+		ch->host = host;
+		ch->path = strdup(path);
+		assert(ch->path);
+		ch->stream_id = stream_id;
+		ch->cpu = cpu;
+		ch->next = channels;
+		channels = ch;
+		nb_channels++;
+	}
+	pthread_mutex_unlock(&channels_lock);
+	return ch;
+}
+
+/* compare packet context values with the previous packet of the stream */
+void lost_check(struct lost_channel *ch, uint64_t discarded, int has_seq,
+		uint64_t seq, struct event_record *rec)
+{
+	if (!ch->primed) {
+		ch->primed = 1;
+		/* only the first packet of a stream counts from zero */
+		if (!has_seq || (seq != 0)) {
+			ch->discarded = discarded;
+			ch->seq = seq;
+			ch->seq_valid = has_seq;
+			return;
+		}
+	}
+
+	if (discarded > ch->discarded) {
+		rec->lost_events = discarded-ch->discarded;
+		rec->lost_channel = ch;
+	}
+	ch->discarded = discarded;
+
+	if (has_seq) {
+		if (ch->seq_valid && (seq > ch->seq+1)) {
+			rec->lost_packets = seq-ch->seq-1;
+			rec->lost_channel = ch;
+		}
+		ch->seq = seq;
+		ch->seq_valid = 1;
+	}
+}
+
+/* every pass primes its channels again */
+void lost_reset(void)
+{
+	int cpu;
+	struct lost_channel *ch;
+
+	for (ch = channels; ch; ch = ch->next) {
+		ch->primed = 0;
+		ch->discarded = 0;
+		ch->seq_valid = 0;
+		ch->lost_events = 0;
+		ch->lost_packets = 0;
+	}
+	for (cpu = 0; cpu < MAX_CPU; cpu++)
+		lost_total[cpu] = 0;
+}
+
+/* called by dispatch_event() for events following a gap */
+void lost_process(struct event_record *rec, int pass)
+{
+	int cpu = rec->cpu_id;
+
+	if (pass == 1) {
+		init_trace(&lost_count[cpu], TG_GLOBAL, 2.0+0.1*cpu,
+			   TRACE_SYM_F_ANALOG, "lost events/%d",
+			   host_cpu(cpu));
+		init_trace(&lost_info[cpu], TG_GLOBAL, 2.05+0.1*cpu,
+			   TRACE_SYM_F_STRING, "lost events/%d (info)",
+			   host_cpu(cpu));
+	}
+
+	if (pass == 2) {
+		if (rec->lost_channel) {
+			rec->lost_channel->lost_events += rec->lost_events;
+			rec->lost_channel->lost_packets += rec->lost_packets;
+		}
+		lost_total[cpu] += rec->lost_events;
+		emit_trace(&lost_count[cpu],
+			   (union ltt_value)(double)lost_total[cpu]);
+		if (rec->lost_packets)
+			emit_fmt(&lost_info[cpu], "%" PRIu64 " events, %" PRIu64
+				 " packets lost", rec->lost_events,
+				 rec->lost_packets);
+		else
+			emit_fmt(&lost_info[cpu], "%" PRIu64 " events lost",
+				 rec->lost_events);
+	}
+}
+
+static int compare_channels(const void *a, const void *b)
+{
+	const struct lost_channel *ca = *(struct lost_channel **)a;
+	const struct lost_channel *cb = *(struct lost_channel **)b;
+
+	/* worst channels first */
+	if (ca->lost_events != cb->lost_events)
+		return (ca->lost_events < cb->lost_events) ? 1 : -1;
+	if (ca->lost_packets != cb->lost_packets)
+		return (ca->lost_packets < cb->lost_packets) ? 1 : -1;
+	if (ca->host != cb->host)
+		return ca->host-cb->host;
+	if (ca->stream_id != cb->stream_id)
+		return (ca->stream_id > cb->stream_id) ? 1 : -1;
+	return ca->cpu-cb->cpu;
+}
+
+void lost_summary(void)
+{
+	int i, n = 0;
+	struct lost_channel *ch, **tab;
+
+	for (ch = channels; ch; ch = ch->next)
+		if (ch->lost_events || ch->lost_packets)
+			n++;
+	if (n == 0) {
+		INFO("no event lost\n");
+		return;
+	}
+
+	tab = malloc(n*sizeof(*tab));
+	assert(tab);
+	for (ch = channels, i = 0; ch; ch = ch->next)
+		if (ch->lost_events || ch->lost_packets)
+			tab[i++] = ch;
+	qsort(tab, n, sizeof(*tab), compare_channels);
+
+	DIAG("lost events, consider bigger subbuffers for:\n");
+	for (i = 0; i < n; i++) {
+		ch = tab[i];
+		DIAG("  %s%s%s stream %" PRIu64 " cpu %d: %" PRIu64
+		     " events, %" PRIu64 " packets\n",
+		     host_name(ch->host) ? : "",
+		     host_name(ch->host) ? ":" : "", ch->path,
+		     ch->stream_id, ch->cpu, ch->lost_events,
+		     ch->lost_packets);
+	}
+	free(tab);
+}
+
+static void lost_save(FILE *fp)
+{
+	struct lost_channel *ch;
+
+	state_put(fp, lost_total, sizeof(lost_total));
+	state_put(fp, &nb_channels, sizeof(nb_channels));
+	for (ch = channels; ch; ch = ch->next) {
+		state_put(fp, &ch->host, sizeof(ch->host));
+		state_put_str(fp, ch->path);
+		state_put(fp, &ch->stream_id, sizeof(ch->stream_id));
+		state_put(fp, &ch->cpu, sizeof(ch->cpu));
+		state_put(fp, &ch->primed, sizeof(ch->primed));
+		state_put(fp, &ch->discarded, sizeof(ch->discarded));
+		state_put(fp, &ch->seq, sizeof(ch->seq));
+		state_put(fp, &ch->seq_valid, sizeof(ch->seq_valid));
+		state_put(fp, &ch->lost_events, sizeof(ch->lost_events));
+		state_put(fp, &ch->lost_packets, sizeof(ch->lost_packets));
+	}
+}
+
+/* channels are created on decoding, the resumed pass may not have them */
+static void lost_restore(FILE *fp)
+{
+	int i, n, host, cpu;
+	uint64_t stream_id;
+	char path[LINEBUF_MAX];
+	struct lost_channel *ch;
+
+	lost_reset();
+	state_get(fp, lost_total, sizeof(lost_total));
+	state_get(fp, &n, sizeof(n));
+	for (i = 0; i < n; i++) {
+		state_get(fp, &host, sizeof(host));
+		state_get_str(fp, path, sizeof(path));
+		state_get(fp, &stream_id, sizeof(stream_id));
+		state_get(fp, &cpu, sizeof(cpu));
+		ch = lost_channel(host, path, stream_id, cpu);
+		state_get(fp, &ch->primed, sizeof(ch->primed));
+		state_get(fp, &ch->discarded, sizeof(ch->discarded));
+		state_get(fp, &ch->seq, sizeof(ch->seq));
+		state_get(fp, &ch->seq_valid, sizeof(ch->seq_valid));
+		state_get(fp, &ch->lost_events, sizeof(ch->lost_events));
+		state_get(fp, &ch->lost_packets, sizeof(ch->lost_packets));
+	}
+}
+STATE(lost);
+
+void lost_free(void)
+{
+	struct lost_channel *ch, *next;
+
+	for (ch = channels; ch; ch = next) {
+		next = ch->next;
+		free(ch->path);
+		free(ch);
+	}
+	channels = NULL;
+	nb_channels = 0;
+}
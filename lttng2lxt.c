@@ -10,11 +10,54 @@
 
 #include "lttng2lxt.h"
 
-int verbose;
-int diag;
-int gtkwave_parrot = 1;
-int show_cpu_switch = 1;
-int do_stats = 0;
+#include <sys/resource.h>
+
+enum {
+	OPT_FROM = 256,
+	OPT_TO,
+	OPT_LAST,
+	OPT_EVENT,
+	OPT_EXCLUDE_EVENT,
+	OPT_CPU,
+	OPT_TID,
+	OPT_TGID,
+	OPT_COMM,
+	OPT_FOLLOW,
+	OPT_HOST,
+	OPT_SYNC,
+	OPT_CHECKPOINT,
+	OPT_RESUME,
+	OPT_SHARDS,
+	OPT_PIPELINE,
+	OPT_MAX_MEMORY,
+	OPT_PACK,
+	OPT_PACK_LEVEL,
+	OPT_NATIVE,
+};
+
+static const struct option long_options[] = {
+	{"from", required_argument, NULL, OPT_FROM},
+	{"to",   required_argument, NULL, OPT_TO},
+	{"last", required_argument, NULL, OPT_LAST},
+	{"event", required_argument, NULL, OPT_EVENT},
+	{"exclude-event", required_argument, NULL, OPT_EXCLUDE_EVENT},
+	{"cpu",  required_argument, NULL, OPT_CPU},
+	{"tid",  required_argument, NULL, OPT_TID},
+	{"tgid", required_argument, NULL, OPT_TGID},
+	{"comm", required_argument, NULL, OPT_COMM},
+	{"follow", optional_argument, NULL, OPT_FOLLOW},
+	{"host", required_argument, NULL, OPT_HOST},
+	{"sync", required_argument, NULL, OPT_SYNC},
+	{"checkpoint", optional_argument, NULL, OPT_CHECKPOINT},
+	{"resume", no_argument, NULL, OPT_RESUME},
+	{"shards", optional_argument, NULL, OPT_SHARDS},
+	{"pipeline", no_argument, NULL, OPT_PIPELINE},
+	{"max-memory", required_argument, NULL, OPT_MAX_MEMORY},
+	{"pack", required_argument, NULL, OPT_PACK},
+	{"pack-level", required_argument, NULL, OPT_PACK_LEVEL},
+	{"native", no_argument, NULL, OPT_NATIVE},
+	{NULL,   0,                 NULL, 0},
+};
 
 static void link_gtkw_file(const char *tracefile, const char *savefile)
 {
@@ -28,21 +71,89 @@ static void link_gtkw_file(const char *tracefile, const char *savefile)
 	free(gtkwfile);
 }
 
+static double parse_seconds(const char *arg)
+{
+	char *end;
+	double val;
+
+	val = strtod(arg, &end);
+	if ((end == arg) || *end || (val < 0.0))
+		FATAL("invalid time '%s', expecting seconds\n", arg);
+	return val;
+}
+
+static int parse_count(const char *arg, const char *what, int min, int max)
+{
+	char *end;
+	long val;
+
+	errno = 0;
+	val = strtol(arg, &end, 10);
+	if ((end == arg) || *end || errno || (val < min) || (val > max))
+		FATAL("invalid %s '%s', expecting %d to %d\n", what, arg,
+		      min, max);
+	return (int)val;
+}
+
+static uint64_t parse_mib(const char *arg)
+{
+	char *end;
+	unsigned long val;
+
+	val = strtoul(arg, &end, 0);
+	if ((end == arg) || *end || (val == 0))
+		FATAL("invalid size '%s', expecting MiB\n", arg);
+	return (uint64_t)val << 20;
+}
+
+static void report_memory(void)
+{
+	struct rusage usage;
+	uint64_t peak;
+
+	if (!memory_limit || getrusage(RUSAGE_SELF, &usage))
+		return;
+
+	/* ru_maxrss is in KiB on Linux */
+	peak = (uint64_t)usage.ru_maxrss << 10;
+	DIAG("peak RSS %" PRIu64 " MiB, %lu FST blocks written early\n",
+	     peak >> 20, save_dump_budget_flushes());
+	if (peak > memory_limit)
+		DIAG("peak RSS above --max-memory %" PRIu64 " MiB\n",
+		     memory_limit >> 20);
+}
+
 static void usage(void)
 {
-	fprintf(stderr, "\nUsage: lttng2lxt [-v] [-d] [-c] [-s] [-a] [-S <stat mask>] [-e <exefile>] "
-		"<lttng_trace_dir> [<outputfile> <savefile>]\n");
+	fprintf(stderr, "\nUsage: lttng2lxt [-v] [-d] [-c] [-s] [-a] [-S <stat mask>] [-e <exefile>] [-1] [-j] [--native] [-N] "
+		"[--from <s>] [--to <s>] [--last <s>] "
+		"[--event <globs>] [--exclude-event <globs>] [--cpu <list>] "
+		"[--tid <list>] [--tgid <list>] [--comm <globs>] "
+		"[--follow[=<s>]] [--host <dir>[@<s>]] [--sync <event>] "
+		"[--checkpoint[=<s>]] [--resume] [--shards[=<n>]] "
+		"[--pipeline] [--max-memory <MiB>] "
+		"[--pack zlib|fastlz|lz4|zstd] [--pack-level <n>] "
+		"<lttng_trace_dir|archive> [<outputfile> <savefile>]\n");
+	fprintf(stderr, "\n--max-memory bounds the FST writer buffers. With "
+		"-1 or --follow, a dead task is\nfreed with its traces, and "
+		"--native gives back the trace pages it has read:\nthe RSS "
+		"still grows by about 80 bytes per dead task, kept by the FST "
+		"writer,\nand 64 bytes per packet. Two passes keep every "
+		"task.\n");
 	exit(1);
 }
 
 int main(int argc, char *argv[])
 {
-	int c, ret;
+	int c, ret, task_filter = 0;
 	char *tracefile;
 	char *outputfile, *savefile;
 	int rebase_clock = 1;
+	const char *pack = NULL;
+	const char *pack_level = NULL;
 
-	while ((c = getopt(argc, argv, "hvdcse:S:a")) != -1) {
+	while ((c = getopt_long(argc, argv, "hvdcse:S:a1jN", long_options,
+				NULL)) != -1) {
 		switch (c) {
 
 		case 'e':
@@ -71,6 +182,89 @@ int main(int argc, char *argv[])
 		case 'a':
 			rebase_clock = 0;
 			break;
+		case '1':
+			single_pass = 1;
+			break;
+		case 'j':
+			parallel_decode = 1;
+			break;
+		case 'N':
+			discovery_cache = 0;
+			break;
+		case OPT_FROM:
+			window_from = parse_seconds(optarg);
+			break;
+		case OPT_TO:
+			window_to = parse_seconds(optarg);
+			break;
+		case OPT_LAST:
+			window_last = parse_seconds(optarg);
+			break;
+		case OPT_EVENT:
+			filter_add_events(optarg);
+			break;
+		case OPT_EXCLUDE_EVENT:
+			filter_exclude_events(optarg);
+			break;
+		case OPT_CPU:
+			filter_add_cpus(optarg);
+			break;
+		case OPT_TID:
+			filter_add_tids(optarg);
+			task_filter = 1;
+			break;
+		case OPT_TGID:
+			filter_add_tgids(optarg);
+			task_filter = 1;
+			break;
+		case OPT_COMM:
+			filter_add_comms(optarg);
+			task_filter = 1;
+			break;
+		case OPT_HOST:
+			host_add(optarg);
+			break;
+		case OPT_SYNC:
+			sync_event = optarg;
+			break;
+		case OPT_FOLLOW:
+			follow_interval = optarg ? parse_seconds(optarg) : 1.0;
+			if (follow_interval <= 0.0)
+				FATAL("invalid follow interval '%s'\n", optarg);
+			break;
+		case OPT_CHECKPOINT:
+			checkpoint_interval = optarg ?
+				parse_seconds(optarg) : 60.0;
+			if (checkpoint_interval <= 0.0)
+				FATAL("invalid checkpoint interval '%s'\n",
+				      optarg);
+			break;
+		case OPT_NATIVE:
+			/* the native decoder is one of the -j decoders */
+			native_decode = 1;
+			parallel_decode = 1;
+			break;
+		case OPT_RESUME:
+			checkpoint_resume = 1;
+			break;
+		case OPT_SHARDS:
+			shard_count = optarg ?
+				parse_count(optarg, "shard count", 1,
+					    MAX_SHARDS) :
+				(int)sysconf(_SC_NPROCESSORS_ONLN);
+			break;
+		case OPT_PIPELINE:
+			pipeline = 1;
+			break;
+		case OPT_MAX_MEMORY:
+			memory_limit = parse_mib(optarg);
+			break;
+		case OPT_PACK:
+			pack = optarg;
+			break;
+		case OPT_PACK_LEVEL:
+			pack_level = optarg;
+			break;
 		case 'h':
 		default:
 			usage();
@@ -78,12 +272,102 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	save_dump_set_pack(pack, pack_level);
 	display_modules();
 
+	if (single_pass && atag_enabled) {
+		/* address tags are resolved in batch at the end of pass 1 */
+		INFO("-e requires two passes, ignoring -1\n");
+		single_pass = 0;
+	}
+
+	if (follow_interval > 0.0) {
+		/* a growing trace is converted in a single pass */
+		if (atag_enabled)
+			FATAL("--follow cannot resolve addresses (-e)\n");
+		if ((window_from >= 0.0) || (window_to >= 0.0) ||
+		    (window_last >= 0.0))
+			FATAL("--follow cannot be used with a time window\n");
+		/* rounds pick their decoders, see parallel_follow() */
+		parallel_decode = 0;
+		native_decode = 0;
+		discovery_cache = 0;
+	}
+
+	if ((checkpoint_interval > 0.0) || checkpoint_resume) {
+		/* checkpoints hold the merge position of the -j decoders */
+		if ((follow_interval > 0.0) || (window_from >= 0.0) ||
+		    (window_to >= 0.0) || (window_last >= 0.0))
+			FATAL("checkpoints cannot be used with --follow or a "
+			      "time window\n");
+		if (single_pass) {
+			INFO("checkpoints need two passes, ignoring -1\n");
+			single_pass = 0;
+		}
+		parallel_decode = 1;
+	}
+
+	/* the discovery cache holds unfiltered results */
+	if (filter_enabled)
+		discovery_cache = 0;
+
 	if ((optind != argc-1) && (optind != argc-3))
 		usage();
 
 	tracefile = argv[optind];
+	host_init(tracefile);
+
+	if (archive_count()) {
+		/* archives are unpacked to a new place on every run */
+		if (follow_interval > 0.0)
+			FATAL("--follow cannot read an archive\n");
+		discovery_cache = 0;
+	}
+
+	if (nb_hosts > 1) {
+		/* hosts are merged on the per-stream decoders */
+		if ((window_from >= 0.0) || (window_to >= 0.0) ||
+		    (window_last >= 0.0) || (follow_interval > 0.0))
+			FATAL("--host cannot be used with --follow or a time "
+			      "window\n");
+		if ((checkpoint_interval > 0.0) || checkpoint_resume)
+			FATAL("--host cannot be used with checkpoints\n");
+		parallel_decode = 1;
+		discovery_cache = 0;
+	} else if (sync_event) {
+		INFO("--sync needs several hosts, ignoring it\n");
+		sync_event = NULL;
+	}
+
+	if (shard_count > 1) {
+		/* shards go on with the -j merge from pass 1 snapshots */
+		if (single_pass || (follow_interval > 0.0))
+			FATAL("--shards needs two passes, it cannot be used "
+			      "with -1 or --follow\n");
+		if ((window_from >= 0.0) || (window_to >= 0.0) ||
+		    (window_last >= 0.0) || (nb_hosts > 1))
+			FATAL("--shards cannot be used with a time window or "
+			      "--host\n");
+		if ((checkpoint_interval > 0.0) || checkpoint_resume ||
+		    pipeline)
+			FATAL("--shards cannot be used with checkpoints or "
+			      "--pipeline\n");
+		/* serial pass 2 filters tasks on their final names */
+		if (task_filter)
+			FATAL("--shards cannot be used with --tid, --tgid or "
+			      "--comm\n");
+		parallel_decode = 1;
+	}
+
+	if (pipeline) {
+		/* these write the FST file outside of the pipeline */
+		if ((follow_interval > 0.0) || (checkpoint_interval > 0.0) ||
+		    checkpoint_resume) {
+			INFO("--pipeline cannot be used with --follow or "
+			     "checkpoints, ignoring it\n");
+			pipeline = 0;
+		}
+	}
 
 	if (optind == argc-3) {
 		outputfile = argv[optind+1];
@@ -92,16 +376,21 @@ int main(int argc, char *argv[])
 		/* make new names with proper extensions */
 		if (tracefile[strlen(tracefile)-1] == '/')  /* strip last / */
 			tracefile[strlen(tracefile)-1] = 0;
+		/* "trace.tar.zst" gives "trace.fst" */
+		tracefile[archive_base_len(tracefile)] = 0;
 		ret = asprintf(&outputfile, "%s.fst", tracefile);
 		assert(ret > 0);
 		ret = asprintf(&savefile, "%s.sav", tracefile);
 		assert(ret > 0);
 	}
 
-	save_dump_init(outputfile);
+	/* a resumed conversion goes on writing the FST file */
+	checkpoint_init(tracefile, outputfile);
+	if (!checkpoint_resuming())
+		save_dump_init(outputfile);
 
 	/* do the actual work */
-	scan_lttng_trace(tracefile, rebase_clock);
+	scan_lttng_trace(host_dir(0), rebase_clock);
 
 	/* create a savefile for GTKwave with comments, trace ordering, etc. */
 	write_savefile(savefile);
@@ -109,6 +398,7 @@ int main(int argc, char *argv[])
 	link_gtkw_file(tracefile, savefile);
 
 	save_dump_close();
+	checkpoint_done();
 
 	fprintf(stdout, "%s: Generated '%s' file\n", argv[0], outputfile);
 
@@ -116,11 +406,19 @@ int main(int argc, char *argv[])
 		free(outputfile);
 		free(savefile);
 	}
+	lost_summary();
 	if (do_stats & STAT_IRQ)
 		irq_stats();
 	if (do_stats & STAT_SOFTIRQ)
 		softirq_stats();
+	if (do_stats & STAT_PIPELINE)
+		pipeline_stats();
+	report_memory();
 
 	unregister_modules();
+	lost_free();
+	pipeline_free();
+	intern_free();
+	host_free();
 	return 0;
 }
@@ -51,8 +51,10 @@ enum {
 #define LT_1                      "1"
 #define LT_0                      "0"
 
-#define MAX_CPU                   (4)
+#define MAX_CPU                   (16)
+#define MAX_HOSTS                 (4)
 #define MAX_IRQS                  (1024)
+#define MAX_SHARDS                (64)
 
 #define PROCESS_IDLE              LT_IDLE
 #define PROCESS_KERNEL            (gtkwave_parrot ? LT_S0 : LT_1)
@@ -86,6 +88,11 @@ struct ltt_trace {
 	const char       *name;
 	const char       *fst_name; /* fst allowed chars only */
 	int               emitted;
+	int               filtered; /* never declared nor emitted */
+	int               cached;   /* last holds the last emitted value */
+	uint64_t          last;
+	int               host;
+	uint64_t          created;  /* clock of the event that created it */
 	struct ltt_trace *next;
 	/* XXX alow to save the task state before cs. should be done
 	   in another struct */
@@ -102,6 +109,7 @@ struct parse_result {
 };
 
 struct task {
+	int                host;
 	int                pid;
 	int                tgid;
 	struct ltt_trace  *state_trace;
@@ -109,6 +117,9 @@ struct task {
 	const char        *mode;
 	char              *name;
 	int                current_cpu;
+	/* clock of the events which last set name and tgid */
+	uint64_t           name_clock;
+	uint64_t           tgid_clock;
 };
 
 enum arg_type {
@@ -128,7 +139,7 @@ struct arg_value {
 
 struct ltt_module {
 	const char  *name;
-	void       (*process)(const char *modname, int pass, double clock,
+	void       (*process)(const char *modname, int pass, uint64_t clock,
 			      int cpu_id, void *args);
 };
 
@@ -150,6 +161,14 @@ struct ltt_module {
 		register_module(#_pattern_, _name_ ## _process);	\
 	}
 
+/* module state saved in checkpoints, see checkpoint.c */
+#define STATE(_name_)							\
+	static __attribute__((constructor)) void __s_ ## _name_(void)	\
+	{								\
+		register_state(#_name_, _name_ ## _save,		\
+			       _name_ ## _restore);			\
+	}
+
 #define FATAL(_fmt, args...)				\
 	do {						\
 		fprintf(stderr, PFX _fmt, ##args);      \
@@ -168,8 +187,8 @@ struct ltt_module {
 #define TDIAG(_name, _clock,  _fmt, args...)				\
 	do {								\
 		if (diag) {						\
-			fprintf(stderr, PFX "%s\t@%.0f ns :",		\
-				(_name), (_clock)*1000000000);		\
+			fprintf(stderr, PFX "%s\t@%" PRIu64 " ns :",	\
+				(_name), (uint64_t)(_clock));		\
 			fprintf(stderr, _fmt, ##args);			\
 		}							\
 	} while (0)
@@ -179,14 +198,63 @@ extern int diag;
 extern int gtkwave_parrot;
 extern int show_cpu_switch;
 extern int do_stats;
+extern int single_pass;
+extern int parallel_decode;
+extern int native_decode;
+extern int discovery_cache;
+/* time window, in seconds from the trace start; unset when negative */
+extern double window_from;
+extern double window_to;
+extern double window_last;
+extern double follow_interval;
+extern double checkpoint_interval;
+extern int checkpoint_resume;
+extern int shard_count;
+extern int pipeline;
+extern uint64_t memory_limit;
+extern int filter_enabled;
+extern int nb_hosts;
+extern char *sync_event;
 enum {
 	STAT_IRQ = 1,
 	STAT_SOFTIRQ = 2,
+	STAT_PIPELINE = 4,
 };
 extern int atag_enabled;
 
+void lost_summary(void);
+void lost_free(void);
 void irq_stats(void);
 void softirq_stats(void);
+void pipeline_stats(void);
+void pipeline_free(void);
+
+void filter_add_events(const char *globs);
+void filter_exclude_events(const char *globs);
+void filter_add_comms(const char *globs);
+void filter_add_cpus(const char *list);
+void filter_add_tids(const char *list);
+void filter_add_tgids(const char *list);
+int filter_event(const char *name);
+int filter_cpu(int cpu);
+int filter_task(int tid, int tgid, const char *comm);
+
+int archive_is_archive(const char *path);
+size_t archive_base_len(const char *path);
+int archive_count(void);
+const char *archive_open(const char *path);
+void archive_close(void);
+
+void host_add(const char *arg);
+void host_init(const char *dir);
+void host_free(void);
+const char *host_dir(int host);
+const char *host_name(int host);
+void host_adjust_offset(int host, int64_t delta);
+uint64_t host_clock(int host, uint64_t timestamp);
+uint64_t host_bias(void);
+int host_cpu_id(int host, int cpu);
+int host_cpu(int cpu);
 
 void atag_init(const char *name);
 char *atag_get(uint32_t addr);
@@ -198,18 +266,95 @@ void init_trace(struct ltt_trace *tr,
 		double pos,
 		uint32_t flags,
 		const char *fmt, ...);
+void release_trace_name(struct ltt_trace *tr);
+void retire_trace(struct ltt_trace *tr);
 void refresh_name(struct ltt_trace *tr,
 		  const char *fmt, ...);
 void symbol_flush(void);
+void symbol_set_lazy(void);
+#define FNV1A_SEED                (0xcbf29ce484222325ULL)
+uint64_t fnv1a(uint64_t h, const void *data, size_t len);
+
+/* where emit_trace() and emit_clock() go, see symbol_set_emit() */
+enum emit_mode {
+	EMIT_FST,
+	EMIT_STATE,
+	EMIT_RECORD,
+	EMIT_PIPELINE,
+};
+
+/* a value change on its way to the FST writer */
+struct value_change {
+	int       op;
+	int       handle;
+	uint32_t  len;
+	uint64_t  time;
+	char      data[];
+};
 
+void symbol_set_emit(enum emit_mode mode, FILE *fp);
+int symbol_record_failed(void);
 void emit_trace(struct ltt_trace *tr, union ltt_value value, ...);
+
+/* string values formatted once, see intern_string() */
+struct ltt_string {
+	uint64_t  hash;
+	uint32_t  len;
+	char      str[];
+};
+
+const struct ltt_string *intern_string(const char *s);
+const struct ltt_string *intern_format(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+void intern_free(void);
+void emit_interned(struct ltt_trace *tr, const struct ltt_string *s);
+
+/* typed emit_trace(), without formatting unless asked to */
+void emit_str(struct ltt_trace *tr, const char *s, size_t len);
+void emit_fmt(struct ltt_trace *tr, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
 struct ltt_trace *trace_head(void);
-void emit_clock(double clock);
+void emit_clock(uint64_t clock);
 void save_dump_init(const char *name);
+void save_dump_flush(void);
+void save_dump_set_pack(const char *name, const char *level);
+unsigned long save_dump_budget_flushes(void);
 void save_dump_close(void);
+int save_dump_checkpoint(FILE *fp);
+void save_dump_resume(const char *name, FILE *fp);
+void save_dump_replay(FILE *fp);
+void save_dump_write(const struct value_change *vc);
+
+void register_state(const char *name, void (*save)(FILE *fp),
+		    void (*restore)(FILE *fp));
+void state_put(FILE *fp, const void *data, size_t len);
+void state_get(FILE *fp, void *data, size_t len);
+void state_put_str(FILE *fp, const char *s);
+void state_get_str(FILE *fp, char *buf, size_t size);
+void state_error(const char *what);
+void state_save_all(FILE *fp);
+void state_restore_all(FILE *fp);
+void checkpoint_init(const char *trace, const char *outfile);
+int checkpoint_resuming(void);
+uint64_t checkpoint_restore(void);
+void checkpoint_event(uint64_t ts);
+void checkpoint_done(void);
+
+void shard_init(void);
+void shard_range(uint64_t begin, uint64_t end);
+int shard_tracking(void);
+void shard_event(uint64_t ts);
+int shard_pass(int rebase_clock);
+
+void pipeline_start_writer(void);
+void pipeline_stop_writer(void);
+struct value_change *pipeline_reserve(uint32_t len);
+void pipeline_commit(void);
+void pipeline_drain(void);
 
 struct task *get_current_task(int cpu);
 struct task *find_or_add_task(const char *comm, int pid);
+void task_set_single_pass(void);
 
 void parse_init(void);
 int parse_line(char *line, struct parse_result *res);
@@ -217,29 +362,46 @@ int parse_line(char *line, struct parse_result *res);
 const struct ltt_module *find_module_by_name(const char *name);
 void register_module(const char *name, void (*process)(const char *modname,
 						       int pass,
-						       double clock,
+						       uint64_t clock,
 						       int cpu,
 						       void *args));
 void unregister_modules(void);
 void display_modules(void);
 
+void savefile_retire(const struct ltt_trace *tr);
 void write_savefile(const char *name);
 void scan_lttng_trace(const char *nam, int rebase_clock);
+uint64_t get_event_clock(void);
+int get_event_host(void);
+
+/* handle on an event field, remembers where the field was last found */
+struct arg_field {
+	const char *name;
+	int         index;
+	/* decoder owned name of the field found last */
+	const char *match;
+};
+
+#define ARG_FIELD(_name)    {.name = (_name), .index = 0, .match = NULL}
 
 int get_arg(void *args, const char *name, struct arg_value *value);
 int64_t get_arg_i64(void *args, const char *name);
 uint64_t get_arg_u64(void *args, const char *name);
 const char *get_arg_str(void *args, const char *name);
+int get_field(void *args, struct arg_field *field, struct arg_value *value);
+int64_t get_field_i64(void *args, struct arg_field *field);
+uint64_t get_field_u64(void *args, struct arg_field *field);
+const char *get_field_str(void *args, struct arg_field *field);
 void for_each_arg(void *args,
 		  void (*pfn)(void *cookie,
 			      const char *name,
 			      const struct arg_value *value),
 		  void *cookie);
 
-void set_cpu_idle(double clock, int cpu);
-void set_cpu_running(double clock, int cpu);
-void cpu_preempt(double clock, int cpu);
-void cpu_unpreempt(double clock, int cpu);
+void set_cpu_idle(uint64_t clock, int cpu);
+void set_cpu_running(uint64_t clock, int cpu);
+void cpu_preempt(uint64_t clock, int cpu);
+void cpu_unpreempt(uint64_t clock, int cpu);
 void init_cpu(int cpu);
 
 void symbol_clean_name(char *name);
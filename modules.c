@@ -72,7 +72,7 @@ void display_modules(void)
 
 void register_module(const char *name, void (*process)(const char *modname,
 						       int pass,
-						       double clock,
+						       uint64_t clock,
 						       int cpu,
 						       void *args))
 {
@@ -0,0 +1,349 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "ctf.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+
+/*
+ * Conversion pipeline: decoding, module dispatch and FST writing run in
+ * three threads, connected by single-producer single-consumer rings. Ring
+ * positions are only updated with atomics. A side that finds the ring full or
+ * empty raises its flag and sleeps on its semaphore, the other side posts it
+ * when it clears the flag. The flag is raised before the ring is checked
+ * again, so a post always follows a position update that the sleeper may have
+ * missed: a wake up is never lost, and the hot path takes no lock. A
+ * semaphore, unlike a condition variable, keeps a post made before the
+ * sleeper reaches sem_wait().
+ */
+
+#define RING_BYTES                (1024*1024)
+/* header of each ring record, marks the unused end of the ring */
+#define RING_PAD                  (UINT64_MAX)
+
+struct ring {
+	const char      *name;
+	char            *buf;
+	size_t           head;     /* consumer position */
+	size_t           tail;     /* producer position */
+	size_t           reserved;
+	int              done;
+	int              producer_waits;
+	int              consumer_waits;
+	sem_t            not_full;
+	sem_t            not_empty;
+	/* occupancy stats */
+	uint64_t         records;
+	uint64_t         fill;
+	uint64_t         full;
+	uint64_t         empty;
+	double           full_time;
+	double           empty_time;
+};
+
+int pipeline;
+
+static struct ring events = {.name = "decode -> dispatch"};
+static struct ring values = {.name = "dispatch -> write"};
+static pthread_t writer;
+
+static size_t load(size_t *pos)
+{
+	return __atomic_load_n(pos, __ATOMIC_SEQ_CST);
+}
+
+static void store(size_t *pos, size_t val)
+{
+	__atomic_store_n(pos, val, __ATOMIC_SEQ_CST);
+}
+
+static int flag(int *flag)
+{
+	return __atomic_load_n(flag, __ATOMIC_SEQ_CST);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static void ring_init(struct ring *r)
+{
+	if (!r->buf) {
+		r->buf = malloc(RING_BYTES);
+		assert(r->buf);
+		sem_init(&r->not_full, 0, 0);
+		sem_init(&r->not_empty, 0, 0);
+	}
+	r->head = r->tail = 0;
+	r->done = 0;
+	r->producer_waits = r->consumer_waits = 0;
+}
+
+static void ring_free(struct ring *r)
+{
+	if (!r->buf)
+		return;
+	sem_destroy(&r->not_full);
+	sem_destroy(&r->not_empty);
+	free(r->buf);
+	r->buf = NULL;
+}
+
+static void ring_sleep(sem_t *sem)
+{
+	while (sem_wait(sem) && (errno == EINTR))
+		;
+}
+
+/* whoever clears the flag of a sleeping side wakes it up */
+static void ring_wake(int *waits, sem_t *sem)
+{
+	if (__atomic_exchange_n(waits, 0, __ATOMIC_SEQ_CST))
+		sem_post(sem);
+}
+
+/* no need to sleep after all, but the other side may be posting already */
+static void ring_cancel(int *waits, sem_t *sem)
+{
+	if (!__atomic_exchange_n(waits, 0, __ATOMIC_SEQ_CST))
+		ring_sleep(sem);
+}
+
+/* producer side: room for len bytes, not visible until ring_commit() */
+static void *ring_reserve(struct ring *r, size_t len)
+{
+	size_t need = (sizeof(uint64_t)+len+7) & ~(size_t)7;
+	size_t pos = r->tail % RING_BYTES;
+	size_t total = need;
+	double start;
+
+	/* records do not wrap: pad the end of the ring */
+	if (RING_BYTES-pos < need)
+		total += RING_BYTES-pos;
+
+	if (RING_BYTES-(r->tail-load(&r->head)) < total) {
+		start = now();
+		r->full++;
+		do {
+			__atomic_store_n(&r->producer_waits, 1,
+					 __ATOMIC_SEQ_CST);
+			if (RING_BYTES-(r->tail-load(&r->head)) >= total) {
+				ring_cancel(&r->producer_waits, &r->not_full);
+				break;
+			}
+			ring_sleep(&r->not_full);
+		} while (RING_BYTES-(r->tail-load(&r->head)) < total);
+		r->full_time += now()-start;
+	}
+
+	if (total != need) {
+		*(uint64_t *)&r->buf[pos] = RING_PAD;
+		pos = 0;
+	}
+	*(uint64_t *)&r->buf[pos] = need;
+	r->reserved = total;
+	return &r->buf[pos+sizeof(uint64_t)];
+}
+
+static void ring_commit(struct ring *r)
+{
+	r->records++;
+	r->fill += r->tail-load(&r->head);
+	store(&r->tail, r->tail+r->reserved);
+	if (flag(&r->consumer_waits))
+		ring_wake(&r->consumer_waits, &r->not_empty);
+}
+
+static void ring_finish(struct ring *r)
+{
+	__atomic_store_n(&r->done, 1, __ATOMIC_SEQ_CST);
+	ring_wake(&r->consumer_waits, &r->not_empty);
+}
+
+/* consumer side: oldest record, NULL once the producer is done */
+static void *ring_peek(struct ring *r)
+{
+	size_t pos;
+	uint64_t hdr;
+	double start;
+
+	for (;;) {
+		if (r->head == load(&r->tail)) {
+			if (flag(&r->done) && (r->head == load(&r->tail)))
+				return NULL;
+			start = now();
+			r->empty++;
+			__atomic_store_n(&r->consumer_waits, 1,
+					 __ATOMIC_SEQ_CST);
+			if ((r->head != load(&r->tail)) || flag(&r->done))
+				ring_cancel(&r->consumer_waits,
+					    &r->not_empty);
+			else
+				ring_sleep(&r->not_empty);
+			r->empty_time += now()-start;
+			continue;
+		}
+		pos = r->head % RING_BYTES;
+		hdr = *(uint64_t *)&r->buf[pos];
+		if (hdr != RING_PAD)
+			return &r->buf[pos+sizeof(uint64_t)];
+		store(&r->head, r->head+RING_BYTES-pos);
+	}
+}
+
+static void ring_release(struct ring *r)
+{
+	uint64_t hdr = *(uint64_t *)&r->buf[r->head % RING_BYTES];
+
+	store(&r->head, r->head+hdr);
+	/* let the producer refill half the ring at once */
+	if (flag(&r->producer_waits) &&
+	    (load(&r->tail)-r->head <= RING_BYTES/2))
+		ring_wake(&r->producer_waits, &r->not_full);
+}
+
+/* wait for the consumer to take every record */
+static void ring_drain(struct ring *r)
+{
+	while (load(&r->head) != r->tail)
+		sched_yield();
+}
+
+/* decode stage: events are copied out, the iterator moves on right away */
+struct decode_stage {
+	struct bt_ctf_iter  *iter;
+	const char          *name;
+	struct decode_cache *cache;
+};
+
+static void decode_stage_event(struct bt_ctf_event *ctf_event, void *cookie)
+{
+	struct decode_stage *ds = cookie;
+	struct event_record *rec;
+
+	rec = ring_reserve(&events, sizeof(*rec));
+	/* events without module never leave the stage */
+	if (decode_event(ctf_event, rec, ds->cache) == 0) {
+		record_keep_strings(rec);
+		ring_commit(&events);
+	}
+}
+
+static void *decode_stage(void *arg)
+{
+	struct decode_stage *ds = arg;
+
+	iterate_events(ds->iter, ds->name, decode_stage_event, ds);
+	ring_finish(&events);
+	return NULL;
+}
+
+/* serial decoding in its own thread, dispatched in the calling thread */
+void pipeline_process_events(struct bt_ctf_iter *iter, const char *name,
+			     struct decode_cache *cache, int pass,
+			     int rebase_clock)
+{
+	int ret;
+	pthread_t thread;
+	struct event_record *rec;
+	struct decode_stage ds = {iter, name, cache};
+
+	ring_init(&events);
+	ret = pthread_create(&thread, NULL, decode_stage, &ds);
+	if (ret)
+		FATAL("cannot create decoder thread: %s\n", strerror(ret));
+
+	while ((rec = ring_peek(&events))) {
+		dispatch_event(rec, pass, rebase_clock);
+		ring_release(&events);
+	}
+	pthread_join(thread, NULL);
+}
+
+/* write stage: value changes go to the FST writer in emission order */
+static void *write_stage(void *arg)
+{
+	struct value_change *vc;
+
+	while ((vc = ring_peek(&values))) {
+		save_dump_write(vc);
+		ring_release(&values);
+	}
+	return NULL;
+}
+
+void pipeline_start_writer(void)
+{
+	int ret;
+
+	ring_init(&values);
+	ret = pthread_create(&writer, NULL, write_stage, NULL);
+	if (ret)
+		FATAL("cannot create writer thread: %s\n", strerror(ret));
+	symbol_set_emit(EMIT_PIPELINE, NULL);
+}
+
+void pipeline_stop_writer(void)
+{
+	symbol_set_emit(EMIT_FST, NULL);
+	ring_finish(&values);
+	pthread_join(writer, NULL);
+}
+
+struct value_change *pipeline_reserve(uint32_t len)
+{
+	return ring_reserve(&values, sizeof(struct value_change)+len);
+}
+
+void pipeline_commit(void)
+{
+	ring_commit(&values);
+}
+
+/* the FST writer is idle until the next value change */
+void pipeline_drain(void)
+{
+	ring_drain(&values);
+}
+
+static void ring_stats(struct ring *r)
+{
+	if (!r->records)
+		return;
+	DIAG("%s: %" PRIu64 " records, %.1f%% full on average\n", r->name,
+	     r->records, 100.0*r->fill/r->records/RING_BYTES);
+	DIAG("  producer blocked %" PRIu64 " times (%f s), consumer starved "
+	     "%" PRIu64 " times (%f s)\n", r->full, r->full_time, r->empty,
+	     r->empty_time);
+}
+
+void pipeline_stats(void)
+{
+	if (!(do_stats & STAT_PIPELINE) || !pipeline)
+		return;
+
+	DIAG("pipeline stat\n");
+	ring_stats(&events);
+	ring_stats(&values);
+}
+
+void pipeline_free(void)
+{
+	ring_free(&events);
+	ring_free(&values);
+}
@@ -24,8 +24,25 @@ static unsigned int count_traces(void)
 
 static int compare_traces(const void *t1, const void *t2)
 {
-	double d = (*(struct ltt_trace **)t1)->pos-
-		(*(struct ltt_trace **)t2)->pos;
+	const struct ltt_trace *tr1 = *(struct ltt_trace **)t1;
+	const struct ltt_trace *tr2 = *(struct ltt_trace **)t2;
+	double d = tr1->pos-tr2->pos;
+
+	/* merged hosts are shown one after the other */
+	if (tr1->host != tr2->host)
+		return tr1->host-tr2->host;
+	/*
+	 * Same position (e.g. one IRQ on several CPUs): the trace list is in
+	 * reverse creation order. With -j, pass 1 creates traces out of time
+	 * order: sort them the way a serial pass 1 would have created them.
+	 * Traces created at the same timestamp were created in babeltrace's
+	 * heap order, which is lost: they are sorted by name.
+	 */
+	if ((d == 0.0) && parallel_decode) {
+		if (tr1->created != tr2->created)
+			return (tr1->created < tr2->created) ? 1 : -1;
+		return strcmp(tr1->fst_name, tr2->fst_name);
+	}
 	return (d > 0.0) ? 1 : ((d < 0.0) ? -1 : 0);
 }
 
@@ -47,48 +64,99 @@ static void sort_traces(enum trace_group group, struct ltt_trace **tab,
 	*len = n;
 }
 
-static void print_group(enum trace_group group, const char *name, FILE *fp,
+static const char *const group_name[] = {
+	[TG_IRQ]     = "Interrupts",
+	[TG_MM]      = "Memory Management",
+	[TG_GLOBAL]  = "Global Info",
+	[TG_USER]    = "User Info",
+	[TG_PROCESS] = "Processes",
+};
+
+/* lines of the traces retired before the end, see savefile_retire() */
+static FILE *retired[TG_PROCESS+1];
+
+static void print_trace(FILE *fp, const struct ltt_trace *tr)
+{
+	unsigned int flag = 0;
+
+	flag |= (tr->flags & TRACE_SYM_F_BITS) ?    TR_BIN : 0;
+	flag |= (tr->flags & TRACE_SYM_F_INTEGER) ? TR_HEX : 0;
+	flag |= (tr->flags & TRACE_SYM_F_STRING) ?  TR_ASCII : 0;
+
+	/* overrides */
+	if (tr->flags == TRACE_SYM_F_ANALOG) {
+		flag = (TR_ANALOG_INTERPOLATED|
+			TR_DEC|
+			TR_ANALOG_FULLSCALE);
+	}
+
+	fprintf(fp, "@%x\n%s.", flag|TR_RJUSTIFY, group_name[tr->group]);
+	if (host_name(tr->host))
+		fprintf(fp, "%s.", host_name(tr->host));
+	fprintf(fp, "%s%s\n", tr->fst_name,
+		(tr->flags == TRACE_SYM_F_U16) ? "[0:15]" : "");
+}
+
+/*
+ * A trace about to be freed (dead tasks, see evict_task()) leaves its line
+ * in a temporary file: retired traces are shown after the others of their
+ * group, in the order they went.
+ */
+void savefile_retire(const struct ltt_trace *tr)
+{
+	if ((tr->group == TG_NONE) || (tr->group > TG_PROCESS))
+		return;
+	if (!retired[tr->group]) {
+		retired[tr->group] = tmpfile();
+		if (retired[tr->group] == NULL)
+			FATAL("cannot create temporary file: %s\n",
+			      strerror(errno));
+	}
+	print_trace(retired[tr->group], tr);
+}
+
+static void print_retired(enum trace_group group, FILE *fp)
+{
+	char buf[4096];
+	size_t len;
+
+	rewind(retired[group]);
+	while ((len = fread(buf, 1, sizeof(buf), retired[group])) > 0)
+		fwrite(buf, 1, len, fp);
+	fclose(retired[group]);
+	retired[group] = NULL;
+}
+
+static void print_group(enum trace_group group, FILE *fp,
 			struct ltt_trace **tab)
 {
 	int i, tablen;
-	unsigned int flag;
 
 	sort_traces(group, tab, &tablen);
-	if (tablen <= 0)
+	if ((tablen <= 0) && !retired[group])
 		return;
 
-	fprintf(fp, "@%x\n-%s\n", TR_BLANK, name);
-
-	for (i = 0; i < tablen; i++) {
-		flag = 0;
-		flag |= (tab[i]->flags & TRACE_SYM_F_BITS) ?    TR_BIN : 0;
-		flag |= (tab[i]->flags & TRACE_SYM_F_INTEGER) ? TR_HEX : 0;
-		flag |= (tab[i]->flags & TRACE_SYM_F_STRING) ?  TR_ASCII : 0;
+	fprintf(fp, "@%x\n-%s\n", TR_BLANK, group_name[group]);
 
-		/* overrides */
-		if (tab[i]->flags == TRACE_SYM_F_ANALOG) {
-			flag = (TR_ANALOG_INTERPOLATED|
-				TR_DEC|
-				TR_ANALOG_FULLSCALE);
-		}
-
-		fprintf(fp, "@%x\n%s.%s%s\n", flag|TR_RJUSTIFY,
-			name, tab[i]->fst_name,
-			(tab[i]->flags == TRACE_SYM_F_U16) ? "[0:15]" : "");
-	}
+	for (i = 0; i < tablen; i++)
+		print_trace(fp, tab[i]);
+	if (retired[group])
+		print_retired(group, fp);
 }
 
 void write_savefile(const char *name)
 {
 	unsigned int ntraces;
 	struct ltt_trace **tab;
+	enum trace_group group;
 	FILE *fp;
 
+	/* dead tasks are the only traces retired */
 	ntraces = count_traces();
-	if (ntraces == 0)
+	if ((ntraces == 0) && !retired[TG_PROCESS])
 		return;
 
-	tab = malloc(ntraces*sizeof(struct ltt_trace *));
+	tab = malloc((ntraces+1)*sizeof(struct ltt_trace *));
 	assert(tab);
 
 	fp = fopen(name, "wb");
@@ -98,11 +166,8 @@ void write_savefile(const char *name)
 
 	INFO("writing SAV file '%s'...\n", name);
 
-	print_group(TG_IRQ, "Interrupts", fp, tab);
-	print_group(TG_MM, "Memory Management", fp, tab);
-	print_group(TG_GLOBAL, "Global Info", fp, tab);
-	print_group(TG_USER, "User Info", fp, tab);
-	print_group(TG_PROCESS, "Processes", fp, tab);
+	for (group = TG_IRQ; group <= TG_PROCESS; group++)
+		print_group(group, fp, tab);
 
 	free(tab);
 	fclose(fp);
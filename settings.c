@@ -0,0 +1,29 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+
+/*
+ * Conversion settings, with their defaults. The command line of lttng2lxt.c
+ * and the parameters of the babeltrace 2 sink both set them.
+ */
+
+int verbose;
+int diag;
+int gtkwave_parrot = 1;
+int show_cpu_switch = 1;
+int do_stats = 0;
+int single_pass;
+int parallel_decode;
+int native_decode;
+double window_from = -1.0;
+double window_to = -1.0;
+double window_last = -1.0;
+double follow_interval;
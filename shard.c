@@ -0,0 +1,200 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+#include "lttng2lxt.h"
+#include "ctf.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/*
+ * Time shards of pass 2. Module state at a given time only depends on the
+ * events before it: pass 1 also runs the pass 2 state machine, emitting
+ * nothing, and snapshots it at fixed time boundaries. Pass 1 merges the
+ * per-stream decoders (-j) in pass 2 order, and the snapshots hold the merge
+ * position, see merge_save(). Each shard converts its time range in a child
+ * process from its snapshot, and records its value changes. The records are
+ * replayed in time order on the FST writer, which gets the calls of a serial
+ * pass 2: the output is the same, same timestamp events included.
+ */
+
+/* exit status of a shard emitting a trace pass 1 did not declare */
+#define SHARD_UNDECLARED          (2)
+
+struct shard {
+	uint64_t  ts;      /* first timestamp of the shard */
+	char     *state;   /* module state before ts */
+	size_t    size;
+	FILE     *record;
+	pid_t     pid;
+};
+
+int shard_count;
+
+static struct shard shards[MAX_SHARDS];
+static int nb_shards;
+static int tracking;
+static uint64_t range_begin;
+static uint64_t range_step;
+static int boundary;
+static uint64_t next_ts;
+
+/* start tracking pass 2 state */
+void shard_init(void)
+{
+	if (shard_count > MAX_SHARDS)
+		shard_count = MAX_SHARDS;
+	boundary = 0;
+	next_ts = 0;
+	tracking = 1;
+	symbol_set_emit(EMIT_STATE, NULL);
+}
+
+/* boundaries over [begin, end], known once pass 1 has opened the streams */
+void shard_range(uint64_t begin, uint64_t end)
+{
+	range_begin = begin;
+	range_step = (end-begin)/shard_count;
+}
+
+int shard_tracking(void)
+{
+	return tracking;
+}
+
+/* called with the timestamp of each pass 1 event, before decoding it */
+void shard_event(uint64_t ts)
+{
+	FILE *fp;
+	struct shard *sh;
+
+	if (ts < next_ts)
+		return;
+
+	sh = &shards[nb_shards++];
+	sh->ts = ts;
+	fp = open_memstream(&sh->state, &sh->size);
+	assert(fp);
+	state_save_all(fp);
+	fclose(fp);
+
+	/* boundaries without events in between make a single shard */
+	do {
+		boundary++;
+	} while ((boundary < shard_count) &&
+		 (range_begin+boundary*range_step <= ts));
+	next_ts = (boundary < shard_count) ?
+		range_begin+boundary*range_step : UINT64_MAX;
+}
+
+static void restore_state(struct shard *sh)
+{
+	FILE *fp;
+
+	fp = fmemopen(sh->state, sh->size, "rb");
+	assert(fp);
+	state_restore_all(fp);
+	fclose(fp);
+}
+
+static void run_shard(int i, int rebase_clock)
+{
+	int fd;
+	struct shard *sh = &shards[i];
+	uint64_t end = (i+1 < nb_shards) ? shards[i+1].ts : UINT64_MAX;
+
+	/* pass 1 has reported pass 2 diagnostics already, in order */
+	fd = open("/dev/null", O_WRONLY);
+	if (fd >= 0) {
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+
+	/* the merge goes on from the snapshot, up to the next shard */
+	restore_state(sh);
+	symbol_set_emit(EMIT_RECORD, sh->record);
+	parallel_process_events(2, rebase_clock, end);
+
+	/* the parent owns stdio buffers and archives, do not flush them */
+	if (symbol_record_failed())
+		_exit(SHARD_UNDECLARED);
+	if (fflush(sh->record) || ferror(sh->record))
+		_exit(1);
+	_exit(0);
+}
+
+static int wait_shard(int i)
+{
+	int status;
+
+	if ((waitpid(shards[i].pid, &status, 0) < 0) || !WIFEXITED(status)) {
+		INFO("shard %d died\n", i);
+		return -1;
+	}
+	if (WEXITSTATUS(status) == SHARD_UNDECLARED) {
+		INFO("shard %d emits traces pass 1 did not declare\n", i);
+		return -1;
+	}
+	/* errors are reported again by the serial pass 2 */
+	return WEXITSTATUS(status) ? -1 : 0;
+}
+
+/* convert pass 2 in shards, -1 when it has to be done serially instead */
+int shard_pass(int rebase_clock)
+{
+	int i, ret = 0;
+	struct shard *sh;
+
+	tracking = 0;
+	symbol_set_emit(EMIT_FST, NULL);
+
+	if (nb_shards > 1) {
+		INFO("converting %d time shards\n", nb_shards);
+		fflush(stdout);
+		fflush(stderr);
+		for (i = 0; i < nb_shards; i++) {
+			sh = &shards[i];
+			sh->record = tmpfile();
+			if (!sh->record)
+				FATAL("cannot create shard record: %s\n",
+				      strerror(errno));
+			sh->pid = fork();
+			if (sh->pid < 0)
+				FATAL("cannot fork: %s\n", strerror(errno));
+			if (sh->pid == 0)
+				run_shard(i, rebase_clock);
+		}
+		for (i = 0; i < nb_shards; i++)
+			ret |= wait_shard(i);
+
+		/* nothing reaches the writer unless every shard made it */
+		for (i = 0; i < nb_shards; i++) {
+			if (!ret) {
+				rewind(shards[i].record);
+				save_dump_replay(shards[i].record);
+			}
+			fclose(shards[i].record);
+		}
+	} else {
+		ret = -1;
+	}
+
+	/* a serial pass 2 starts from the state pass 1 began with */
+	if (ret) {
+		INFO("converting pass 2 serially\n");
+		if (nb_shards)
+			restore_state(&shards[0]);
+	}
+
+	for (i = 0; i < nb_shards; i++)
+		free(shards[i].state);
+	nb_shards = 0;
+	return ret;
+}
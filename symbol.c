@@ -15,6 +15,76 @@ static void *fst_ctx;
 static struct ltt_trace *head;
 static int symbol_flushed;
 static const char *out_name;
+static int first_emit = 1;
+static uint64_t last_clock;
+static enum emit_mode emit_mode;
+static FILE *record_fp;
+static int record_failed;
+/* bit traces created after symbol_flush(), declared at the next time change */
+static struct ltt_trace **late;
+static unsigned int nb_late, late_max;
+/* bytes given to the FST writer since it last wrote a block */
+static uint64_t unflushed;
+static unsigned long budget_flushes;
+/* emissions identical to the last value of their trace */
+static unsigned long redundant;
+
+uint64_t memory_limit;
+
+/* FST pack types of value change blocks, by --pack name */
+static const struct {
+	const char *name;
+	int         type;
+	int         max_level;
+} pack_types[] = {
+	{"zlib",   FST_WR_PT_ZLIB,   9},
+	{"fastlz", FST_WR_PT_FASTLZ, 2},
+	/* the lz4 level is its acceleration: higher is faster and larger */
+	{"lz4",    FST_WR_PT_LZ4,    65537},
+	{"zstd",   FST_WR_PT_ZSTD,   22},
+};
+static int pack_type = FST_WR_PT_LZ4;
+static int pack_level;
+
+/*
+ * Interned strings: info traces repeat a small set of values all along. Each
+ * one is formatted, measured and hashed once, in a table keyed by content.
+ */
+#define INTERN_MIN_SLOTS          (1024)
+/* beyond this, intern_format() no longer adds strings */
+#define INTERN_MAX                (65536)
+
+static const struct ltt_string **interned;
+static uint32_t intern_slots;
+static uint32_t intern_count;
+
+/* value change operations, see symbol_set_emit() */
+#define RECORD_TIME               ('T')
+#define RECORD_VALUE              ('V')
+#define RECORD_STRING             ('S')
+
+/* writer memory per value change besides its value, roughly */
+#define VALUE_OVERHEAD            (8)
+/*
+ * Part of --max-memory for value changes buffered by the FST writer: a block
+ * is compressed in a scratch buffer of the same size, and the rest is left
+ * to the decoder and the modules.
+ */
+#define WRITER_SHARE              (4)
+
+/* FST scope of each trace group, in declaration order */
+static const struct {
+	enum trace_group  group;
+	enum fstScopeType type;
+	const char       *name;
+} group_scope[] = {
+	{TG_NONE,    FST_ST_VCD_CLASS,         "All Info"},
+	{TG_GLOBAL,  FST_ST_VCD_PACKAGE,       "Global Info"},
+	{TG_IRQ,     FST_ST_VHDL_IF_GENERATE,  "Interrupts"},
+	{TG_MM,      FST_ST_VCD_PACKAGE,       "Memory Management"},
+	{TG_USER,    FST_ST_VCD_STRUCT,        "User Info"},
+	{TG_PROCESS, FST_ST_VCD_TASK,          "Processes"},
+};
 
 void symbol_clean_name(char *name)
 {
@@ -27,12 +97,6 @@ void symbol_clean_name(char *name)
 	}
 }
 
-struct fst_symbol_list {
-	fstHandle symbol;
-	char *name;
-	struct fst_symbol_list *next;
-};
-
 char *get_fst_clean_name(const char *name)
 {
 	static char clean_name[1024];
@@ -60,17 +124,10 @@ void insert_symbol(struct ltt_trace *tr)
 {
 	int vartype;
 	int len = 1;
-	struct fst_symbol_list *tmp;
 
-	if (tr->fst_handle != 0)
+	if ((tr->fst_handle != 0) || tr->filtered)
 		return;
 
-	tmp = (struct fst_symbol_list *)calloc(1, sizeof(struct fst_symbol_list));
-	if (tmp == NULL) {
-		fprintf(stderr, "Allocation error creatinf fymbols list\n");
-		return;
-	}
-	tmp->name = strdup(tr->name);
 	tr->fst_name = strdup(get_fst_clean_name(tr->name));
 	switch (tr->flags) {
 	case TRACE_SYM_F_BITS:
@@ -95,10 +152,8 @@ void insert_symbol(struct ltt_trace *tr)
 		assert(0);
 	}
 
-	tmp->symbol = fstWriterCreateVar(fst_ctx, vartype,
-					 FST_VD_IMPLICIT,
-					 len, tr->fst_name, 0);
-	tr->fst_handle = tmp->symbol;
+	tr->fst_handle = fstWriterCreateVar(fst_ctx, vartype, FST_VD_IMPLICIT,
+					    len, tr->fst_name, 0);
 	if (tr->fst_handle == 0)
 		fprintf(stderr, "Failed to add fst symbol for '%s'\n", tr->name);
 }
@@ -116,6 +171,8 @@ void init_trace(struct ltt_trace *tr,
 
 		tr->flags = flags;
 		tr->group = group;
+		tr->host = get_event_host();
+		tr->created = get_event_clock();
 		tr->pos = pos;
 		tr->next = head;
 		head = tr;
@@ -128,9 +185,19 @@ void init_trace(struct ltt_trace *tr,
 
 		INFO("adding trace '%s' group=%d pos=%g\n", linebuf, group,
 		     pos);
-		if (symbol_flushed)
-			/* XXX hack late symbol flush */
-			insert_symbol(tr);
+		/*
+		 * Late traces are declared on first emission, except bit
+		 * traces: they start at "z" from their creation, as they would
+		 * with two passes.
+		 */
+		if (symbol_flushed && (flags == TRACE_SYM_F_BITS)) {
+			if (nb_late == late_max) {
+				late_max = late_max ? 2*late_max : 16;
+				late = realloc(late, late_max*sizeof(*late));
+				assert(late);
+			}
+			late[nb_late++] = tr;
+		}
 	}
 }
 
@@ -148,60 +215,345 @@ void refresh_name(struct ltt_trace *tr,
 
 	if (strcmp(tr->name, linebuf)) {
 		INFO("refreshing %s -> %s\n", tr->name, linebuf);
-		free((char *)tr->name);
+		if (tr->name != tr->fst_name)
+			free((char *)tr->name);
 		tr->name = strdup(linebuf);
 	}
 }
 
-void insert_amm_symbols(unsigned int group)
+/* a declared trace can do with the name it has in the FST file */
+void release_trace_name(struct ltt_trace *tr)
+{
+	if (!tr->fst_handle || (tr->name == tr->fst_name))
+		return;
+	free((char *)tr->name);
+	tr->name = tr->fst_name;
+}
+
+/*
+ * A trace that will not be emitted again leaves the trace list, and its
+ * savefile line goes aside. The caller frees the trace itself.
+ */
+void retire_trace(struct ltt_trace *tr)
+{
+	struct ltt_trace **p;
+	unsigned int i;
+
+	for (p = &head; *p; p = &(*p)->next) {
+		if (*p == tr) {
+			*p = tr->next;
+			break;
+		}
+	}
+	/* created by the event being processed, not declared yet */
+	for (i = 0; i < nb_late; i++) {
+		if (late[i] == tr) {
+			memmove(&late[i], &late[i+1],
+				(nb_late-i-1)*sizeof(*late));
+			nb_late--;
+			break;
+		}
+	}
+	if (tr->emitted)
+		savefile_retire(tr);
+	if (tr->name != tr->fst_name)
+		free((char *)tr->name);
+	free((char *)tr->fst_name);
+}
+
+void insert_amm_symbols(unsigned int group, int host)
 {
 	struct ltt_trace *tr;
 	for (tr = trace_head(); tr; tr = tr->next) {
-		if (tr->group == group)
+		if ((tr->group == group) && (tr->host == host))
 			insert_symbol(tr);
 	}
 }
 
+/* merged hosts each get a scope inside the group scope */
+static void set_host_scope(int host)
+{
+	if (host_name(host))
+		fstWriterSetScope(fst_ctx, FST_ST_VCD_MODULE,
+				  host_name(host), NULL);
+}
+
+static void set_host_upscope(int host)
+{
+	if (host_name(host))
+		fstWriterSetUpscope(fst_ctx);
+}
+
 void symbol_flush(void)
 {
-	fstWriterSetScope(fst_ctx, FST_ST_VCD_CLASS, "All Info", NULL);
-	insert_amm_symbols(TG_NONE);
-	fstWriterSetUpscope(fst_ctx);
-	fstWriterSetScope(fst_ctx, FST_ST_VCD_PACKAGE, "Global Info", NULL);
-	insert_amm_symbols(TG_GLOBAL);
-	fstWriterSetUpscope(fst_ctx);
-	fstWriterSetScope(fst_ctx, FST_ST_VHDL_IF_GENERATE, "Interrupts", NULL);
-	insert_amm_symbols(TG_IRQ);
-	fstWriterSetUpscope(fst_ctx);
-	fstWriterSetScope(fst_ctx, FST_ST_VCD_PACKAGE, "Memory Management", NULL);
-	insert_amm_symbols(TG_MM);
-	fstWriterSetUpscope(fst_ctx);
-	fstWriterSetScope(fst_ctx, FST_ST_VCD_STRUCT, "User Info", NULL);
-	insert_amm_symbols(TG_USER);
-	fstWriterSetUpscope(fst_ctx);
-	fstWriterSetScope(fst_ctx, FST_ST_VCD_TASK, "Processes", NULL);
-	insert_amm_symbols(TG_PROCESS);
-	fstWriterSetUpscope(fst_ctx);
+	int i, host;
+
+	for (i = 0; i < ARRAY_SIZE(group_scope); i++) {
+		fstWriterSetScope(fst_ctx, group_scope[i].type,
+				  group_scope[i].name, NULL);
+		for (host = 0; host < nb_hosts; host++) {
+			set_host_scope(host);
+			insert_amm_symbols(group_scope[i].group, host);
+			set_host_upscope(host);
+		}
+		fstWriterSetUpscope(fst_ctx);
+	}
+	symbol_flushed = 1;
+}
+
+/*
+ * Declare a trace created after symbol_flush(): the FST writer accepts late
+ * variables, reopen the group scope so that the savefile path still matches.
+ */
+static void insert_late_symbol(struct ltt_trace *tr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(group_scope); i++) {
+		if (group_scope[i].group == tr->group) {
+			fstWriterSetScope(fst_ctx, group_scope[i].type,
+					  group_scope[i].name, NULL);
+			set_host_scope(tr->host);
+			insert_symbol(tr);
+			set_host_upscope(tr->host);
+			fstWriterSetUpscope(fst_ctx);
+			return;
+		}
+	}
+	insert_symbol(tr);
+}
+
+/* single pass mode: no discovery pass, declare every trace lazily */
+void symbol_set_lazy(void)
+{
 	symbol_flushed = 1;
 }
 
+/*
+ * Time shards convert in child processes, which cannot write to the FST
+ * writer: their emissions go to a record file instead, replayed in order by
+ * save_dump_replay(). Pass 1 tracks what emissions change without emitting
+ * anything, to take the shard snapshots. With --pipeline, emissions go to
+ * the writer thread, see pipeline.c.
+ */
+void symbol_set_emit(enum emit_mode mode, FILE *fp)
+{
+	emit_mode = mode;
+	record_fp = fp;
+	record_failed = 0;
+}
+
+/* a shard needed a trace that pass 1 did not declare */
+int symbol_record_failed(void)
+{
+	return record_failed;
+}
+
+/* bytes the FST writer reads for the variable types of insert_symbol() */
+static uint32_t value_len(const struct ltt_trace *tr)
+{
+	switch (tr->flags) {
+	case TRACE_SYM_F_BITS:
+		return 1;
+	case TRACE_SYM_F_ADDR:
+		return 4;
+	default:
+		/* reals */
+		return sizeof(double);
+	}
+}
+
+static void write_value(int op, fstHandle handle, const void *val,
+			uint32_t len)
+{
+	if (op == RECORD_STRING)
+		fstWriterEmitVariableLengthValueChange(fst_ctx, handle, val,
+						       len);
+	else
+		fstWriterEmitValueChange(fst_ctx, handle, val);
+	unflushed += len+VALUE_OVERHEAD;
+}
+
+/* with --max-memory, blocks are written before the next time change */
+static void write_time(uint64_t timeval)
+{
+	if (memory_limit && (unflushed > memory_limit/WRITER_SHARE)) {
+		fstWriterFlushContext(fst_ctx);
+		unflushed = 0;
+		budget_flushes++;
+	}
+	fstWriterEmitTimeChange(fst_ctx, timeval);
+}
+
+static void emit_value(int op, const struct ltt_trace *tr, const void *val,
+		       uint32_t len)
+{
+	struct value_change *vc;
+
+	if (emit_mode == EMIT_PIPELINE) {
+		vc = pipeline_reserve(len);
+		vc->op = op;
+		vc->handle = tr->fst_handle;
+		vc->len = len;
+		memcpy(vc->data, val, len);
+		pipeline_commit();
+	} else if (emit_mode == EMIT_RECORD) {
+		putc(op, record_fp);
+		fwrite(&tr->fst_handle, sizeof(tr->fst_handle), 1, record_fp);
+		fwrite(&len, sizeof(len), 1, record_fp);
+		fwrite(val, len, 1, record_fp);
+	} else {
+		write_value(op, tr->fst_handle, val, len);
+	}
+}
+
 void symbol_fst_initvalues(void)
 {
        struct ltt_trace *tr;
        for (tr = trace_head(); tr; tr = tr->next)
-               if (tr->flags == TRACE_SYM_F_BITS)
-                       fstWriterEmitValueChange(fst_ctx, tr->fst_handle, "z");
+               if ((tr->flags == TRACE_SYM_F_BITS) && tr->fst_handle)
+                       emit_value(RECORD_VALUE, tr, "z", 1);
 }
 
-void emit_trace(struct ltt_trace *tr, union ltt_value value, ...)
+/* slot of string s, or the free slot where it goes */
+static uint32_t intern_slot(const char *s, uint32_t len, uint64_t hash)
+{
+	uint32_t i = hash & (intern_slots-1);
+	const struct ltt_string *is;
+
+	while ((is = interned[i]) &&
+	       ((is->hash != hash) || (is->len != len) ||
+		memcmp(is->str, s, len)))
+		i = (i+1) & (intern_slots-1);
+	return i;
+}
+
+static void intern_grow(void)
+{
+	uint32_t i, old_slots = intern_slots;
+	const struct ltt_string **old = interned;
+
+	intern_slots = old_slots ? 2*old_slots : INTERN_MIN_SLOTS;
+	interned = calloc(intern_slots, sizeof(*interned));
+	assert(interned);
+	for (i = 0; i < old_slots; i++)
+		if (old[i])
+			interned[intern_slot(old[i]->str, old[i]->len,
+					     old[i]->hash)] = old[i];
+	free(old);
+}
+
+static const struct ltt_string *intern(const char *s, uint32_t len,
+				       int transient)
+{
+	static struct ltt_string *scratch;
+	struct ltt_string *is;
+	uint64_t hash = fnv1a(FNV1A_SEED, s, len);
+	uint32_t i;
+
+	if (2*(intern_count+1) > intern_slots)
+		intern_grow();
+	i = intern_slot(s, len, hash);
+	if (interned[i])
+		return interned[i];
+
+	if (transient && (intern_count >= INTERN_MAX)) {
+		if (!scratch) {
+			scratch = malloc(sizeof(*scratch)+LINEBUF_MAX);
+			assert(scratch);
+		}
+		is = scratch;
+	} else {
+		is = malloc(sizeof(*is)+len+1);
+		assert(is);
+		interned[i] = is;
+		intern_count++;
+	}
+	is->hash = hash;
+	is->len = len;
+	memcpy(is->str, s, len);
+	is->str[len] = '\0';
+	return is;
+}
+
+/* a value of a fixed set, such as names: interned for good */
+const struct ltt_string *intern_string(const char *s)
+{
+	return intern(s, strlen(s), 0);
+}
+
+/*
+ * Values that mostly repeat. Once the table is full, strings that are not
+ * in it come back in a buffer only valid until the next call.
+ */
+const struct ltt_string *intern_format(const char *fmt, ...)
 {
 	va_list ap;
-	static char linebuf[LINEBUF_MAX];
-	static int first_emit = 1;
+	int len;
+	char buf[LINEBUF_MAX];
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf)-1;
+	return intern(buf, (len > 0) ? len : 0, 1);
+}
+
+void intern_free(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < intern_slots; i++)
+		free((void *)interned[i]);
+	free(interned);
+	interned = NULL;
+	intern_slots = intern_count = 0;
+	free(late);
+	late = NULL;
+	nb_late = late_max = 0;
+}
+
+/*
+ * Identical values are dropped, otherwise the trace is declared if needed:
+ * returns 0 when the value goes to the FST writer.
+ */
+static int emit_check(struct ltt_trace *tr, uint64_t key)
+{
+	/*
+	 * Drop values the trace already has. Pass 1 tracks them as well, so
+	 * that time shards start from the same last values.
+	 */
+	if (tr->cached && (tr->last == key)) {
+		if (emit_mode != EMIT_STATE)
+			redundant++;
+		return -1;
+	}
+	tr->cached = 1;
+	tr->last = key;
+
+	/* symbol_flush() will declare every trace pass 1 discovers */
+	if (emit_mode == EMIT_STATE) {
+		first_emit = 0;
+		tr->emitted = 1;
+		return -1;
+	}
+
+	if ((tr->fst_handle == 0) && tr->name && symbol_flushed) {
+		/* only the parent declares traces */
+		if (emit_mode == EMIT_RECORD) {
+			record_failed = 1;
+			return -1;
+		}
+		/* the writer thread must not be using the hierarchy */
+		if (emit_mode == EMIT_PIPELINE)
+			pipeline_drain();
+		insert_late_symbol(tr);
+	}
 
 	if (tr->fst_handle == 0) {
 		fprintf(stderr, "No symbol for '%s'\n", tr->name);
-		return;
+		return -1;
 	}
 
 	if (first_emit) {
@@ -210,33 +562,112 @@ void emit_trace(struct ltt_trace *tr, union ltt_value value, ...)
 		symbol_fst_initvalues();
 	}
 	tr->emitted = 1;
+	return 0;
+}
+
+/* string traces: same as emit_trace(), without formatting */
+void emit_interned(struct ltt_trace *tr, const struct ltt_string *s)
+{
+	if (tr->filtered)
+		return;
+
+	assert(tr->flags == TRACE_SYM_F_STRING);
+	if (emit_check(tr, s->hash) == 0)
+		emit_value(RECORD_STRING, tr, s->str, s->len);
+}
+
+/* string traces: the len bytes of s are emitted as they are */
+void emit_str(struct ltt_trace *tr, const char *s, size_t len)
+{
+	if (tr->filtered)
+		return;
+
+	assert(tr->flags == TRACE_SYM_F_STRING);
+	/* records and pipeline rings take LINEBUF_MAX bytes at most */
+	if (len >= LINEBUF_MAX)
+		len = LINEBUF_MAX-1;
+	if (emit_check(tr, fnv1a(FNV1A_SEED, s, len)) == 0)
+		emit_value(RECORD_STRING, tr, s, len);
+}
+
+/* string traces, with format checks at compile time */
+void emit_fmt(struct ltt_trace *tr, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+	static char linebuf[LINEBUF_MAX];
+
+	if (tr->filtered)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(linebuf, sizeof(linebuf), fmt, ap);
+	va_end(ap);
+	emit_str(tr, linebuf, (len > 0) ? len : 0);
+}
+
+void emit_trace(struct ltt_trace *tr, union ltt_value value, ...)
+{
+	va_list ap;
+	uint64_t key = 0;
+	static char linebuf[LINEBUF_MAX];
+
+	if (tr->filtered)
+		return;
+
 	switch (tr->flags) {
 
 	case TRACE_SYM_F_BITS:
-		fstWriterEmitValueChange(fst_ctx, tr->fst_handle, value.state);
+		key = value.state[0];
 		break;
 
 	case TRACE_SYM_F_U16:
 		assert(value.data <= 0xffff);
 	case TRACE_SYM_F_INTEGER:
-		fstWriterEmitValueChange(fst_ctx, tr->fst_handle, &value.data);
+	case TRACE_SYM_F_ADDR:
+		/* same address, same tag */
+		key = value.data;
 		break;
 
 	case TRACE_SYM_F_ANALOG:
-		fstWriterEmitValueChange(fst_ctx, tr->fst_handle, &value.dataf);
+		memcpy(&key, &value.dataf, sizeof(key));
 		break;
 
 	case TRACE_SYM_F_STRING:
 		va_start(ap, value);
 		vsnprintf(linebuf, LINEBUF_MAX, value.format, ap);
 		va_end(ap);
-		fstWriterEmitVariableLengthValueChange(fst_ctx, tr->fst_handle,
-						       linebuf, strlen(linebuf));
+		key = fnv1a(FNV1A_SEED, linebuf, strlen(linebuf));
+		break;
+	default:
+		assert(0);
+	}
+
+	if (emit_check(tr, key))
+		return;
+
+	switch (tr->flags) {
+
+	case TRACE_SYM_F_BITS:
+		emit_value(RECORD_VALUE, tr, value.state, value_len(tr));
+		break;
+
+	case TRACE_SYM_F_U16:
+	case TRACE_SYM_F_INTEGER:
+		emit_value(RECORD_VALUE, tr, &value.data, value_len(tr));
+		break;
+
+	case TRACE_SYM_F_ANALOG:
+		emit_value(RECORD_VALUE, tr, &value.dataf, value_len(tr));
+		break;
+
+	case TRACE_SYM_F_STRING:
+		emit_value(RECORD_STRING, tr, linebuf, strlen(linebuf));
 		break;
 
 	case TRACE_SYM_F_ADDR:
-		fstWriterEmitValueChange(fst_ctx, tr->fst_handle,
-						 atag_get(value.data));
+		emit_value(RECORD_VALUE, tr, atag_get(value.data),
+			   value_len(tr));
 		break;
 	default:
 		assert(0);
@@ -248,21 +679,68 @@ struct ltt_trace *trace_head(void)
 	return head;
 }
 
-void emit_clock(double clock)
+/* traces created by the event being processed, filters are known by now */
+static void declare_late_traces(void)
 {
-	uint64_t timeval;
-	static uint64_t oldtimeval;
+	struct ltt_trace *tr;
+	unsigned int i;
+
+	for (i = 0; i < nb_late; i++) {
+		tr = late[i];
+		if (tr->fst_handle || tr->filtered)
+			continue;
+		if (emit_mode == EMIT_PIPELINE)
+			pipeline_drain();
+		insert_late_symbol(tr);
+		/* before the first emission, symbol_fst_initvalues() does it */
+		if (tr->fst_handle && !first_emit)
+			emit_value(RECORD_VALUE, tr, "z", 1);
+	}
+}
 
-	timeval = (uint64_t)(1000000000.0*clock);
-	if (timeval < oldtimeval) {
-		DIAG("negative time offset @%lu: %lu !\n", oldtimeval,
-		     (int64_t)timeval - oldtimeval);
-		timeval = oldtimeval + 1;
-	} else if (timeval == oldtimeval) {
-		return;
+void emit_clock(uint64_t clock)
+{
+	uint64_t timeval = clock;
+	struct value_change *vc;
+
+	/* every event source is merged in time order */
+	if (timeval < last_clock)
+		FATAL("negative time offset @%" PRIu64 ": %" PRId64 " !\n",
+		      last_clock, (int64_t)(timeval-last_clock));
+	if (timeval != last_clock) {
+		last_clock = timeval;
+		if (emit_mode == EMIT_PIPELINE) {
+			vc = pipeline_reserve(0);
+			vc->op = RECORD_TIME;
+			vc->time = timeval;
+			pipeline_commit();
+		} else if (emit_mode == EMIT_RECORD) {
+			putc(RECORD_TIME, record_fp);
+			fwrite(&timeval, sizeof(timeval), 1, record_fp);
+		} else if (emit_mode == EMIT_FST) {
+			write_time(timeval);
+		}
+	}
+
+	if (nb_late) {
+		/* shard children cannot declare traces, see emit_check() */
+		if (emit_mode != EMIT_RECORD)
+			declare_late_traces();
+		nb_late = 0;
 	}
-	oldtimeval = timeval;
-	fstWriterEmitTimeChange(fst_ctx, timeval);
+}
+
+/*
+ * Blocks are compressed and written in a thread of the FST writer when a CPU
+ * is spare and the pack type is costly. On a 45 MB trace, zlib -9 blocks take
+ * a quarter of the run time, while lz4 and fastlz ones take under a tenth:
+ * too little to pay for the block copies the thread works on.
+ */
+static int parallel_writer(void)
+{
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+		return 0;
+	return (pack_type == FST_WR_PT_ZLIB) || (pack_type == FST_WR_PT_ZSTD);
 }
 
 void save_dump_init(const char *outfile)
@@ -271,17 +749,206 @@ void save_dump_init(const char *outfile)
 
 	fst_ctx = fstWriterCreate(outfile, 1);
 	assert(fst_ctx);
-	fstWriterSetPackType(fst_ctx, FST_WR_PT_LZ4);
+	fstWriterSetPackType(fst_ctx, pack_type);
+	fstWriterSetPackLevel(fst_ctx, pack_level);
+	/* LTTng clocks are read in nanoseconds */
+	fstWriterSetTimescale(fst_ctx, -9);
 	/* 0 is normal, 1 does the repack (via fstapi) at end */
 	fstWriterSetRepackOnClose(fst_ctx, 0);
-	/* 0 is is single threaded, 1 is multi-threaded */
-	fstWriterSetParallelMode(fst_ctx, 0);
+	fstWriterSetParallelMode(fst_ctx, parallel_writer());
 	fstWriterEmitDumpActive(fst_ctx, 1);
 }
 
+/* pack type by name, NULL keeps lz4; a NULL level is the type default */
+void save_dump_set_pack(const char *name, const char *level)
+{
+	int i;
+	char *end;
+	long val;
+
+	for (i = 0; name && (i < ARRAY_SIZE(pack_types)); i++)
+		if (strcmp(name, pack_types[i].name) == 0)
+			break;
+	if (name && (i == ARRAY_SIZE(pack_types)))
+		FATAL("unknown pack type '%s', expecting zlib, fastlz, lz4 "
+		      "or zstd\n", name);
+	if (name)
+		pack_type = pack_types[i].type;
+#ifndef HAVE_LIBZSTD
+	if (pack_type == FST_WR_PT_ZSTD)
+		FATAL("zstd support is not built in, see 'make ZSTD=1'\n");
+#endif
+
+	for (i = 0; i < ARRAY_SIZE(pack_types); i++)
+		if (pack_types[i].type == pack_type)
+			break;
+	if (!level)
+		return;
+	errno = 0;
+	val = strtol(level, &end, 10);
+	if ((end == level) || *end || errno || (val < 1) ||
+	    (val > pack_types[i].max_level))
+		FATAL("invalid %s pack level '%s', expecting 1 to %d\n",
+		      pack_types[i].name, level, pack_types[i].max_level);
+	pack_level = (int)val;
+}
+
+/* write buffered value changes, so that writer memory stays bounded */
+void save_dump_flush(void)
+{
+	fstWriterFlushContext(fst_ctx);
+}
+
+/* flush the FST writer to a block boundary, and save its state */
+int save_dump_checkpoint(FILE *fp)
+{
+	uint32_t count = 0;
+	struct ltt_trace *tr;
+
+	if (!fstWriterCheckpoint(fst_ctx, fp))
+		return -1;
+	unflushed = 0;
+
+	for (tr = head; tr; tr = tr->next)
+		count++;
+	state_put(fp, &count, sizeof(count));
+	/* names of dead tasks are released, see release_trace_name() */
+	for (tr = head; tr; tr = tr->next) {
+		state_put_str(fp, get_fst_clean_name(tr->name));
+		state_put(fp, &tr->fst_handle, sizeof(tr->fst_handle));
+	}
+	return 0;
+}
+
+/*
+ * Reopen the FST file at the checkpoint. Pass 1 has declared the same
+ * traces again, in the same order: give them back their handles.
+ */
+void save_dump_resume(const char *outfile, FILE *fp)
+{
+	uint32_t count = 0, saved;
+	struct ltt_trace *tr;
+	char name[LINEBUF_MAX];
+
+	out_name = outfile;
+	fst_ctx = fstWriterResume(outfile, fp);
+	if (!fst_ctx)
+		FATAL("cannot resume '%s' from its checkpoint\n", outfile);
+	fstWriterSetPackType(fst_ctx, pack_type);
+	fstWriterSetPackLevel(fst_ctx, pack_level);
+	fstWriterSetParallelMode(fst_ctx, parallel_writer());
+
+	for (tr = head; tr; tr = tr->next)
+		count++;
+	state_get(fp, &saved, sizeof(saved));
+	if (saved != count)
+		state_error("trace count");
+
+	for (tr = head; tr; tr = tr->next) {
+		state_get_str(fp, name, sizeof(name));
+		if (strcmp(name, get_fst_clean_name(tr->name)))
+			state_error(tr->name);
+		state_get(fp, &tr->fst_handle, sizeof(tr->fst_handle));
+		if (tr->fst_handle)
+			tr->fst_name = strdup(get_fst_clean_name(tr->name));
+	}
+	symbol_flushed = 1;
+}
+
+/* emit the value changes of a record file, see symbol_set_emit() */
+void save_dump_replay(FILE *fp)
+{
+	static union {
+		struct value_change vc;
+		char                buf[sizeof(struct value_change)+
+					LINEBUF_MAX];
+	} u;
+	struct value_change *vc = &u.vc;
+
+	while ((vc->op = getc(fp)) != EOF) {
+		if (vc->op == RECORD_TIME) {
+			if (fread(&vc->time, sizeof(vc->time), 1, fp) != 1)
+				break;
+		} else if ((fread(&vc->handle, sizeof(vc->handle), 1,
+				  fp) != 1) ||
+			   (fread(&vc->len, sizeof(vc->len), 1, fp) != 1) ||
+			   (vc->len > LINEBUF_MAX) ||
+			   (vc->len &&
+			    (fread(vc->data, vc->len, 1, fp) != 1))) {
+			break;
+		}
+		save_dump_write(vc);
+	}
+	if (!feof(fp))
+		FATAL("corrupted shard record\n");
+}
+
+/* FST writer call of a value change, see emit_value() */
+void save_dump_write(const struct value_change *vc)
+{
+	if (vc->op == RECORD_TIME)
+		write_time(vc->time);
+	else
+		write_value(vc->op, vc->handle, vc->data, vc->len);
+}
+
+/*
+ * Traces are prepended to the list: traces discovered after the state was
+ * saved come first, and had not been emitted yet.
+ */
+static void symbol_save(FILE *fp)
+{
+	uint32_t count = 0;
+	struct ltt_trace *tr;
+
+	for (tr = head; tr; tr = tr->next)
+		count++;
+	state_put(fp, &count, sizeof(count));
+	for (tr = head; tr; tr = tr->next) {
+		state_put(fp, &tr->emitted, sizeof(tr->emitted));
+		state_put(fp, &tr->cached, sizeof(tr->cached));
+		state_put(fp, &tr->last, sizeof(tr->last));
+	}
+	state_put(fp, &first_emit, sizeof(first_emit));
+	state_put(fp, &last_clock, sizeof(last_clock));
+}
+
+static void symbol_restore(FILE *fp)
+{
+	uint32_t count = 0, saved;
+	struct ltt_trace *tr;
+
+	for (tr = head; tr; tr = tr->next)
+		count++;
+	state_get(fp, &saved, sizeof(saved));
+	if (saved > count)
+		state_error("trace count");
+
+	for (tr = head; tr; tr = tr->next, count--) {
+		if (count > saved) {
+			tr->emitted = 0;
+			tr->cached = 0;
+		} else {
+			state_get(fp, &tr->emitted, sizeof(tr->emitted));
+			state_get(fp, &tr->cached, sizeof(tr->cached));
+			state_get(fp, &tr->last, sizeof(tr->last));
+		}
+	}
+	state_get(fp, &first_emit, sizeof(first_emit));
+	state_get(fp, &last_clock, sizeof(last_clock));
+}
+STATE(symbol);
+
+/* blocks the FST writer wrote early to stay within --max-memory */
+unsigned long save_dump_budget_flushes(void)
+{
+	return budget_flushes;
+}
+
 void save_dump_close(void)
 {
 	INFO("writing output file '%s'...\n", out_name);
+	INFO("%lu redundant value changes dropped\n", redundant);
 	fstWriterEmitDumpActive(fst_ctx, 0);
 	fstWriterClose(fst_ctx);
 }
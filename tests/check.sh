@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# LTTng to GTKwave trace conversion
+#
+# Regression check of the conversion modes: each trace is converted serially,
+# then with -j, --native, --shards, --pipeline and --checkpoint/--resume, and
+# every FST must hold the same value changes as the serial one:
+#   make check [TRACES="<lttng_trace_dir|archive> ..."]
+# Without traces, the check runs on three small CTF traces made by
+# tests/mkctf.py: the second one has events of several streams at the same
+# timestamp, the third one the event headers and metadata of lttng-modules,
+# which --native decodes on its own. Time shards replay the writer calls of
+# the serial conversion: their FST must be the serial one byte for byte, but
+# for its creation date.
+#
+
+PROGRAM=${PROGRAM:-./lttng2lxt}
+TESTS=$(dirname "$0")
+TAB=$(printf '\t')
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+# value changes per trace name, in time order: handle numbers may differ
+dump() {
+	"$TESTS/fstdump" "$1" >"$OUT/dump" || return 1
+	sort -s -t "$TAB" -k1,1 "$OUT/dump" >"$2"
+}
+
+convert() {
+	"$PROGRAM" -N "$@" >/dev/null 2>"$OUT/err" && return 0
+	tail -n 1 "$OUT/err"
+	return 1
+}
+
+if [ $# -eq 0 ]; then
+	python3 "$TESTS/mkctf.py" "$OUT/fixture" || exit 1
+	python3 "$TESTS/mkctf.py" --ties "$OUT/ties" || exit 1
+	python3 "$TESTS/mkctf.py" --lttng "$OUT/lttng" || exit 1
+	set -- "$OUT/fixture" "$OUT/ties" "$OUT/lttng"
+fi
+
+failed=0
+for trace in "$@"; do
+	name=$(basename "$trace")
+	if ! convert "$trace" "$OUT/serial.fst" "$OUT/serial.sav"; then
+		echo "FAIL $name serial"
+		failed=1
+		continue
+	fi
+	if ! dump "$OUT/serial.fst" "$OUT/serial.txt"; then
+		echo "FAIL $name serial: cannot read the FST"
+		failed=1
+		continue
+	fi
+	echo "ok   $name serial"
+
+	for mode in -j --native --shards=4 --pipeline --resume; do
+		rm -f "$OUT/out.fst" "$OUT/out.fst.ckpt"
+		if [ $mode = --resume ]; then
+			# keep the last checkpoint, then resume from it
+			LD_PRELOAD="$TESTS/keep_ckpt.so" convert \
+				--checkpoint=0.000001 "$trace" \
+				"$OUT/out.fst" "$OUT/out.sav" &&
+			{ [ -f "$OUT/out.fst.ckpt" ] ||
+			  { echo "no checkpoint taken"; false; }; } &&
+			convert --resume "$trace" "$OUT/out.fst" "$OUT/out.sav"
+		else
+			convert $mode "$trace" "$OUT/out.fst" "$OUT/out.sav"
+		fi
+		if [ $? -ne 0 ]; then
+			echo "FAIL $name $mode"
+			failed=1
+		elif ! dump "$OUT/out.fst" "$OUT/out.txt"; then
+			echo "FAIL $name $mode: cannot read the FST"
+			failed=1
+		elif ! cmp -s "$OUT/serial.txt" "$OUT/out.txt"; then
+			echo "FAIL $name $mode: FST differs"
+			failed=1
+		elif ! cmp -s "$OUT/serial.sav" "$OUT/out.sav"; then
+			echo "FAIL $name $mode: savefile differs"
+			failed=1
+		elif [ $mode = --shards=4 ] &&
+		     ! { cmp -s -n 202 "$OUT/serial.fst" "$OUT/out.fst" &&
+			 cmp -s -i 321 "$OUT/serial.fst" "$OUT/out.fst"; }; then
+			# the date takes header bytes 202 to 320
+			echo "FAIL $name $mode: FST bytes differ"
+			failed=1
+		else
+			echo "ok   $name $mode"
+		fi
+	done
+done
+exit $failed
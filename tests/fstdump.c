@@ -0,0 +1,107 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+/*
+ * Dump an FST file as text for tests/check.sh, one value change per line:
+ * '<scope>.<trace>', time and value separated by tabs, in time order. Handles
+ * are not printed: conversion modes may number the same traces differently.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "fstapi.h"
+
+#define SCOPE_MAX                 (1024)
+
+static char **names;
+static fstHandle nb_names;
+
+static void add_name(fstHandle handle, const char *scope, const char *name)
+{
+	if (handle >= nb_names) {
+		names = realloc(names, sizeof(*names)*(handle+1));
+		assert(names);
+		memset(names+nb_names, 0, sizeof(*names)*(handle+1-nb_names));
+		nb_names = handle+1;
+	}
+	/* an alias keeps the name of the first trace of its handle */
+	if (names[handle])
+		return;
+	names[handle] = malloc(strlen(scope)+strlen(name)+2);
+	assert(names[handle]);
+	sprintf(names[handle], "%s.%s", scope, name);
+}
+
+static void value_change(void *user, uint64_t time, fstHandle handle,
+			 const unsigned char *value, uint32_t len)
+{
+	printf("%s\t%" PRIu64 "\t%.*s\n", names[handle], time, (int)len,
+	       (const char *)value);
+}
+
+static void value_change_str(void *user, uint64_t time, fstHandle handle,
+			     const unsigned char *value)
+{
+	value_change(user, time, handle, value,
+		     (uint32_t)strlen((const char *)value));
+}
+
+int main(int argc, char **argv)
+{
+	void *ctx;
+	struct fstHier *hier;
+	char scope[SCOPE_MAX] = "";
+	char *dot;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <fstfile>\n", argv[0]);
+		return 1;
+	}
+	ctx = fstReaderOpen(argv[1]);
+	if (!ctx) {
+		fprintf(stderr, "cannot open '%s'\n", argv[1]);
+		return 1;
+	}
+
+	printf("timescale %d start %" PRIu64 " end %" PRIu64 "\n",
+	       fstReaderGetTimescale(ctx), fstReaderGetStartTime(ctx),
+	       fstReaderGetEndTime(ctx));
+
+	while ((hier = fstReaderIterateHier(ctx))) {
+		switch (hier->htyp) {
+		case FST_HT_SCOPE:
+			if (strlen(scope)+strlen(hier->u.scope.name)+2 >
+			    sizeof(scope)) {
+				fprintf(stderr, "scope too deep\n");
+				return 1;
+			}
+			if (scope[0])
+				strcat(scope, ".");
+			strcat(scope, hier->u.scope.name);
+			break;
+		case FST_HT_UPSCOPE:
+			dot = strrchr(scope, '.');
+			*(dot ? dot : scope) = '\0';
+			break;
+		case FST_HT_VAR:
+			add_name(hier->u.var.handle, scope, hier->u.var.name);
+			break;
+		}
+	}
+
+	fstReaderSetFacProcessMaskAll(ctx);
+	fstReaderIterBlocks2(ctx, value_change_str, value_change, NULL, NULL);
+	fstReaderClose(ctx);
+	return 0;
+}
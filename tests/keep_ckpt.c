@@ -0,0 +1,33 @@
+/**
+ * LTTng to GTKwave trace conversion
+ *
+ * Authors:
+ * Ivan Djelic <ivan.djelic@parrot.com>
+ * Matthieu Castet <matthieu.castet@parrot.com>
+ *
+ * Copyright (C) 2013 Parrot S.A.
+ */
+
+/*
+ * LD_PRELOAD helper for tests/check.sh: a complete conversion removes its
+ * checkpoint, this keeps the last one so that --resume can be tested as if
+ * the conversion had been interrupted there.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <dlfcn.h>
+
+int unlink(const char *path)
+{
+	static int (*real_unlink)(const char *);
+	size_t len = strlen(path);
+
+	if ((len > 5) && !strcmp(path+len-5, ".ckpt"))
+		return 0;
+	if (!real_unlink)
+		real_unlink = (int (*)(const char *))dlsym(RTLD_NEXT,
+							   "unlink");
+	return real_unlink(path);
+}
@@ -0,0 +1,405 @@
+#!/usr/bin/env python3
+#
+# LTTng to GTKwave trace conversion
+#
+# Write a small LTTng-like kernel CTF trace for tests/check.sh:
+#   mkctf.py [--ties] [--lttng] [--churn] <trace_dir>
+#            [<events> [<cpus> [<seed>]]]
+# The events are random but reproducible for a given seed. With --ties, some
+# events of different CPUs share a timestamp: babeltrace merges them in its
+# heap order, which every conversion mode has to reproduce. With --lttng, the
+# same events are laid out as lttng-modules does it: packetized metadata,
+# compact and extended event headers, field names with an underscore. With
+# --churn, forked tasks die as new ones come: the number of live tasks stays
+# the same whatever the trace length.
+#
+
+import os
+import random
+import struct
+import sys
+
+CLOCK_START = 1000000000000
+PACKET_SIZE = 4096
+CTF_MAGIC = 0xc1fc1fc1
+METADATA_MAGIC = 0x75d11d57
+UUID = bytes(range(0x10, 0x20))
+# compact event headers: 5-bit id, 27-bit timestamp
+COMPACT_ID_MAX = 30
+EXTENDED_ID = 31
+COMPACT_TS_BITS = 27
+# live tasks with --churn
+CHURN_TASKS = 32
+
+# field types: (tsdl type, struct format), strings are encoded apart
+INT32 = ("int32_t", "<i")
+INT64 = ("int64_t", "<q")
+UINT64 = ("uint64_t", "<Q")
+COMM = ("comm", None)
+STRING = ("string", None)
+
+EVENTS = [
+    ("lttng_statedump_start", []),
+    ("lttng_statedump_end", []),
+    ("lttng_statedump_process_state",
+     [("tid", INT32), ("pid", INT32), ("ppid", INT32), ("name", COMM),
+      ("type", INT32), ("mode", INT32), ("submode", INT32),
+      ("status", INT32)]),
+    ("sched_switch",
+     [("prev_comm", COMM), ("prev_tid", INT32), ("prev_prio", INT32),
+      ("prev_state", INT64), ("next_comm", COMM), ("next_tid", INT32),
+      ("next_prio", INT32)]),
+    ("sched_wakeup",
+     [("comm", COMM), ("tid", INT32), ("prio", INT32),
+      ("target_cpu", INT32)]),
+    ("sched_migrate_task",
+     [("comm", COMM), ("tid", INT32), ("prio", INT32), ("orig_cpu", INT32),
+      ("dest_cpu", INT32)]),
+    ("sched_process_fork",
+     [("parent_comm", COMM), ("parent_tid", INT32), ("parent_pid", INT32),
+      ("child_comm", COMM), ("child_tid", INT32), ("child_pid", INT32)]),
+    ("sched_process_exec",
+     [("filename", STRING), ("tid", INT32), ("old_tid", INT32)]),
+    ("signal_generate",
+     [("sig", INT32), ("errno", INT32), ("code", INT32), ("comm", COMM),
+      ("pid", INT32), ("group", INT32), ("result", INT32)]),
+    ("irq_handler_entry", [("irq", INT32), ("name", STRING)]),
+    ("irq_handler_exit", [("irq", INT32), ("ret", INT32)]),
+    ("softirq_raise", [("vec", INT32)]),
+    ("softirq_entry", [("vec", INT32)]),
+    ("softirq_exit", [("vec", INT32)]),
+]
+SYSCALLS = ["read", "write", "ioctl", "futex"]
+for name in SYSCALLS:
+    EVENTS.append(("syscall_entry_" + name,
+                   [("fd", INT32), ("buf", UINT64), ("count", UINT64)]))
+    EVENTS.append(("syscall_exit_" + name, [("ret", INT64)]))
+EVENTS.append(("sched_process_free",
+               [("comm", COMM), ("tid", INT32), ("prio", INT32)]))
+EVENT_ID = dict((name, i) for i, (name, fields) in enumerate(EVENTS))
+
+METADATA_HEAD = """/* CTF 1.8 */
+
+typealias integer { size = 8; align = 8; signed = false; } := uint8_t;
+typealias integer { size = 32; align = 8; signed = false; } := uint32_t;
+typealias integer { size = 64; align = 8; signed = false; } := uint64_t;
+typealias integer { size = 32; align = 8; signed = true; } := int32_t;
+typealias integer { size = 64; align = 8; signed = true; } := int64_t;
+
+trace {
+	major = 1;
+	minor = 8;
+	uuid = "%s";
+	byte_order = le;
+	packet.header := struct {
+		uint32_t magic;
+		uint8_t  uuid[16];
+		uint32_t stream_id;
+	};
+};
+
+env {
+	hostname = "check";
+	domain = "kernel";
+	sysname = "Linux";
+	tracer_name = "lttng-modules";
+	tracer_major = 2;
+	tracer_minor = 5;
+};
+
+clock {
+	name = monotonic;
+	uuid = "%s";
+	description = "Monotonic Clock";
+	freq = 1000000000;
+	offset = 0;
+};
+
+typealias integer {
+	size = 64; align = 8; signed = false;
+	map = clock.monotonic.value;
+} := uint64_clock_monotonic_t;
+"""
+
+STREAM_PLAIN = """
+stream {
+	id = 0;
+	event.header := struct {
+		uint32_t id;
+		uint64_clock_monotonic_t timestamp;
+	};
+	packet.context := struct {
+		uint64_clock_monotonic_t timestamp_begin;
+		uint64_clock_monotonic_t timestamp_end;
+		uint64_t content_size;
+		uint64_t packet_size;
+		uint64_t packet_seq_num;
+		uint64_t events_discarded;
+		uint32_t cpu_id;
+	};
+};
+"""
+
+STREAM_LTTNG = """
+typealias integer { size = 64; align = 8; signed = false; } := unsigned long;
+typealias integer { size = 5; align = 1; signed = false; } := uint5_t;
+typealias integer {
+	size = 27; align = 1; signed = false;
+	map = clock.monotonic.value;
+} := uint27_clock_monotonic_t;
+
+struct packet_context {
+	uint64_clock_monotonic_t timestamp_begin;
+	uint64_clock_monotonic_t timestamp_end;
+	uint64_t content_size;
+	uint64_t packet_size;
+	uint64_t packet_seq_num;
+	unsigned long events_discarded;
+	uint32_t cpu_id;
+};
+
+struct event_header_compact {
+	enum : uint5_t { compact = 0 ... 30, extended = 31 } id;
+	variant <id> {
+		struct {
+			uint27_clock_monotonic_t timestamp;
+		} compact;
+		struct {
+			uint32_t id;
+			uint64_clock_monotonic_t timestamp;
+		} extended;
+	} v;
+} align(8);
+
+stream {
+	id = 0;
+	event.header := struct event_header_compact;
+	packet.context := struct packet_context;
+};
+"""
+
+COMM_TSDL = ("integer { size = 8; align = 8; signed = false; "
+             "encoding = UTF8; base = 10; }")
+
+
+def uuid_string(uuid):
+    h = uuid.hex()
+    return "%s-%s-%s-%s-%s" % (h[0:8], h[8:12], h[12:16], h[16:20], h[20:])
+
+
+def metadata(lttng):
+    out = [METADATA_HEAD % (uuid_string(UUID), uuid_string(UUID))]
+    out.append(STREAM_LTTNG if lttng else STREAM_PLAIN)
+    prefix = "_" if lttng else ""
+    for i, (name, fields) in enumerate(EVENTS):
+        out.append("\nevent {\n\tname = \"%s\";\n\tid = %d;\n"
+                   "\tstream_id = 0;\n\tfields := struct {\n" % (name, i))
+        for field, (tsdl, fmt) in fields:
+            if tsdl == "comm":
+                out.append("\t\t%s %s%s[16];\n" % (COMM_TSDL, prefix, field))
+            else:
+                out.append("\t\t%s %s%s;\n" % (tsdl, prefix, field))
+        out.append("\t};\n};\n")
+    return "".join(out)
+
+
+def metadata_packets(text):
+    """lttng-modules metadata: packets of a 37-byte header and the text"""
+    out = b""
+    data = text.encode()
+    while data:
+        chunk, data = data[:PACKET_SIZE-37], data[PACKET_SIZE-37:]
+        size = 37+len(chunk)
+        out += struct.pack("<I16sIIIBBBBB", METADATA_MAGIC, UUID, 0,
+                           size*8, PACKET_SIZE*8, 0, 0, 0, 1, 8)
+        out += chunk+b"\0"*(PACKET_SIZE-size)
+    return out
+
+
+def event_header(name, ts, lttng, extended):
+    if not lttng:
+        return struct.pack("<IQ", EVENT_ID[name], ts)
+    if extended or EVENT_ID[name] > COMPACT_ID_MAX:
+        # 5-bit id, padding to the byte, then the extended fields
+        return struct.pack("<BIQ", EXTENDED_ID, EVENT_ID[name], ts)
+    low = ts & ((1 << COMPACT_TS_BITS)-1)
+    return struct.pack("<I", EVENT_ID[name] | (low << 5))
+
+
+def encode(name, values):
+    data = b""
+    for field, (tsdl, fmt) in dict(EVENTS)[name]:
+        value = values[field]
+        if tsdl == "comm":
+            data += value.encode()[:15].ljust(16, b"\0")
+        elif tsdl == "string":
+            data += value.encode() + b"\0"
+        else:
+            data += struct.pack(fmt, value)
+    return data
+
+
+def write_stream(path, cpu, events, lttng):
+    header = struct.pack("<I16sI", CTF_MAGIC, UUID, 0)
+    context_size = 6*8+4
+    seq = 0
+    first = 0
+    with open(path, "wb") as f:
+        while first < len(events):
+            size = len(header)+context_size
+            count = first
+            packet = []
+            while count < len(events):
+                # LTTng writes the first event of a packet with a full
+                # timestamp, some others in the packet take one too
+                ts, name, data = events[count]
+                data = event_header(name, ts, lttng,
+                                    count == first or ts % 7 == 0)+data
+                if size+len(data) > PACKET_SIZE:
+                    break
+                packet.append(data)
+                size += len(data)
+                count += 1
+            f.write(header)
+            f.write(struct.pack("<QQQQQQI", events[first][0],
+                                events[count-1][0], size*8, PACKET_SIZE*8,
+                                seq, 0, cpu))
+            for data in packet:
+                f.write(data)
+            f.write(b"\0"*(PACKET_SIZE-size))
+            first = count
+            seq += 1
+
+
+def generate(nb_events, nb_cpus, seed, ties=False, churn=False):
+    rand = random.Random(seed)
+    tie = random.Random(seed)
+    streams = [[] for cpu in range(nb_cpus)]
+    clock = [CLOCK_START]
+    last_cpu = [0]
+
+    def emit(cpu, event, **values):
+        clock[0] += 1
+        streams[cpu].append((clock[0], event, encode(event, values)))
+        last_cpu[0] = cpu
+
+    tasks = dict((100+i, "task%d" % i) for i in range(8))
+    first_tasks = set(tasks)
+    current = [0]*nb_cpus
+    irqs = {11: "eth0", 27: "timer", 33: "mmc0"}
+
+    emit(0, "lttng_statedump_start")
+    for tid, name in sorted(tasks.items()):
+        emit(0, "lttng_statedump_process_state", tid=tid, pid=tid, ppid=1,
+             name=name, type=0, mode=0, submode=0, status=5)
+    emit(0, "lttng_statedump_end")
+
+    for i in range(nb_events):
+        clock[0] += rand.randint(100, 3000)
+        cpu = rand.randrange(nb_cpus)
+        tid = current[cpu]
+        r = rand.random()
+        if ties and nb_cpus > 1 and tie.random() < 0.3:
+            # another CPU wakes the task of the last event up, at the same
+            # time: the merge order shows in the task state trace
+            other = current[last_cpu[0]] or rand.choice(sorted(tasks))
+            clock[0] = streams[last_cpu[0]][-1][0]-1
+            emit((last_cpu[0]+1+tie.randrange(nb_cpus-1)) % nb_cpus,
+                 "sched_wakeup", comm=tasks[other], tid=other, prio=20,
+                 target_cpu=last_cpu[0])
+        elif r < 0.3:
+            nxt = rand.choice([0]+sorted(tasks))
+            emit(cpu, "sched_switch",
+                 prev_comm=tasks.get(tid, "swapper/%d" % cpu), prev_tid=tid,
+                 prev_prio=20, prev_state=rand.choice([0, 1]),
+                 next_comm=tasks.get(nxt, "swapper/%d" % cpu), next_tid=nxt,
+                 next_prio=20)
+            current[cpu] = nxt
+        elif r < 0.45:
+            irq = rand.choice(sorted(irqs))
+            emit(cpu, "irq_handler_entry", irq=irq, name=irqs[irq])
+            clock[0] += rand.randint(10, 500)
+            emit(cpu, "irq_handler_exit", irq=irq, ret=1)
+        elif r < 0.55:
+            vec = rand.randrange(10)
+            emit(cpu, "softirq_raise", vec=vec)
+            emit(cpu, "softirq_entry", vec=vec)
+            clock[0] += rand.randint(10, 400)
+            emit(cpu, "softirq_exit", vec=vec)
+        elif r < 0.8 and tid:
+            name = rand.choice(SYSCALLS)
+            emit(cpu, "syscall_entry_" + name, fd=rand.randrange(10),
+                 buf=rand.randrange(1 << 31), count=rand.randrange(4096))
+            clock[0] += rand.randint(100, 5000)
+            emit(cpu, "syscall_exit_" + name, ret=rand.randrange(-5, 4096))
+        elif r < 0.88:
+            other = rand.choice(sorted(tasks))
+            emit(cpu, "sched_wakeup", comm=tasks[other], tid=other,
+                 prio=20, target_cpu=cpu)
+        elif r < 0.91:
+            other = rand.choice(sorted(tasks))
+            emit(cpu, "sched_migrate_task", comm=tasks[other], tid=other,
+                 prio=20, orig_cpu=cpu, dest_cpu=rand.randrange(nb_cpus))
+        elif r < 0.94:
+            other = rand.choice(sorted(tasks))
+            emit(cpu, "signal_generate", sig=rand.choice([2, 9, 15, 17]),
+                 errno=0, code=0, comm=tasks[other], pid=other, group=0,
+                 result=0)
+        elif r < 0.97:
+            if churn and len(tasks) >= CHURN_TASKS:
+                # the oldest child that is not running goes first
+                gone = min(t for t in tasks
+                           if t not in first_tasks and t not in current)
+                emit(cpu, "sched_process_free", comm=tasks[gone], tid=gone,
+                     prio=20)
+                del tasks[gone]
+            parent = rand.choice(sorted(tasks))
+            child = max(tasks)+1
+            tasks[child] = tasks[parent]
+            emit(cpu, "sched_process_fork", parent_comm=tasks[parent],
+                 parent_tid=parent, parent_pid=parent,
+                 child_comm=tasks[child], child_tid=child, child_pid=child)
+        else:
+            other = rand.choice(sorted(tasks))
+            tasks[other] += "x"
+            emit(cpu, "sched_process_exec", filename="/bin/" + tasks[other],
+                 tid=other, old_tid=other)
+    return streams
+
+
+def main():
+    args = sys.argv[1:]
+    ties = "--ties" in args
+    if ties:
+        args.remove("--ties")
+    lttng = "--lttng" in args
+    if lttng:
+        args.remove("--lttng")
+    churn = "--churn" in args
+    if churn:
+        args.remove("--churn")
+    if len(args) < 1:
+        sys.stderr.write("usage: %s [--ties] [--lttng] [--churn] "
+                         "<trace_dir> [<events> [<cpus> [<seed>]]]\n"
+                         % sys.argv[0])
+        return 1
+    path = os.path.join(args[0], "kernel")
+    nb_events = int(args[1]) if len(args) > 1 else 20000
+    nb_cpus = int(args[2]) if len(args) > 2 else 4
+    seed = int(args[3]) if len(args) > 3 else 1
+
+    os.makedirs(path)
+    with open(os.path.join(path, "metadata"), "wb") as f:
+        if lttng:
+            f.write(metadata_packets(metadata(lttng)))
+        else:
+            f.write(metadata(lttng).encode())
+    streams = generate(nb_events, nb_cpus, seed, ties, churn)
+    for cpu, events in enumerate(streams):
+        write_stream(os.path.join(path, "channel0_%d" % cpu), cpu, events,
+                     lttng)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())